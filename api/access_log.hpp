@@ -0,0 +1,117 @@
+#ifndef _ACCESS_LOG_HPP
+#define _ACCESS_LOG_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+
+namespace http
+{
+
+// A segment file is an AccessLogHeader followed by records, each an
+// AccessRecord and uriSize bytes of URI, padded to ACCESS_RECORD_ALIGNMENT.
+// Numbers are in host byte order, shs-access-log turns segments into text or JSON.
+
+#define ACCESS_LOG_MAGIC "SHSALOG1"
+
+enum {
+    ACCESS_LOG_VERSION = 1,
+    ACCESS_LOG_BATCH_SIZE = 65536,          // bytes a worker collects before handing them over
+    ACCESS_LOG_FLUSH_MS = 1000,             // a batch older than this is collected by the writer
+    ACCESS_LOG_MAX_QUEUED = 64,             // batches waiting for the writer, more are dropped
+    ACCESS_LOG_SEGMENT_SIZE = 67108864,     // 64 Mb, a bigger segment is rotated
+    ACCESS_LOG_SEGMENT_SECONDS = 3600,      // an older segment is rotated
+    ACCESS_LOG_MAX_URI = 2048,              // longer URIs are truncated
+    ACCESS_RECORD_ALIGNMENT = 8,
+};
+
+struct AccessLogHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize; // sizeof(AccessRecord) of the writer
+};
+
+struct AccessRecord
+{
+    uint64_t timestamp; // ns since the epoch, when the request arrived
+    uint64_t bytes;     // response bytes sent
+    uint32_t latency;   // us from receiving the request to sending the response
+    uint16_t status;
+    uint16_t uriSize;
+    uint8_t method;     // Command
+    uint8_t family;     // AF_INET, AF_INET6 or AF_UNIX without an address
+    uint16_t port;
+    uint8_t addr[16];
+};
+
+// Binary access log. Workers append records to a buffer of their own, so a
+// request costs a copy of the record and an uncontended lock. Full buffers go
+// to a writer thread that writes all it has with one writev() and rotates
+// segments by size and age, and that picks up buffers left aging by idle
+// workers. A worker never waits for the disk, batches are dropped if the
+// writer lags.
+class AccessLog
+{
+public:
+    AccessLog(const std::filesystem::path &dir,
+              size_t segmentSize = ACCESS_LOG_SEGMENT_SIZE,
+              time_t segmentSeconds = ACCESS_LOG_SEGMENT_SECONDS);
+    ~AccessLog();
+
+    AccessLog(const AccessLog&) = delete;
+    AccessLog &operator=(const AccessLog&) = delete;
+
+    void start(std::error_code &ec);
+    // writes out the records of all workers, later ones are dropped
+    void stop();
+
+    void append(const AccessRecord &record, std::string_view uri);
+
+    // records lost because the writer could not keep up or could not write them
+    uint64_t dropped() const
+    {
+        return m_dropped;
+    }
+
+private:
+    struct Batch
+    {
+        char data[ACCESS_LOG_BATCH_SIZE];
+        size_t size = 0;
+        size_t records = 0;
+        uint64_t first = 0; // timestamp of the first record
+    };
+
+    friend struct AccessLogWorker;
+
+    std::unique_ptr<Batch> submit(std::unique_ptr<Batch> batch);
+    void collect(uint64_t cutoff);
+    void writer(std::stop_token st);
+    bool open_segment();
+
+private:
+    std::filesystem::path m_dir;
+    size_t m_segmentSize;
+    time_t m_segmentSeconds;
+    int m_fd;
+    size_t m_segmentBytes;
+    time_t m_segmentStart;
+    unsigned m_segmentSeq;
+    std::mutex m_mutex;
+    std::condition_variable_any m_cv;
+    std::vector<std::unique_ptr<Batch>> m_queue;
+    std::vector<std::unique_ptr<Batch>> m_free;
+    std::atomic<uint64_t> m_dropped;
+    std::jthread m_writer;
+};
+
+}// namespace http
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _ADMISSION_HPP
+#define _ADMISSION_HPP
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include "tcp_connection.hpp"
+
+namespace http
+{
+
+enum {
+    ADMISSION_PENDING_PER_SLOT = 4, // accepted connections waiting for a thread, per thread
+    ADMISSION_TARGET_MS = 50,       // queueing delay that is fine
+    ADMISSION_INTERVAL_MS = 500,    // a longer delay for that long starts shedding
+};
+
+enum AdmissionDecision
+{
+    ADMISSION_RUN = 0,  // a thread is free for the connection
+    ADMISSION_QUEUED,   // the connection waits for a thread to finish its connection
+    ADMISSION_REJECT,   // the queue is full
+};
+
+enum AdmissionNext
+{
+    ADMISSION_NONE = 0, // nothing is waiting, the thread slot is released
+    ADMISSION_SERVE,    // the thread serves the connection it got
+    ADMISSION_SHED,     // the connection waited too long and has to be rejected
+};
+
+// Caps the connection threads at maxActive. Connections over the cap wait in a
+// bounded queue and are taken over by threads finishing their connections.
+// The queue is shed CoDel style: once the delay of the connections leaving it
+// stayed above ADMISSION_TARGET_MS for ADMISSION_INTERVAL_MS, connections are
+// dropped at a rate rising with the square root of the drops until it falls again.
+class AdmissionControl
+{
+public:
+    AdmissionControl();
+
+    void limits(unsigned maxActive, unsigned maxPending);
+
+    // called by the accept loop for every new connection
+    AdmissionDecision admit(const Connection &conn);
+
+    // called by a thread whose connection is done, conn is the next one for it
+    AdmissionNext next(Connection &conn);
+
+    // a thread holding an idle connection should give it up
+    bool waiting() const;
+
+    unsigned active() const;
+
+    unsigned limit() const;
+
+    // a queued connection for a new thread, while the limit allows one, e.g. after it was raised
+    bool promote(Connection &conn);
+
+    // mean time the connections that left the queue since the last call waited, in ns
+    uint64_t queue_delay();
+
+private:
+    bool shed(uint64_t sojourn, uint64_t now);
+
+private:
+    struct Pending
+    {
+        Connection conn;
+        uint64_t queued; // CLOCK_MONOTONIC ns
+    };
+
+    mutable std::mutex m_mutex;
+    std::deque<Pending> m_pending;
+    unsigned m_active;
+    unsigned m_maxActive;
+    unsigned m_maxPending;
+    // CoDel state
+    uint64_t m_firstAbove;  // when the delay will have been above the target for an interval
+    uint64_t m_dropNext;
+    unsigned m_dropCount;
+    bool m_dropping;
+    uint64_t m_delaySum;
+    unsigned m_delayCount;
+};
+
+}// namespace http
+
+#endif
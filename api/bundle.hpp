@@ -0,0 +1,148 @@
+#ifndef _BUNDLE_HPP
+#define _BUNDLE_HPP
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <system_error>
+#include "content_source.hpp"
+
+namespace http
+{
+
+// A site bundle is a whole document root packed into one file:
+//
+//   BundleHeader
+//   BundleRecord[count]   sorted by path
+//   uint32_t[slots]       open addressing hash table, record index + 1, 0 is a free slot
+//   strings               paths, ETags and Last-Modified dates, not terminated
+//   blobs                 raw and deflated file bodies, page aligned for sendfile
+//
+// All numbers are in host byte order, a bundle is built for the machine serving it.
+
+#define BUNDLE_MAGIC "SHSBNDL1"
+
+enum {
+    BUNDLE_VERSION = 2,           // 2 has the ETags of the deflated bodies
+    BUNDLE_BLOB_ALIGNMENT = 4096, // blobs of at least a page start on a page boundary
+    BUNDLE_SMALL_BLOB_ALIGNMENT = 16,
+};
+
+struct BundleHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint32_t slots; // a power of two, at least twice the count
+    uint32_t reserved;
+    uint64_t recordsOffset;
+    uint64_t tableOffset;
+    uint64_t stringsOffset;
+    uint64_t size;
+};
+
+struct BundleRecord
+{
+    uint64_t hash;
+    uint32_t pathOffset; // string offsets are relative to stringsOffset
+    uint32_t pathSize;
+    uint32_t etagOffset;
+    uint32_t etagSize;
+    uint32_t lastModifiedOffset;
+    uint32_t lastModifiedSize;
+    uint32_t type; // ContentType
+    uint32_t deflateEtagOffset;
+    uint32_t deflateEtagSize;
+    uint32_t reserved;
+    int64_t mtime;
+    uint64_t rawOffset;
+    uint64_t rawSize;
+    uint64_t deflateOffset;
+    uint64_t deflateSize; // 0 if the deflated body is not smaller and was not stored
+};
+
+// FNV-1a, shared by the builder and the server
+inline uint64_t bundle_hash(std::string_view path)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : path)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// A mapped and validated bundle file
+class Bundle
+{
+public:
+    Bundle();
+    ~Bundle();
+
+    Bundle(const Bundle&) = delete;
+    Bundle &operator=(const Bundle&) = delete;
+
+    void open(const std::filesystem::path &path, std::error_code &ec);
+
+    // one hash probe sequence, nullptr if there is no such path
+    const BundleRecord *find(std::string_view path) const;
+
+    std::string_view string(uint32_t offset, uint32_t size) const
+    {
+        return std::string_view(m_strings + offset, size);
+    }
+
+    const char *data() const
+    {
+        return m_data;
+    }
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    uint32_t count() const
+    {
+        return m_header->count;
+    }
+
+private:
+    bool validate() const;
+
+private:
+    int m_fd;
+    const char *m_data;
+    size_t m_size;
+    const BundleHeader *m_header;
+    const BundleRecord *m_records;
+    const uint32_t *m_table;
+    const char *m_strings;
+};
+
+// Serves a site bundle. reload() maps the bundle file again and swaps it in
+// atomically, requests in flight keep the bundle they started with.
+class BundleSource : public ContentSource
+{
+public:
+    BundleSource(const std::filesystem::path &path);
+
+    BundleSource(const BundleSource&) = delete;
+    BundleSource &operator=(const BundleSource&) = delete;
+
+    void start(std::error_code &ec);
+
+    void lookup(const std::string &path, Asset &out, std::error_code &ec) override;
+    void reload(std::error_code &ec) override;
+
+private:
+    std::filesystem::path m_path;
+    std::atomic<std::shared_ptr<const Bundle>> m_bundle;
+};
+
+}// namespace http
+
+#endif
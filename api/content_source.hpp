@@ -0,0 +1,67 @@
+#ifndef _CONTENT_SOURCE_HPP
+#define _CONTENT_SOURCE_HPP
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <sys/types.h>
+
+namespace http
+{
+
+// Everything RequestHandler needs to answer GET and HEAD for one resource
+struct Asset
+{
+    const char *data;          // identity bytes in memory, may be nullptr if fd is set
+    size_t size;
+    int fd;                    // descriptor to sendfile the identity bytes from, -1 if there is none
+    off_t fileOffset;          // position of the identity bytes in fd
+    time_t mtime;
+    const char *contentType;
+    std::string_view etag;
+    std::string_view deflatedEtag; // the deflated representation is tagged apart from the identity one
+    std::string_view lastModified;
+    std::string_view deflated; // empty while no deflated copy is available
+    bool deflatable;           // false if the resource is always sent as is
+    std::shared_ptr<const void> holder;         // keeps data, fd and the strings alive
+    std::shared_ptr<const void> deflatedHolder; // keeps deflated alive
+
+    Asset()
+    : data{nullptr},
+      size{0},
+      fd{-1},
+      fileOffset{0},
+      mtime{0},
+      contentType{nullptr},
+      etag{},
+      deflatedEtag{},
+      lastModified{},
+      deflated{},
+      deflatable{false},
+      holder{},
+      deflatedHolder{}
+    {}
+};
+
+// A place the server takes its resources from
+class ContentSource
+{
+public:
+    virtual ~ContentSource() = default;
+
+    // path must be normalized by normalize_uri()
+    virtual void lookup(const std::string &path, Asset &out, std::error_code &ec) = 0;
+
+    // makes asset.deflated available, sources with precompressed data have it set by lookup()
+    virtual void deflate(Asset &asset, std::error_code &ec)
+    {}
+
+    // picks up a new version of the content, e.g. on SIGHUP
+    virtual void reload(std::error_code &ec)
+    {}
+};
+
+}// namespace http
+
+#endif
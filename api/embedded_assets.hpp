@@ -0,0 +1,94 @@
+#ifndef _EMBEDDED_ASSETS_HPP
+#define _EMBEDDED_ASSETS_HPP
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include "mime.hpp"
+#include "content_source.hpp"
+
+namespace http
+{
+
+// A file compiled into the binary, see shs_embed_assets() in CMakeLists.txt
+struct EmbeddedAsset
+{
+    std::string_view path;
+    const char *data;
+    size_t size;
+    const char *deflated; // nullptr if deflating does not make the file smaller
+    size_t deflatedSize;
+    ContentType type;
+    time_t mtime;
+    std::string_view etag;
+    std::string_view deflatedEtag; // empty if deflated is nullptr
+    std::string_view lastModified;
+};
+
+// The generated table. The path index is a hash and displace perfect hash:
+// the bucket of a path picks a seed, the seed picks a slot that no other path uses.
+struct EmbeddedAssets
+{
+    const EmbeddedAsset *assets;
+    size_t count;
+    const uint32_t *seeds;   // per bucket
+    size_t buckets;
+    const uint32_t *slots;   // asset index + 1, 0 is a free slot
+    size_t slotCount;
+};
+
+constexpr uint64_t embedded_hash(std::string_view path, uint32_t seed)
+{
+    uint64_t hash = 14695981039346656037ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+    for (char c : path)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash ^ (hash >> 32);
+}
+
+constexpr const EmbeddedAsset *embedded_find(const EmbeddedAssets &table, std::string_view path)
+{
+    if (table.count == 0)
+        return nullptr;
+    uint32_t seed = table.seeds[embedded_hash(path, 0) % table.buckets];
+    uint32_t index = table.slots[embedded_hash(path, seed) % table.slotCount];
+    if (index == 0 || table.assets[index - 1].path != path)
+        return nullptr;
+    return &table.assets[index - 1];
+}
+
+// used by the generated code to prove the index at compile time
+constexpr bool embedded_table_is_perfect(const EmbeddedAssets &table)
+{
+    for (size_t i = 0; i < table.count; ++i)
+    {
+        if (embedded_find(table, table.assets[i].path) != &table.assets[i])
+            return false;
+    }
+    return true;
+}
+
+// defined by the translation unit generated by shs-embed
+extern const EmbeddedAssets EMBEDDED_ASSETS;
+
+// Serves the assets compiled into the binary, nothing is read or compressed at run time
+class EmbeddedSource : public ContentSource
+{
+public:
+    EmbeddedSource(const EmbeddedAssets &assets)
+    : m_assets{assets}
+    {}
+
+    void lookup(const std::string &path, Asset &out, std::error_code &ec) override;
+
+private:
+    const EmbeddedAssets &m_assets;
+};
+
+}// namespace http
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef _FILE_CACHE_HPP
+#define _FILE_CACHE_HPP
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+#include <system_error>
+#include <sys/types.h>
+#include "mime.hpp"
+#include "path_resolver.hpp"
+#include "content_source.hpp"
+
+namespace http
+{
+
+// IMF-fixdate used by Last-Modified and If-Modified-Since
+#define HTTP_DATE_FORMAT "%a, %d %b %Y %H:%M:%S GMT"
+
+enum {
+    FILE_CACHE_SHARDS = 16,
+    FILE_CACHE_CAPACITY = 268435456, // 256 Mb of files and their deflated copies, split evenly between the shards
+    FILE_CACHE_MAX_FILE_SIZE = 10485760, // 10 Mb, larger files are opened per request
+};
+
+// An open file together with the metadata needed to serve it. The body is
+// sent from the descriptor, a mapping would raise SIGBUS when the file is
+// truncated under a reader.
+struct FileEntry
+{
+    std::string path;
+    OpenFilePtr file;
+    size_t size;
+    struct timespec mtime;
+    ino_t inode;
+    ContentType type;
+    std::string etag;
+    std::string deflatedEtag;
+    char lastModified[32];
+    mutable std::atomic<std::shared_ptr<const std::string>> deflated; // set once the file has been deflated
+
+    FileEntry()
+    : path{},
+      file{},
+      size{0},
+      mtime{},
+      inode{0},
+      type{UNKNOWN},
+      etag{},
+      deflatedEtag{},
+      lastModified{},
+      deflated{}
+    {}
+
+    FileEntry(const FileEntry&) = delete;
+    FileEntry &operator=(const FileEntry&) = delete;
+};
+
+typedef std::shared_ptr<const FileEntry> FileEntryPtr;
+
+// Cache of open files under the document root.
+// Entries are never re-validated on lookup, they are dropped by an inotify
+// watcher as soon as the file or one of its parent directories changes,
+// so a hit costs a hash lookup and no system calls. A shard over its share
+// of the capacity or of the open descriptors drops its least recently used
+// entries. Files of a directory inotify could not watch are opened per request.
+class FileCache : public ContentSource
+{
+public:
+    FileCache(const std::filesystem::path &root, size_t capacity = FILE_CACHE_CAPACITY);
+    ~FileCache() override;
+
+    FileCache(const FileCache&) = delete;
+    FileCache(FileCache &&) = delete;
+    FileCache &operator=(const FileCache &) = delete;
+    FileCache &operator=(FileCache &&) = delete;
+
+    void start(std::error_code &ec);
+    void stop();
+
+    // path must be normalized by normalize_uri()
+    FileEntryPtr get(const std::string &path, std::error_code &ec);
+
+    // Deflated copy of the file. The first caller for a given path and ETag
+    // compresses it, concurrent callers wait for and share that result.
+    std::shared_ptr<const std::string> deflate(const FileEntry &entry, std::error_code &ec);
+
+    void lookup(const std::string &path, Asset &out, std::error_code &ec) override;
+    void deflate(Asset &asset, std::error_code &ec) override;
+    void reload(std::error_code &ec) override;
+
+    // drops the entry and, if path is a directory, everything below it
+    void invalidate(const std::string &path);
+    void clear();
+
+    const std::filesystem::path &root() const
+    {
+        return m_root;
+    }
+
+    size_t cached_bytes() const
+    {
+        return m_cachedBytes;
+    }
+
+private:
+    struct Slot
+    {
+        FileEntryPtr entry;
+        std::list<const std::string *>::iterator lru;
+        size_t bytes;       // the file and its deflated copy
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, Slot> entries;
+        std::list<const std::string *> lru; // keys of entries, the most recently used first
+        size_t bytes = 0;
+    };
+
+    // a compression in progress
+    struct Flight
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done = false;
+        std::shared_ptr<const std::string> result;
+        std::error_code ec;
+    };
+
+    Shard &shard(const std::string &path)
+    {
+        return m_shards[std::hash<std::string>{}(path) % FILE_CACHE_SHARDS];
+    }
+
+    FileEntryPtr load(const std::string &path, bool keep, std::error_code &ec);
+    void erase(Shard &s, std::unordered_map<std::string, Slot>::iterator iter);
+    void evict(Shard &s);
+    void charge_deflated(const FileEntry &entry, size_t bytes);
+    void invalidate_file(const std::string &path);
+    bool watched(const std::string &path);
+    void add_watch(const std::string &dir);
+    void watch_tree(const std::string &dir);
+    void watcher(std::stop_token st);
+
+private:
+    std::filesystem::path m_root;
+    PathResolver m_resolver;
+    size_t m_capacity;
+    size_t m_maxFiles;      // entries hold their descriptors, see cached_descriptors_limit()
+    std::atomic<size_t> m_cachedBytes;
+    std::atomic<unsigned long> m_generation;
+    std::array<Shard, FILE_CACHE_SHARDS> m_shards;
+    int m_inotifyFd;
+    std::mutex m_watchMutex;
+    std::unordered_map<int, std::string> m_watches;
+    std::unordered_set<std::string> m_unwatched; // directories inotify_add_watch() failed for
+    std::jthread m_watcher;
+    std::mutex m_flightMutex;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> m_flights;
+};
+
+}// namespace http
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef _FILE_IO_HPP
+#define _FILE_IO_HPP
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+namespace http
+{
+
+enum {
+    FILE_IO_THREADS = 4,            // reads of cold files in parallel, more would only queue up on the disk
+    FILE_IO_QUEUE = 64,             // reads waiting for a thread, the caller reads on its own past that
+    FILE_IO_CHUNK = 524288,         // files are sent and read ahead in chunks of that size
+    FILE_IO_SCRATCH = 262144,       // a thread reads a chunk through a buffer of that size
+    FILE_IO_POLL_MS = 1,            // an HTTP/2 connection waiting for a read polls that often
+};
+
+// A file range being read into the page cache
+class FileRead
+{
+public:
+    bool done() const;
+    void wait() const;
+
+private:
+    friend class FileIo;
+
+    int m_fd;
+    off_t m_offset;
+    size_t m_length;
+    std::shared_ptr<const void> m_holder;   // keeps m_fd open
+    uint64_t m_queued;
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_cv;
+    bool m_done = false;
+};
+
+typedef std::shared_ptr<FileRead> FileReadPtr;
+
+// Asynchronous file reads off the connection threads. sendfile(), pread() and
+// page faults on a mapping go to the disk when a file is not in the page cache,
+// and a connection thread, or all the streams of an HTTP/2 connection, stalls
+// meanwhile. A range is probed with preadv2(RWF_NOWAIT) first, which fails
+// instead of waiting, and only a miss is queued to a small pool of threads that
+// pull it into the page cache, while the caller sends what is there already.
+class FileIo
+{
+public:
+    static FileIo &instance();
+
+    ~FileIo();
+
+    FileIo(const FileIo&) = delete;
+    FileIo &operator=(const FileIo &) = delete;
+
+    // nullptr if the range is in the page cache, or if the queue is full and
+    // the caller is better off reading it itself; holder keeps fd open until
+    // the read is done, it may be empty if the caller waits for it anyway
+    FileReadPtr prefetch(int fd, off_t offset, size_t length, std::shared_ptr<const void> holder);
+
+private:
+    FileIo();
+
+    void worker(std::stop_token st);
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable_any m_cv;
+    std::deque<FileReadPtr> m_queue;
+    std::vector<std::jthread> m_threads;
+};
+
+}// namespace http
+
+#endif
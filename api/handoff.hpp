@@ -0,0 +1,39 @@
+#ifndef _HANDOFF_HPP
+#define _HANDOFF_HPP
+#include <system_error>
+#include <vector>
+
+namespace http
+{
+
+enum {
+    HANDOFF_RECEIVE_TIMEOUT_SECONDS = 5,
+    HANDOFF_CONFIRM_TIMEOUT_MS = 60000, // the new process warms up its caches before it confirms
+    HANDOFF_MAX_SOCKETS = 16,           // the TCP listener and the Unix ones of listen_unix()
+};
+
+// Live upgrade: a running server offers its listening sockets on the abstract
+// Unix socket "@simple-http-server-<port>". A new process connects, gets the
+// sockets with SCM_RIGHTS and accepts on them alongside the old one. When it is
+// ready it confirms, and the old process stops accepting and drains. Only a
+// peer of the same user is answered.
+
+// the connection to the running server and its listening sockets, the TCP one first,
+// -1 if no server offers them
+int handoff_receive(int port, std::vector<int> &listenFds, std::error_code &ec);
+
+// tells the old server over the connection from handoff_receive() that it can drain, closes it
+void handoff_confirm(int peer, std::error_code &ec);
+
+// the Unix socket to offer the listening socket on
+int handoff_listen(int port, std::error_code &ec);
+
+// sends listenFds to a peer accepted on the socket from handoff_listen()
+void handoff_send(int peer, const std::vector<int> &listenFds, std::error_code &ec);
+
+// whether the peer confirmed, waits for it up to timeoutMs
+bool handoff_confirmed(int peer, int timeoutMs);
+
+}// namespace http
+
+#endif
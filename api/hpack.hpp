@@ -0,0 +1,112 @@
+#ifndef _HPACK_HPP
+#define _HPACK_HPP
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace http
+{
+
+enum {
+    HPACK_TABLE_SIZE = 4096,         // SETTINGS_HEADER_TABLE_SIZE, the default of both directions
+    HPACK_ENTRY_OVERHEAD = 32,       // counted per entry on top of the name and the value
+    HPACK_STATIC_ENTRIES = 61,
+    HPACK_MAX_HEADER_LIST = 65536,   // decoded name, value and overhead of a block, as the HTTP/1 request buffer
+};
+
+typedef std::pair<std::string, std::string> HeaderField;
+
+// A dynamic table of one direction of a connection behind the static table,
+// index 1 is the first static entry and index 62 the newest dynamic one.
+class HpackTable
+{
+public:
+    HpackTable()
+    : m_entries{},
+      m_size{0},
+      m_maxSize{HPACK_TABLE_SIZE}
+    {}
+
+    // the newest entries are kept, entries larger than the table empty it
+    void add(std::string_view name, std::string_view value);
+
+    void max_size(size_t value);
+
+    size_t max_size() const
+    {
+        return m_maxSize;
+    }
+
+    // of the entries, with HPACK_ENTRY_OVERHEAD each
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    // nullptr if index is out of range
+    const HeaderField *get(size_t index) const;
+
+    // index of the name and value, or of the name only if nameOnly is set, 0 if there is none
+    size_t find(std::string_view name, std::string_view value, bool &nameOnly) const;
+
+private:
+    void evict(size_t limit);
+
+private:
+    std::deque<HeaderField> m_entries; // the newest first
+    size_t m_size;
+    size_t m_maxSize;
+};
+
+class HpackDecoder
+{
+public:
+    // a header block, names as they were sent; a block the table cannot follow is
+    // HTTP_ERR_BAD_REQUEST and ends the connection, a list over HPACK_MAX_HEADER_LIST
+    // is HTTP_ERR_HEADER_FIELDS_TOO_LARGE with the table still in step
+    void decode(std::string_view block, std::vector<HeaderField> &fields, std::error_code &ec);
+
+    const HpackTable &table() const
+    {
+        return m_table;
+    }
+
+private:
+    HpackTable m_table;
+};
+
+class HpackEncoder
+{
+public:
+    HpackEncoder()
+    : m_table{},
+      m_sizeUpdate{false}
+    {}
+
+    // SETTINGS_HEADER_TABLE_SIZE of the peer, the table never grows past HPACK_TABLE_SIZE
+    void max_size(size_t value);
+
+    // starts a header block, a table size change is announced in front of it
+    void begin(std::string &out);
+
+    // fields seen before are sent as an index, the others are added to the table
+    // unless they differ from response to response anyway
+    void encode(std::string_view name, std::string_view value, std::string &out);
+
+private:
+    HpackTable m_table;
+    bool m_sizeUpdate;
+};
+
+// The Huffman code of RFC 7541 appendix B, decoding fails on EOS and on bad padding
+bool huffman_decode(std::string_view in, std::string &out);
+void huffman_encode(std::string_view in, std::string &out);
+size_t huffman_length(std::string_view in);
+
+}// namespace http
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef _HTTP2_HPP
+#define _HTTP2_HPP
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "http_server.hpp"
+#include "hpack.hpp"
+#include "file_io.hpp"
+
+namespace http
+{
+
+enum {
+    H2_PREFACE_SIZE = 24,
+    H2_FRAME_HEADER_SIZE = 9,
+    H2_FRAME_SIZE = 16384,              // the frames of both sides, larger SETTINGS_MAX_FRAME_SIZE of a peer are not used
+    H2_MAX_FRAME_SIZE = 16777215,
+    H2_WINDOW = 65535,                  // initial flow control window of a connection and of its streams
+    H2_MAX_WINDOW = 2147483647,
+    H2_MAX_STREAMS = 32,                // SETTINGS_MAX_CONCURRENT_STREAMS, a stream holds a RequestHandler
+    H2_RESET_STREAMS = 2 * H2_MAX_STREAMS, // streams reset by the server lately, frames the peer had in flight are ignored
+    H2_OUTPUT_BATCH = 65536,            // frames are written in batches of about that size
+    H2_MAX_OUTPUT = 4 * H2_OUTPUT_BATCH,// nothing is read from a peer that does not take its frames
+};
+
+enum H2FrameType
+{
+    H2_DATA = 0,
+    H2_HEADERS,
+    H2_PRIORITY,
+    H2_RST_STREAM,
+    H2_SETTINGS,
+    H2_PUSH_PROMISE,
+    H2_PING,
+    H2_GOAWAY,
+    H2_WINDOW_UPDATE,
+    H2_CONTINUATION,
+};
+
+enum H2Flag
+{
+    H2_FLAG_END_STREAM = 0x1,
+    H2_FLAG_ACK = 0x1,
+    H2_FLAG_END_HEADERS = 0x4,
+    H2_FLAG_PADDED = 0x8,
+    H2_FLAG_PRIORITY = 0x20,
+};
+
+enum H2Setting
+{
+    H2_SETTINGS_HEADER_TABLE_SIZE = 1,
+    H2_SETTINGS_ENABLE_PUSH,
+    H2_SETTINGS_MAX_CONCURRENT_STREAMS,
+    H2_SETTINGS_INITIAL_WINDOW_SIZE,
+    H2_SETTINGS_MAX_FRAME_SIZE,
+    H2_SETTINGS_MAX_HEADER_LIST_SIZE,
+};
+
+enum H2Error
+{
+    H2_NO_ERROR = 0,
+    H2_PROTOCOL_ERROR,
+    H2_INTERNAL_ERROR,
+    H2_FLOW_CONTROL_ERROR,
+    H2_SETTINGS_TIMEOUT,
+    H2_STREAM_CLOSED,
+    H2_FRAME_SIZE_ERROR,
+    H2_REFUSED_STREAM,
+    H2_CANCEL,
+    H2_COMPRESSION_ERROR,
+    H2_CONNECT_ERROR,
+    H2_ENHANCE_YOUR_CALM,
+};
+
+extern const char *H2_PREFACE;
+extern const char *H2_SWITCHING_PROTOCOLS;
+
+// whether the first bytes of a connection are, or begin, the client preface
+bool h2_preface_prefix(const char *data, size_t size);
+
+// the SETTINGS payload of an HTTP2-Settings field, false if it is not valid base64url
+bool h2_settings_payload(std::string_view field, std::string &payload);
+
+// Cleartext HTTP/2 on a connection of an HttpServer. The streams are answered
+// by RequestHandler one after the other as their headers come in, the
+// HTTP/1.1 header it prepares is converted to HPACK, and the DATA frames of
+// the bodies are interleaved, a frame per stream in turn, within the flow
+// control windows of the peer. Files are read into the frames with pread(),
+// a stream whose file is not in the page cache waits for FileIo while the
+// others go on.
+class Http2Session
+{
+public:
+    Http2Session(HttpServer &server, const Connection &conn);
+
+    Http2Session(const Http2Session&) = delete;
+    Http2Session &operator=(const Http2Session &) = delete;
+
+    // prior knowledge, data holds the first bytes read from the connection
+    void run(std::string_view data, std::error_code &ec);
+
+    // after the 101 to an Upgrade: h2c, rh holds the upgraded request, which is answered
+    // on stream 1, settings the decoded HTTP2-Settings, data whatever followed the request
+    void run_upgrade(const RequestHandler &rh, std::string_view settings, std::string_view data, std::error_code &ec);
+
+private:
+    struct Stream
+    {
+        std::unique_ptr<RequestHandler> handler;
+        const RequestHandler *rh;   // handler, or the request of an upgrade
+        std::vector<Segment> body;
+        size_t segment;             // the next bytes to send are at body[segment].offset + position
+        size_t position;
+        int64_t window;
+        size_t sent;
+        uint64_t timestamp;
+        uint64_t started;
+        bool requestOpen;           // the peer has not ended its side of the stream
+        FileReadPtr read;           // FileIo reading the chunk of the file range being sent
+        FileReadPtr next;           // and the chunk after it
+        size_t chunkBegin;          // file offsets of the chunk of read
+        size_t chunkEnd;
+        size_t nextEnd;
+    };
+
+    void serve(std::error_code &ec);
+    bool receive(std::error_code &ec);
+    bool flush(std::error_code &ec);
+    void process_frames();
+    void process_frame(uint8_t type, uint8_t flags, uint32_t id, std::string_view payload);
+    void process_headers(uint32_t id, bool newStream);
+    Stream *receiving_stream(uint32_t id);
+    bool apply_settings(std::string_view payload);
+    void start_stream(uint32_t id, Request &&request, const std::error_code &ec);
+    void respond(uint32_t id, Stream &&stream);
+    void fill_output();
+    bool file_ready(Stream &stream, const Segment &segment);
+    void finish_stream(uint32_t id, Stream &stream);
+    void frame(uint8_t type, uint8_t flags, uint32_t id, size_t length);
+    void reset_stream(uint32_t id, H2Error error);
+    void go_away(H2Error error);
+    void window_update(uint32_t id, uint32_t increment);
+
+private:
+    HttpServer &m_server;
+    const Connection &m_conn;
+    HpackDecoder m_decoder;
+    HpackEncoder m_encoder;
+    std::map<uint32_t, Stream> m_streams;
+    std::deque<uint32_t> m_resetStreams;
+    std::string m_in;
+    std::string m_out;
+    size_t m_outSent;           // bytes of m_out already written
+    bool m_preface;             // the client preface has been received
+    uint32_t m_lastStream;      // the highest stream id of the peer
+    uint32_t m_nextStream;      // fill_output() goes on with this stream
+    uint32_t m_headerStream;    // a header block is continued for this stream, 0 if none is
+    bool m_headerEndStream;
+    bool m_headerNewStream;
+    std::string m_headerBlock;
+    int64_t m_window;           // what the peer takes on the connection
+    int64_t m_initialWindow;    // and on a new stream
+    int64_t m_receiveWindow;    // what the peer may still send
+    bool m_goAway;              // sent, no new streams are taken
+    bool m_peerGoAway;
+    bool m_failed;              // a connection error, the GOAWAY is flushed and the connection closed
+    bool m_reading;             // a stream waits for FileIo
+};
+
+}// namespace http
+
+#endif
@@ -18,6 +18,14 @@ enum class HttpStatus
     HTTP_ERR_FORBIDDEN,
     HTTP_ERR_TIMEOUT,
     HTTP_ERR_INTERNAL_SERVER_ERROR,
+    HTTP_ERR_REQUEST_TIMEOUT,
+    HTTP_ERR_PAYLOAD_TOO_LARGE,
+    HTTP_ERR_HEADER_FIELDS_TOO_LARGE,
+    HTTP_ERR_SERVICE_UNAVAILABLE,
+    HTTP_ERR_INVALID_BUNDLE,
+    HTTP_ERR_TOO_MANY_REQUESTS,
+    HTTP_ERR_HANDOFF,
+    HTTP_ERR_INTERRUPTED,
 };
 
 namespace std
@@ -2,8 +2,17 @@
 #define _HTTP_SERVER_HPP
 #include "tcp_server.hpp"
 #include "http_error.hpp"
+#include "file_cache.hpp"
+#include "bundle.hpp"
+#include "embedded_assets.hpp"
+#include "mime.hpp"
+#include "static_responses.hpp"
+#include "access_log.hpp"
+#include "trace.hpp"
 #include <cstring>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <filesystem>
 
 namespace http
@@ -26,18 +35,45 @@ struct Request
 	Command cmd;
 	std::string uri;
 	std::string version;
+	std::vector<std::pair<std::string, std::string>> fields;
 	std::string content;
+
+	// case-insensitive lookup of a header field, nullptr if it is absent
+	const std::string *field(const char *name) const;
+};
+
+// the Command of a method token, false if it is none
+bool parse_method(std::string_view token, Command &cmd);
+
+enum {
+	MAX_BYTE_RANGES = 16, // a Range field with more ranges is ignored
+	WARM_UP_BYTES = 67108864, // 64 Mb of files are loaded by warm_up()
+	REQUEST_HEADER_TIMEOUT_MS = 10000, // the rest of a header that has begun to arrive is waited for that long, then 408
+};
+
+struct ByteRange
+{
+	size_t first;
+	size_t last;
 };
 
-enum ContentType
+// A part of the response, either bytes in memory or, if data is nullptr, a range of the file fd
+struct Segment
 {
-	TEXT_HTML = 0,
-	TEXT_CSS,
-	TEXT_JS,
-	IMAGE_PNG,
-	IMAGE_JPEG,
-	IMAGE_ICON,
-	UNKNOWN,
+	const char *data;
+	int fd;
+	size_t offset;
+	size_t length;
+};
+
+struct HttpOptions
+{
+	std::string cacheControl; // Cache-Control sent with files, empty to omit it
+	std::string metricsPath;  // request target answered with the Prometheus metrics, empty to disable
+	std::string tracePath;    // request target answered with the sampled traces, empty to disable
+	bool debugRemote = false; // metricsPath and tracePath over TCP as well, not only over Unix sockets
+	TraceOptions trace;
+	bool http2 = true;        // h2c by prior knowledge and by Upgrade, see http2.hpp
 };
 
 class RequestHandler
@@ -51,18 +87,26 @@ class RequestHandler
     #define FSA_STATE_DEFAULT FSA_STATE_PARSE_INCOMMING_HTTP_PDU
 
 public:
-	RequestHandler(tslogger::Logger &logger, std::filesystem::path &root)
+	RequestHandler(
+			ContentSource &source,
+			const StaticResponses &responses,
+			const HttpOptions &options
+		)
 	: m_buffer{},
 	  m_offset{0},
 	  m_fsaState{FSA_STATE_DEFAULT},
 	  m_processing{false},
+	  m_local{false},
+	  m_segments{},
+	  m_asset{},
+	  m_status{200},
+	  m_generated{},
 	  m_request{},
 	  m_ec{},
-	  m_logger{logger},
-	  m_root{root}
-	{
-		clear();
-	}
+	  m_source{source},
+	  m_responses{responses},
+	  m_options{options}
+	{}
 	~RequestHandler()
 	{}
 
@@ -77,7 +121,13 @@ public:
 		m_offset = value;
 	}
 
-	CharBuffer &buffer()
+	// the request came over a Unix socket, see HttpOptions::debugRemote
+	void local(bool value)
+	{
+		m_local = value;
+	}
+
+	RequestBuffer &buffer()
 	{
 		return m_buffer;
 	}
@@ -88,9 +138,59 @@ public:
 		m_offset = 0;
 	}
 
+	// sends the response prepared by process(), a response of several parts corked if cork is set
+	size_t send(int sockfd, bool cork, std::error_code &ec);
+
+	const Request &request() const
+	{
+		return m_request;
+	}
+
+	// HTTP status of the response prepared by process()
+	int status() const
+	{
+		return m_status;
+	}
+
 	void process()
 	{
+	    m_ec.clear();
 	    m_fsaState = FSA_STATE_DEFAULT;
+	    run();
+	}
+
+	// a request HTTP/2 has decoded already, ec answers it with an error page instead
+	void process(Request &&request, const std::error_code &ec)
+	{
+	    m_request = std::move(request);
+	    m_ec = ec;
+	    if (!m_ec.value() && m_request.cmd != GET && m_request.cmd != HEAD)
+	        m_ec = make_error_code(HttpStatus::HTTP_ERR_NOT_IMPLEMENTED);
+	    m_fsaState = m_ec.value() ? FSA_STATE_DONE : FSA_STATE_HANDLE_GET_REQUEST;
+	    run();
+	}
+
+	// the response prepared by process() as it goes out on HTTP/1.1, the header first
+	void response(std::vector<Segment> &out) const
+	{
+		if (m_segments.empty())
+			out.assign(1, Segment{m_buffer.data(), -1, 0, m_offset});
+		else
+			out = m_segments;
+	}
+
+	// keeps the files of the segments of response() open
+	const std::shared_ptr<const void> &holder() const
+	{
+		return m_asset.holder;
+	}
+
+private:
+	void run()
+	{
+	    m_segments.clear();
+	    m_asset = Asset();
+	    m_status = 200;
     	m_processing = true;
 	    while(m_processing)
     	{
@@ -100,6 +200,8 @@ public:
 	}
 
 private:
+    friend struct RequestHandlerBench; // benchmarks/ runs the FSA states one by one
+
     static void parse_incomming_http_pdu(void *data);
     static void handle_get_request(void *data);
     static void done(void *data);
@@ -112,17 +214,31 @@ private:
     void handle_get_request();
     void done();
 
+    void create_generated_response(const char *contentType);
+    void create_head_response(bool deflate);
+    void create_deflate_response();
+    void create_identity_response();
+    void create_range_response(const std::vector<ByteRange> &ranges);
+    void push_identity_segment(size_t offset, size_t length);
+    size_t send_file_segment(int sockfd, const Segment &segment, std::error_code &ec);
+
 private:
-	CharBuffer m_buffer;
+	RequestBuffer m_buffer;
 	size_t m_offset;
 	FsaState m_fsaState;
 	bool m_processing;
+	bool m_local;
+	std::vector<Segment> m_segments;
+	Asset m_asset;
+	int m_status;
+	std::string m_generated;
 
 private:
 	Request m_request;
     std::error_code m_ec;
-    tslogger::Logger &m_logger;
-    std::filesystem::path &m_root;
+    ContentSource &m_source;
+    const StaticResponses &m_responses;
+    const HttpOptions &m_options;
 };
 
 class HttpServer : public TcpServer
@@ -133,23 +249,78 @@ public:
 			int port,
 			bool ipv4,
 			const unsigned int maxClients,
-			tslogger::Handler &handler,
-			const char *logFileName,
-			bool logToStdout,
+			bool takeOver,
+			std::error_code &ec
+		);
+	// serves source, e.g. the EmbeddedSource, in place of a doc root
+	HttpServer(
+			ContentSource &source,
+			int port,
+			bool ipv4,
+			const unsigned int maxClients,
+			bool takeOver,
 			std::error_code &ec
 		);
 	~HttpServer()
 	{}
 
+	// replaces built-in error pages by <dir>/<code>.html, before the server starts accepting connections
+	void error_pages(const char *dir, std::error_code &ec);
+
+	// writes a binary access log to dir, before the server starts accepting connections
+	void access_log(const char *dir, std::error_code &ec);
+
+	// writes out the records all threads hold, requests after it are not logged
+	void stop_access_log();
+
+	// picks up a new version of the site, a rebuilt bundle or a changed doc root
+	void reload(std::error_code &ec);
+
+	// loads the files of the doc root and their deflated copies up to WARM_UP_BYTES,
+	// so a server taking over from another one does not start with a cold cache
+	void warm_up(std::error_code &ec);
+
+	// must be set up before the server starts accepting connections
+	HttpOptions &options()
+	{
+		return m_options;
+	}
+
 private:
+	friend class Http2Session; // serves the streams of a connection with the members of the server
+
 	void incoming_handler(
 				const Connection &conn,
-				tslogger::Logger &logger,
 				std::error_code &ec
 			) override;
+	void reject(const Connection &conn) override;
+	// reads until rh holds a whole header, the offset of its end or npos if the connection is done
+	size_t receive_header(const Connection &conn, RequestHandler &rh, std::error_code &ec);
+	// answers with an error page and ends the connection, the request is not read any further
+	void refuse(const Connection &conn, HttpStatus status, std::error_code &ec);
+	// metrics and access log of an answered request
+	void count_request(
+				const Connection &conn,
+				const RequestHandler &rh,
+				size_t sent,
+				uint64_t timestamp,
+				uint64_t started,
+				uint64_t finished
+			);
+	// CLOCK_REALTIME of a request for the access log, 0 without one
+	uint64_t access_timestamp() const;
+	// switches to HTTP/2 if rh holds an Upgrade: h2c request, true if the connection is done then;
+	// data is what the client sent after the request
+	bool upgrade(const Connection &conn, const RequestHandler &rh, std::string_view data);
 
 private:
 	std::filesystem::path m_root;
+	FileCache m_cache;
+	BundleSource m_bundle;
+	ContentSource *m_source;
+	StaticResponses m_responses;
+	HttpOptions m_options;
+	std::unique_ptr<AccessLog> m_accessLog;
 };
 
 }// namespace http
@@ -0,0 +1,287 @@
+#ifndef _LOG_HPP
+#define _LOG_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include <logger.hpp>
+
+namespace http
+{
+
+enum LogLevel
+{
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR,
+};
+
+// call sites below this level are not compiled at all, see SHS_LOG_LEVEL in CMakeLists.txt
+#ifndef SHS_LOG_LEVEL
+#define SHS_LOG_LEVEL http::LOG_LEVEL_INFO
+#endif
+
+enum {
+    LOG_RING_SIZE = 65536, // bytes per thread, a power of two
+    LOG_LINE_SIZE = 1024,
+    LOG_DRAIN_INTERVAL_MS = 100,
+};
+
+typedef int (*LogFormatter)(const char *fmt, const char *args, char *out, size_t size);
+
+// Ring records are a header followed by the encoded arguments
+struct LogRecord
+{
+    uint32_t size;         // including the header and the padding
+    uint32_t level;
+    LogFormatter format;   // nullptr marks the padding before a wrap
+    const char *fmt;
+};
+
+// Argument encoding. Values are copied as they are, strings are copied
+// into the record, so nothing has to outlive the call site.
+template <typename T>
+struct LogArg
+{
+    static_assert(std::is_trivially_copyable_v<T>, "log arguments have to be values or C strings");
+
+    static size_t size(const T &)
+    {
+        return sizeof(T);
+    }
+
+    static char *encode(char *out, const T &value)
+    {
+        memcpy(out, &value, sizeof(T));
+        return out + sizeof(T);
+    }
+
+    static T decode(const char *&in)
+    {
+        T value;
+        memcpy(&value, in, sizeof(T));
+        in += sizeof(T);
+        return value;
+    }
+};
+
+struct LogStringArg
+{
+    static const char *str(const char *s)
+    {
+        return s == nullptr ? "(null)" : s;
+    }
+
+    static size_t size(const char *s)
+    {
+        return sizeof(uint32_t) + strlen(str(s)) + 1;
+    }
+
+    static char *encode(char *out, const char *s)
+    {
+        s = str(s);
+        uint32_t len = strlen(s) + 1;
+        memcpy(out, &len, sizeof(len));
+        memcpy(out + sizeof(len), s, len);
+        return out + sizeof(len) + len;
+    }
+
+    static const char *decode(const char *&in)
+    {
+        uint32_t len;
+        memcpy(&len, in, sizeof(len));
+        const char *s = in + sizeof(len);
+        in += sizeof(len) + len;
+        return s;
+    }
+};
+
+template <> struct LogArg<const char *> : LogStringArg {};
+template <> struct LogArg<char *> : LogStringArg {};
+
+template <typename... Args>
+char *encode_log_args(char *out, const Args &...args)
+{
+    ((out = LogArg<std::decay_t<Args>>::encode(out, args)), ...);
+    return out;
+}
+
+// runs on the drain thread, the types of the arguments are known from the call site
+template <typename... Args>
+int format_log_record(const char *fmt, const char *args, char *out, size_t size)
+{
+    // braced initialization evaluates the decoders left to right
+    std::tuple<decltype(LogArg<Args>::decode(args))...> values{LogArg<Args>::decode(args)...};
+    return std::apply([&](auto... value){ return snprintf(out, size, fmt, value...); }, values);
+}
+
+// Single producer, single consumer byte ring, owned by one thread and drained by AsyncLog
+class LogRing
+{
+public:
+    LogRing()
+    : m_head{0},
+      m_reserved{0},
+      m_tail{0},
+      m_closed{false},
+      m_data{}
+    {}
+
+    // space for a record of size bytes, nullptr if the ring is full
+    char *reserve(size_t size);
+    void commit();
+
+    size_t used() const
+    {
+        return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_relaxed);
+    }
+
+    // calls f for every committed record
+    template <typename F>
+    void consume(F f);
+
+    // the owning thread has exited, the ring goes away once it is drained
+    void close()
+    {
+        m_closed = true;
+    }
+
+    bool closed() const
+    {
+        return m_closed;
+    }
+
+private:
+    alignas(64) std::atomic<uint64_t> m_head;
+    uint64_t m_reserved;
+    alignas(64) std::atomic<uint64_t> m_tail;
+    std::atomic<bool> m_closed;
+    alignas(64) char m_data[LOG_RING_SIZE];
+};
+
+template <typename F>
+void LogRing::consume(F f)
+{
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    while (tail != head)
+    {
+        size_t pos = tail & (LOG_RING_SIZE - 1);
+        if (LOG_RING_SIZE - pos < sizeof(LogRecord)) {
+            tail += LOG_RING_SIZE - pos;
+            continue;
+        }
+        const LogRecord *record = reinterpret_cast<const LogRecord *>(m_data + pos);
+        if (record->format != nullptr)
+            f(*record, m_data + pos + sizeof(LogRecord));
+        tail += record->size;
+    }
+    m_tail.store(tail, std::memory_order_release);
+}
+
+// Deferred logging. A call site only copies the format pointer and the raw
+// arguments into the ring of its thread, formatting and writing happen on
+// the drain thread that run() turns into. Without a drain thread, as in the
+// tools and the benchmarks, warnings and errors go to stderr right away.
+class AsyncLog
+{
+public:
+    static AsyncLog &instance();
+
+    template <typename... Args>
+    void write(LogLevel level, const char *fmt, const Args &...args);
+
+    // drains the rings into sink until stop is requested, also takes over
+    // the handler.process() loop, waking up on errors or every LOG_DRAIN_INTERVAL_MS
+    void run(tslogger::Logger &sink, tslogger::Handler &handler, std::stop_token st);
+
+    uint64_t dropped() const
+    {
+        return m_dropped;
+    }
+
+private:
+    AsyncLog();
+
+    LogRing *thread_ring();
+    void drain(tslogger::Logger &sink);
+
+private:
+    std::mutex m_ringsMutex;
+    std::vector<std::shared_ptr<LogRing>> m_rings;
+    std::mutex m_wakeMutex;
+    std::condition_variable_any m_wake;
+    std::atomic<bool> m_urgent;
+    std::atomic<bool> m_running;
+    std::atomic<uint64_t> m_dropped;
+};
+
+template <typename... Args>
+void AsyncLog::write(LogLevel level, const char *fmt, const Args &...args)
+{
+    size_t size = sizeof(LogRecord);
+    ((size += LogArg<std::decay_t<Args>>::size(args)), ...);
+    size = (size + alignof(LogRecord) - 1) & ~(alignof(LogRecord) - 1);
+
+    if (!m_running.load(std::memory_order_relaxed)) {
+        if (level >= LOG_LEVEL_WARNING) {
+            std::string encoded(size, '\0');
+            encode_log_args(encoded.data(), args...);
+            char line[LOG_LINE_SIZE];
+            format_log_record<std::decay_t<Args>...>(fmt, encoded.data(), line, sizeof(line));
+            fputs(line, stderr);
+        }
+        return;
+    }
+
+    LogRing *ring = thread_ring();
+    char *out = ring->reserve(size);
+    if (out == nullptr) {
+        ++m_dropped;
+        return;
+    }
+    LogRecord *record = reinterpret_cast<LogRecord *>(out);
+    record->size = size;
+    record->level = level;
+    record->format = &format_log_record<std::decay_t<Args>...>;
+    record->fmt = fmt;
+    encode_log_args(out + sizeof(LogRecord), args...);
+    ring->commit();
+
+    // the drain thread batches, it is only woken early for errors or a filling ring
+    if (level >= LOG_LEVEL_ERROR || ring->used() > LOG_RING_SIZE / 2) {
+        m_urgent = true;
+        m_wake.notify_one();
+    }
+}
+
+}// namespace http
+
+// fmt has to be a string literal, it is formatted later on the drain thread;
+// the printf() that never runs lets the compiler check it against the arguments
+#define SHS_LOG(level, ...) \
+    do { \
+        if (false) \
+            (void)printf(__VA_ARGS__); \
+        if constexpr ((level) >= SHS_LOG_LEVEL) \
+            http::AsyncLog::instance().write((level), __VA_ARGS__); \
+    } while (0)
+
+#define LOG_D(...) SHS_LOG(http::LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_I(...) SHS_LOG(http::LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_W(...) SHS_LOG(http::LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_E(...) SHS_LOG(http::LOG_LEVEL_ERROR, __VA_ARGS__)
+#define ENTER() LOG_D("%s:%d <<< Entering\n", __FILE__, __LINE__)
+#define EXIT() LOG_D("%s:%d >>> Exiting\n", __FILE__, __LINE__)
+#define CODE_LINE(msg) LOG_D("> %s:%d %s: %s\n",  __FILE__,  __LINE__, __func__, msg)
+
+#endif
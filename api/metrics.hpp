@@ -0,0 +1,119 @@
+#ifndef _METRICS_HPP
+#define _METRICS_HPP
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <ctime>
+
+namespace http
+{
+
+enum MetricCounter
+{
+    METRIC_CONNECTIONS_OPENED = 0,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_CONNECTIONS_REJECTED, // the admission queue was full
+    METRIC_CONNECTIONS_SHED,     // queued for too long
+    METRIC_CONNECTIONS_RATE_LIMITED,
+    METRIC_REQUESTS_RATE_LIMITED,
+    METRIC_REQUESTS,
+    METRIC_RESPONSES_2XX,
+    METRIC_RESPONSES_3XX,
+    METRIC_RESPONSES_4XX,
+    METRIC_RESPONSES_5XX,
+    METRIC_BYTES_RECEIVED,
+    METRIC_BYTES_SENT,
+    METRIC_CACHE_HITS,
+    METRIC_CACHE_MISSES,
+    METRIC_COMPRESSIONS,
+    METRIC_TCP_SEGMENTS_SENT,    // TCP_INFO of the closed connections
+    METRIC_TCP_RETRANSMITS,
+    METRIC_TCP_FASTOPEN,         // connections whose SYN carried the request
+    METRIC_HTTP2_CONNECTIONS,
+    METRIC_HTTP2_STREAMS,
+    METRIC_FILE_READS,           // file ranges queued to FileIo, they were not in the page cache
+    METRIC_FILE_READS_DONE,
+    METRIC_FILE_READS_INLINE,    // read by the connection thread, the FileIo queue was full
+    METRIC_COUNTER_COUNT,
+};
+
+enum MetricHistogram
+{
+    METRIC_REQUEST_TIME = 0, // from receiving the request to the last byte sent
+    METRIC_COMPRESSION_TIME,
+    METRIC_SEND_TIME,
+    METRIC_TCP_RTT,          // smoothed RTT of the connections when they are closed
+    METRIC_FILE_READ_TIME,   // from queueing a file range to FileIo to having it read
+    METRIC_HISTOGRAM_COUNT,
+};
+
+enum {
+    METRIC_SUB_BUCKET_BITS = 2,                           // 4 buckets per power of two, 25% precision
+    METRIC_SUB_BUCKETS = 1 << METRIC_SUB_BUCKET_BITS,
+    METRIC_MAX_BITS = 40,                                 // 2^40 ns, about 18 minutes
+    METRIC_BUCKETS = (METRIC_MAX_BITS - METRIC_SUB_BUCKET_BITS + 1) * METRIC_SUB_BUCKETS,
+};
+
+// Log bucketed, HDR style: the power of two of a value and its next two bits pick the bucket
+inline size_t metric_bucket(uint64_t ns)
+{
+    if (ns < METRIC_SUB_BUCKETS)
+        return ns;
+    unsigned msb = 63 - __builtin_clzll(ns);
+    if (msb >= METRIC_MAX_BITS)
+        return METRIC_BUCKETS - 1;
+    return (msb - METRIC_SUB_BUCKET_BITS + 1) * METRIC_SUB_BUCKETS
+         + ((ns >> (msb - METRIC_SUB_BUCKET_BITS)) & (METRIC_SUB_BUCKETS - 1));
+}
+
+// Every thread updates a block of its own, so the hot path never writes a
+// cache line another thread writes. Scraping sums the blocks of all threads.
+struct alignas(64) MetricsBlock
+{
+    std::atomic<uint64_t> counters[METRIC_COUNTER_COUNT];
+    struct Histogram
+    {
+        std::atomic<uint64_t> buckets[METRIC_BUCKETS];
+        std::atomic<uint64_t> sum;
+    } histograms[METRIC_HISTOGRAM_COUNT];
+
+    MetricsBlock();
+};
+
+MetricsBlock &thread_metrics();
+
+// only the owning thread writes, a relaxed load and store is enough and needs no locked instruction
+inline void metric_bump(std::atomic<uint64_t> &value, uint64_t delta)
+{
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+inline void metric_add(MetricCounter counter, uint64_t value = 1)
+{
+    metric_bump(thread_metrics().counters[counter], value);
+}
+
+inline void metric_observe(MetricHistogram histogram, uint64_t ns)
+{
+    MetricsBlock::Histogram &h = thread_metrics().histograms[histogram];
+    metric_bump(h.buckets[metric_bucket(ns)], 1);
+    metric_bump(h.sum, ns);
+}
+
+// CLOCK_MONOTONIC in ns
+inline uint64_t metric_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// sum of a counter over all threads
+uint64_t metric_total(MetricCounter counter);
+
+// Prometheus text exposition format 0.0.4
+void render_metrics(std::string &out);
+
+}// namespace http
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _MIME_HPP
+#define _MIME_HPP
+
+namespace http
+{
+
+enum ContentType
+{
+    TEXT_HTML = 0,
+    TEXT_CSS,
+    TEXT_JS,
+    IMAGE_PNG,
+    IMAGE_JPEG,
+    IMAGE_ICON,
+    UNKNOWN,
+};
+
+const char *content_type2str(ContentType t);
+ContentType file_extention2content_type(const char *extension);
+
+}// namespace http
+
+#endif
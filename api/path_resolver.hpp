@@ -0,0 +1,105 @@
+#ifndef _PATH_RESOLVER_HPP
+#define _PATH_RESOLVER_HPP
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <filesystem>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace http
+{
+
+enum {
+    PATH_RESOLVER_CAPACITY = 1024, // open file descriptors kept in the LRU, fewer under a low RLIMIT_NOFILE
+};
+
+// descriptors the caches of open files may keep together: half the soft RLIMIT_NOFILE,
+// the other half is left to sockets, logs and pipes
+size_t cached_descriptors_limit();
+
+// An open file below the document root, closed when the last user releases it
+struct OpenFile
+{
+    std::string path;
+    int fd;
+    struct statx stx;
+
+    OpenFile()
+    : path{},
+      fd{-1},
+      stx{}
+    {}
+
+    ~OpenFile()
+    {
+        if (fd != -1)
+            ::close(fd);
+    }
+
+    OpenFile(const OpenFile&) = delete;
+    OpenFile &operator=(const OpenFile&) = delete;
+};
+
+typedef std::shared_ptr<const OpenFile> OpenFilePtr;
+
+// Turns a request URI into a path relative to the document root, in place:
+// drops the query and fragment, decodes %XX escapes, collapses "//" and "."
+// and resolves ".." segments. A path climbing above the root is rejected.
+void normalize_uri(std::string &uri, std::error_code &ec);
+
+// Opens files relative to a held document root descriptor with
+// openat2(RESOLVE_BENEATH), so lookups can never leave the root, and keeps
+// the most recently used descriptors open together with their statx data.
+// Without openat2 no symlink below the root is followed.
+class PathResolver
+{
+public:
+    PathResolver(const std::filesystem::path &root, size_t capacity = PATH_RESOLVER_CAPACITY);
+    ~PathResolver();
+
+    PathResolver(const PathResolver&) = delete;
+    PathResolver(PathResolver &&) = delete;
+    PathResolver &operator=(const PathResolver &) = delete;
+    PathResolver &operator=(PathResolver &&) = delete;
+
+    void start(std::error_code &ec);
+    void stop();
+    // opens the root again, e.g. a symlink to it now points to another release,
+    // and closes the cached descriptors; the old root stays on failure
+    void reload(std::error_code &ec);
+
+    // path must be normalized by normalize_uri(), the descriptor is kept for later calls
+    // only if keep is set
+    OpenFilePtr open(const std::string &path, bool keep, std::error_code &ec);
+
+    // closes the cached descriptor of path and, if recursive, of everything below it
+    void invalidate(const std::string &path, bool recursive);
+    void clear();
+
+private:
+    int openat2_beneath(int rootFd, const char *path, int flags);
+    int walk_beneath(int rootFd, const char *path, int flags);
+    int open_beneath(const char *path);
+
+private:
+    typedef std::list<OpenFilePtr> LruList;
+
+    std::filesystem::path m_root;
+    size_t m_capacity;
+    std::atomic<OpenFilePtr> m_rootDir;
+    bool m_openat2;             // probed by start()
+    unsigned long m_generation;
+    std::mutex m_mutex;
+    LruList m_lru;
+    std::unordered_map<std::string, LruList::iterator> m_files;
+};
+
+}// namespace http
+
+#endif
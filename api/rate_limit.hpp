@@ -0,0 +1,94 @@
+#ifndef _RATE_LIMIT_HPP
+#define _RATE_LIMIT_HPP
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include "tcp_connection.hpp"
+
+namespace http
+{
+
+enum {
+    RATE_LIMIT_SHARDS = 64,         // a lock each, workers only meet on the same shard
+    RATE_LIMIT_SLOTS = 1024,        // per shard, 64K clients in 2 MB
+    RATE_LIMIT_PROBES = 8,          // slots looked at from the home slot of a client
+};
+
+// Zero rates disable the limit. A client is the source address with the
+// bits past the prefix cleared, IPv4-mapped IPv6 addresses count as IPv4.
+// Connections of a Unix socket are not limited, they all come from the
+// proxy in front, which would be limited as a single client.
+struct RateLimitOptions
+{
+    unsigned connectionsPerSecond = 0;
+    unsigned connectionBurst = 0;
+    unsigned requestsPerSecond = 0;
+    unsigned requestBurst = 0;
+    unsigned ipv4Prefix = 32;
+    unsigned ipv6Prefix = 64;
+};
+
+// Token buckets per client in a sharded open addressing table. A bucket is
+// kept as the time it will be full again (GCRA), so it is refilled by just
+// comparing with the clock, and a slot whose buckets are full is free for
+// any client. A client finding all its probed slots taken by active
+// clients replaces the least recently seen one of them.
+class RateLimiter
+{
+public:
+    RateLimiter();
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter &operator=(const RateLimiter &) = delete;
+
+    // must be set up before the server starts accepting connections
+    void configure(const RateLimitOptions &options);
+
+    bool enabled() const
+    {
+        return m_connectionInterval || m_requestInterval;
+    }
+
+    // takes a token for a new connection of the client of conn
+    bool allow_connection(const Connection &conn);
+
+    // takes a token for a request on conn
+    bool allow_request(const Connection &conn);
+
+private:
+    struct Key
+    {
+        uint64_t hi;
+        uint64_t lo;
+    };
+
+    struct Slot
+    {
+        Key key;
+        uint64_t connectionsFull; // CLOCK_MONOTONIC ns when the bucket is full again
+        uint64_t requestsFull;
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        std::array<Slot, RATE_LIMIT_SLOTS> slots;
+    };
+
+    Key key(const Connection &conn) const;
+    bool allow(const Connection &conn, bool request);
+
+private:
+    std::unique_ptr<Shard[]> m_shards;
+    uint64_t m_connectionInterval;  // ns per token, 0 without a limit
+    uint64_t m_connectionTolerance; // ns the bucket may be ahead of the clock
+    uint64_t m_requestInterval;
+    uint64_t m_requestTolerance;
+    unsigned m_ipv4Prefix;
+    unsigned m_ipv6Prefix;
+};
+
+}// namespace http
+
+#endif
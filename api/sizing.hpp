@@ -0,0 +1,87 @@
+#ifndef _SIZING_HPP
+#define _SIZING_HPP
+#include <cstdint>
+
+namespace http
+{
+
+enum {
+    SIZING_SAMPLE_MS = 100,          // how often the busy threads are counted
+    SIZING_INTERVAL_MS = 1000,       // how often the limit is adjusted
+    SIZING_QUEUE_DELAY_MS = 10,      // more threads are tried above it, below the shedding target
+    SIZING_MAX_THREADS_PER_CPU = 16,
+};
+
+// What the process may use: the CPUs of its affinity mask, cut down by the
+// cgroup v2 cpu.max quota, and the physical memory, cut down by memory.max.
+// The limits of the parent cgroups count as well, and so do the cgroup v1
+// cpu.cfs_quota_us and memory.limit_in_bytes on hosts without v2 controllers.
+struct ResourceLimits
+{
+    double cpus;
+    unsigned long long memory;
+};
+
+ResourceLimits read_resource_limits();
+
+// bounds of the thread limit, zero for the defaults: at least one thread per CPU,
+// at most SIZING_MAX_THREADS_PER_CPU per CPU and what the memory allows
+struct SizingOptions
+{
+    unsigned minThreads = 0;
+    unsigned maxThreads = 0;
+};
+
+// Adjusts the limit of connection threads from what the last interval looked like.
+// Queueing connections get more threads while the busy threads are mostly
+// blocked on I/O and CPU is left, a saturated CPU gets fewer, and a limit
+// that is far from used decays towards the minimum.
+class ThreadSizer
+{
+public:
+    ThreadSizer(const ResourceLimits &limits, const SizingOptions &options, unsigned long threadMemory);
+
+    unsigned min_threads() const
+    {
+        return m_minThreads;
+    }
+
+    unsigned max_threads() const
+    {
+        return m_maxThreads;
+    }
+
+    // called every SIZING_SAMPLE_MS with the number of busy threads
+    void sample(unsigned active);
+
+    // the limit for the next interval, queueDelayNs is the mean wait of the connections in the last one
+    unsigned adjust(unsigned current, uint64_t queueDelayNs);
+
+    // of the last interval, for logging
+    double cpu_utilization() const
+    {
+        return m_cpuUtilization;
+    }
+
+    double blocked_ratio() const
+    {
+        return m_blockedRatio;
+    }
+
+private:
+    double m_cpus;
+    unsigned m_minThreads;
+    unsigned m_maxThreads;
+    uint64_t m_lastWall;     // CLOCK_MONOTONIC ns
+    uint64_t m_lastCpu;      // process CPU time ns
+    uint64_t m_lastSample;
+    double m_busyThreadNs;   // busy threads integrated over the interval
+    unsigned m_samples;
+    unsigned m_activeSum;
+    double m_cpuUtilization;
+    double m_blockedRatio;
+};
+
+}// namespace http
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _SOCKET_OPTIONS_HPP
+#define _SOCKET_OPTIONS_HPP
+#include <string>
+#include <system_error>
+
+namespace http
+{
+
+// Options of the listening socket and of the accepted ones, zeros keep the
+// kernel defaults. SO_REUSEADDR is always set on the listener, a restart
+// must not fail on connections of the last run in TIME_WAIT.
+struct SocketOptions
+{
+    bool noDelay = true;      // TCP_NODELAY, a response does not wait for the ACK of the one before
+    bool cork = true;         // TCP_CORK while a response of several parts is sent, it leaves in full segments
+    int deferAccept = 0;      // TCP_DEFER_ACCEPT seconds, accept() returns once the request is there
+    int fastOpen = 0;         // TCP_FASTOPEN queue, needs bit 2 of net.ipv4.tcp_fastopen
+    int sendBuffer = 0;       // SO_SNDBUF, a fixed size turns autotuning off
+    int receiveBuffer = 0;    // SO_RCVBUF, set on the listener as well, the window scale is sent in the SYN-ACK
+    int notSentLowat = 0;     // TCP_NOTSENT_LOWAT, a send blocks while more than that is not sent yet
+};
+
+// Named profiles, SocketOptions() is "default":
+//   kernel   nothing set, the baseline to measure the others against
+//   default  TCP_NODELAY and corking
+//   latency  default, TCP_DEFER_ACCEPT, TCP_FASTOPEN and a low TCP_NOTSENT_LOWAT
+//   compact  latency with small fixed buffers, for many slow or idle clients
+SocketOptions socket_profile(const std::string &name, std::error_code &ec);
+
+void apply_listener_options(int sockfd, const SocketOptions &options, std::error_code &ec);
+void apply_connection_options(int sockfd, const SocketOptions &options, std::error_code &ec);
+
+// TCP_CORK on or off, failures are ignored as on sockets other than TCP
+void cork_socket(int sockfd, bool on);
+
+// adds TCP_INFO of a connection about to be closed to the metrics
+void observe_tcp_info(int sockfd);
+
+}// namespace http
+
+#endif
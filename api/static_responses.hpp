@@ -0,0 +1,53 @@
+#ifndef _STATIC_RESPONSES_HPP
+#define _STATIC_RESPONSES_HPP
+#include <array>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <system_error>
+#include "http_error.hpp"
+
+namespace http
+{
+
+enum {
+    STATIC_RESPONSE_COUNT = 10,
+    RETRY_AFTER_SECONDS = 1, // sent with 429 and 503, which also close the connection
+};
+
+// Complete error responses, header and page, rendered once at startup.
+// Anything that is not one of the listed HTTP statuses is answered with 500.
+class StaticResponses
+{
+public:
+    StaticResponses();
+
+    StaticResponses(const StaticResponses&) = delete;
+    StaticResponses &operator=(const StaticResponses &) = delete;
+
+    // replaces the built-in pages by <dir>/<code>.html where such a file exists
+    void load(const std::filesystem::path &dir, std::error_code &ec);
+
+    // the whole response, or only its header if headOnly is set
+    std::string_view get(const std::error_code &ec, bool headOnly) const;
+
+    // the HTTP status code get() answers ec with
+    int code(const std::error_code &ec) const;
+
+private:
+    struct Response
+    {
+        std::string data;
+        size_t headerSize;
+    };
+
+    void render(size_t index, std::string_view page);
+    size_t index(const std::error_code &ec) const;
+
+private:
+    std::array<Response, STATIC_RESPONSE_COUNT> m_responses;
+};
+
+}// namespace http
+
+#endif
@@ -3,6 +3,7 @@
 #include <string_view>
 #include <cstring>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/select.h>
 #include <unistd.h>
 #include <netinet/in.h>
@@ -17,6 +18,7 @@ typedef union
 {
     struct sockaddr_in addr;
     struct sockaddr_in6 addr6;
+    struct sockaddr_un local;   // clients of a TcpServer::listen_unix() socket
 } sockaddr_t;
 
 
@@ -30,18 +32,19 @@ struct Connection {
     Connection() = default;
     ~Connection() = default;
 
+    // accepted on an AF_UNIX listener, a process on this host without a client address
+    bool local() const
+    {
+        return client.addr.sin_family == AF_UNIX;
+    }
+
     Connection &operator=(const Connection& other)
     {
 		if (&other == this)
 			return *this;
 		ipv4 = other.ipv4;
 		sockfd = other.sockfd;
-		if (ipv4) {
-			memcpy(&client.addr, &other.client.addr, sizeof(client.addr));
-		}
-		else {
-			memcpy(&client.addr6, &other.client.addr6, sizeof(client.addr6));
-		}
+		memcpy(&client, &other.client, sizeof(client));
 		return *this;   	
     }
 
@@ -56,14 +59,8 @@ struct Connection {
 			return *this;
 		std::swap(ipv4, other.ipv4);
 		std::swap(sockfd, other.sockfd);
-		if (ipv4) {
-			memcpy(&client.addr, &other.client.addr, sizeof(client.addr));
-			memset(&other.client.addr, 0, sizeof(client.addr));
-		}
-		else {
-			memcpy(&client.addr6, &other.client.addr6, sizeof(client.addr6));
-			memset(&other.client.addr6, 0, sizeof(client.addr6));
-		}
+		memcpy(&client, &other.client, sizeof(client));
+		memset(&other.client, 0, sizeof(client));
 		return *this;
     }
     Connection(Connection && other)
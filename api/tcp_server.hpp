@@ -4,16 +4,27 @@
 #include <mutex>
 #include <atomic>
 #include <memory>
-#include <logger.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "log.hpp"
 #include "http_error.hpp"
 #include "tcp_connection.hpp"
 #include "tcp_thread.hpp"
+#include "admission.hpp"
+#include "rate_limit.hpp"
+#include "sizing.hpp"
+#include "topology.hpp"
+#include "socket_options.hpp"
 
 namespace http
 {
 
 enum {
     MAX_BUFFER_SIZE = 10485760, // 10 Mb
+    REQUEST_BUFFER_SIZE = 65536, // a request and the header of its response
+    IDLE_POLL_MS = 10, // how often an idle connection looks for connections waiting for its thread
 };
 
 template <typename T, std::size_t N>
@@ -40,6 +51,11 @@ public:
         return m_data;
     }
 
+    const T *data() const
+    {
+        return m_data;
+    }
+
     const std::size_t size() const
     {
         return static_cast<const std::size_t>(m_size);
@@ -74,6 +90,7 @@ private:
 };
 
 typedef Buffer<char, MAX_BUFFER_SIZE> CharBuffer;
+typedef Buffer<char, REQUEST_BUFFER_SIZE> RequestBuffer;
 
 class TcpServer {
 public:
@@ -81,9 +98,7 @@ public:
             int port,
             bool ipv4,
             const unsigned int maxClients,
-            tslogger::Handler &handler,
-            const char *logFileName,
-            bool logToStdout,
+            bool takeOver,
             std::error_code &ec
             );
     virtual ~TcpServer();
@@ -93,9 +108,11 @@ public:
     TcpServer &operator=(const TcpServer &) = delete;
     TcpServer &operator=(TcpServer &&) = delete;
 
-    void operator()();
+    // serves conn, then the connections queued by the admission control
+    void operator()(Connection conn);
 
     void accept(Connection &conn, std::error_code &ec);
+    // runs conn on a new thread, queues or rejects it when the limit of threads is reached
     void new_thread(Connection &&conn);
 
     bool is_running() const
@@ -108,11 +125,73 @@ public:
         m_running = true;
     }
 
+    // stops right away, safe to call from a signal handler
     void stop()
     {
         m_running = false;
+        wake();
+    }
+
+    // stops accepting, lets the connections finish their requests and closes them once idle
+    void drain()
+    {
+        m_draining = true;
+        stop();
+    }
+
+    bool is_draining() const
+    {
+        return m_draining;
+    }
+
+    // makes a waiting accept() return HTTP_ERR_INTERRUPTED, safe to call from a signal handler
+    void wake()
+    {
+        char c = 0;
+        if (m_wake[1] != -1)
+            (void)!::write(m_wake[1], &c, 1);
+    }
+
+    // whether all connections are done after a drain, waits for them up to timeoutMs
+    bool wait_drained(unsigned int timeoutMs);
+
+    // a server constructed with takeOver while another one runs on the port accepts on the
+    // socket of the other one, which keeps accepting until this tells it to drain
+    void confirm_take_over(std::error_code &ec);
+
+    bool taken_over() const
+    {
+        return m_handoffPeer != -1;
+    }
+
+    // hands the listening socket over to the next server started on the port, see handoff.hpp
+    void offer_handoff();
+
+    // adjusts the limit of connection threads to the load from now on, see ThreadSizer,
+    // without it the limit stays at maxClients
+    void autosize(const SizingOptions &options);
+
+    // opt-in, before the server starts accepting connections: a thread serving a connection
+    // runs on the NUMA node whose CPU took the packets of the connection (SO_INCOMING_CPU),
+    // so the buffers it allocates are local to the node and the packets
+    void pin_workers(bool enable);
+
+    // applies options to the listening socket and to the connections accepted from now on,
+    // see socket_profile(), before the server starts accepting connections
+    void socket_options(const SocketOptions &options, std::error_code &ec);
+
+    const SocketOptions &socket_options() const
+    {
+        return m_socketOptions;
     }
 
+    // also accepts connections on an AF_UNIX stream socket, for a proxy on the same host;
+    // a path starting with '@' is a name in the abstract namespace, any other one a socket
+    // file with the permissions of mode that replaces a stale file of a server that is gone,
+    // the file is left when the server exits as a server taking over may still use it.
+    // Before the server starts accepting connections.
+    void listen_unix(const std::string &path, mode_t mode, std::error_code &ec);
+
     void get_connection(Connection &out, std::thread::id _id, std::error_code &ec)
     {
         std::lock_guard lg(m_mutex);
@@ -120,20 +199,26 @@ public:
         iter = m_threads.find(_id);
         if (iter == m_threads.end()) {
             ec = make_error_code(HttpStatus::HTTP_ERR_THREAD_NOT_FOUND);
+            return;
         }
         out =  iter->second.get()->conn();
     }
 
     void remove_thread(std::thread::id _id, std::error_code &ec)
     {
-        std::lock_guard lg(m_mutex);
-        std::map<std::thread::id, std::shared_ptr<TcpThread>>::iterator iter;
-        iter = m_threads.find(_id);
-        if (iter == m_threads.end()) {
-            ec = make_error_code(HttpStatus::HTTP_ERR_THREAD_NOT_FOUND);
-            return;
+        std::shared_ptr<TcpThread> threadPtr;
+        {
+            std::lock_guard lg(m_mutex);
+            std::map<std::thread::id, std::shared_ptr<TcpThread>>::iterator iter;
+            iter = m_threads.find(_id);
+            if (iter == m_threads.end()) {
+                ec = make_error_code(HttpStatus::HTTP_ERR_THREAD_NOT_FOUND);
+                return;
+            }
+            threadPtr = std::move(iter->second);
+            m_threads.erase(iter);
         }
-        m_threads.erase(iter->first);
+        // joined outside the lock, the thread may still be on its way out
     }
 
     void set_thread(std::shared_ptr<TcpThread> threadPtr)
@@ -150,36 +235,52 @@ public:
 
     void add_thread_to_remove(std::thread::id _id)
     {
+        std::lock_guard lg(m_mutex);
         m_remove.push_back(_id);
     }
 
     void thread_remover(std::error_code &ec)
     {
-        for (std::vector<std::thread::id>::iterator iter = m_remove.begin(), end = m_remove.end();
-            iter != end; ++iter)
+        std::vector<std::thread::id> remove;
+        {
+            std::lock_guard lg(m_mutex);
+            remove.swap(m_remove);
+        }
+        for (std::thread::id _id : remove)
         {
-            remove_thread(*iter, ec);
-            m_remove.erase(iter);
+            remove_thread(_id, ec);
             if (ec.value()) {
                 return;
             }
         }
     }
 
+    const AdmissionControl &admission() const
+    {
+        return m_admission;
+    }
+
+    // limits per client, configure() it before the server starts accepting connections
+    RateLimiter &rate_limiter()
+    {
+        return m_rateLimiter;
+    }
+
 protected:
     virtual void incoming_handler(
                         const Connection &conn,
-                        tslogger::Logger &logger,
                         std::error_code &ec
                     );
-protected:
-    #define LOG_D(...) LOG(m_logger, tslogger::DEBUG, __VA_ARGS__)
-    #define LOG_I(...) LOG(m_logger, tslogger::INFO, __VA_ARGS__)
-    #define LOG_W(...) LOG(m_logger, tslogger::WARNING, __VA_ARGS__)
-    #define LOG_E(...) LOG(m_logger, tslogger::ERROR, __VA_ARGS__)
-    #define ENTER() ENTER_LOG(m_logger, tslogger::DEBUG)
-    #define EXIT() EXIT_LOG(m_logger, tslogger::DEBUG)
-    #define CODE_LINE(msg) LOG_D("> %s:%d %s: %s\n",  __FILE__,  __LINE__, __func__, msg)
+    // answers a connection over the limits and closes it, it must not block
+    virtual void reject(const Connection &conn);
+
+private:
+    int open_listener(int port, bool ipv4, unsigned int maxClients, std::error_code &ec);
+    int take_over(int port, std::error_code &ec);
+    void handoff_server(std::stop_token st);
+    void sizing_loop(std::stop_token st, ThreadSizer sizer);
+    void spawn(Connection &&conn);
+    void serve(const Connection &conn);
 
 private:
     std::atomic<bool> m_running;
@@ -189,10 +290,21 @@ private:
     std::map<std::thread::id, std::shared_ptr<TcpThread>> m_threads;
     std::vector<std::thread::id> m_remove;
     std::mutex m_mutex;
-    tslogger::Logger m_logger;
+    AdmissionControl m_admission;
+    RateLimiter m_rateLimiter;
+    std::atomic<bool> m_draining;
+    int m_wake[2];      // a pipe, a byte in it ends the select() of accept()
+    int m_handoffPeer;  // the server this one took over from until it is confirmed
+    std::vector<int> m_unixListeners;
+    std::vector<int> m_takenOver;   // Unix listeners of the server taken over from, listen_unix() picks them up
+    std::jthread m_handoffThread;
+    std::jthread m_sizingThread;
+    bool m_pinWorkers;
+    CpuTopology m_topology;
+    SocketOptions m_socketOptions;
 };
 
-void log_connection(tslogger::Logger &logger, const Connection &conn);
+void log_connection(const Connection &conn);
 
 }// namespace http
 
@@ -22,8 +22,7 @@ public:
 	virtual ~TcpThread()
 	{
 		std::cout << "~TcpThread()\n";
-		if (m_conn.sockfd > 0)
-			::close(m_conn.sockfd);
+		// the thread closes its connections itself
 	}
 
 	TcpThread &operator=(const TcpThread &other)
@@ -0,0 +1,36 @@
+#ifndef _TOPOLOGY_HPP
+#define _TOPOLOGY_HPP
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace http
+{
+
+// The NUMA nodes of /sys/devices/system/node and their CPUs, limited to the
+// affinity mask of the process. Without NUMA in sysfs all CPUs are one node.
+struct CpuTopology
+{
+    std::vector<std::vector<int>> nodes; // CPUs per node, nodes without usable CPUs are left out
+    std::vector<int> cpuNode;            // node index per CPU number, -1 for CPUs not in the mask
+
+    int node_of(int cpu) const
+    {
+        return cpu >= 0 && static_cast<size_t>(cpu) < cpuNode.size() ? cpuNode[cpu] : -1;
+    }
+};
+
+CpuTopology read_cpu_topology();
+
+// "0-3,8,10-11" as in sysfs cpulist files
+std::vector<int> parse_cpu_list(const std::string &list);
+
+// the CPU the packets of a connection were last processed on, -1 if the kernel does not tell
+int incoming_cpu(int sockfd);
+
+// binds the calling thread to the CPUs of a node
+void pin_to_node(const CpuTopology &topology, int node, std::error_code &ec);
+
+}// namespace http
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef _TRACE_HPP
+#define _TRACE_HPP
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace http
+{
+
+enum TracePhase
+{
+    TRACE_RECEIVE = 0,  // recvfrom() of the request
+    TRACE_PARSE,        // FSA_STATE_PARSE_INCOMMING_HTTP_PDU
+    TRACE_HANDLE,       // FSA_STATE_HANDLE_GET_REQUEST
+    TRACE_LOOKUP,       // ContentSource::lookup(), stat and mmap on a cache miss
+    TRACE_COMPRESS,     // deflating a file
+    TRACE_COMPRESS_WAIT,// waiting for another thread deflating the same file
+    TRACE_DONE,         // FSA_STATE_DONE
+    TRACE_SEND,         // send() of a segment in memory
+    TRACE_SENDFILE,     // sendfile() of a file range
+    TRACE_FILE_WAIT,    // waiting for FileIo to read a file range that was not in the page cache
+    TRACE_PHASE_COUNT,
+};
+
+enum {
+    TRACE_MAX_SPANS = 32,       // per request, later spans are not recorded
+    TRACE_MAX_URI = 64,         // longer URIs are truncated
+    TRACE_RING_SIZE = 4096,     // sampled requests kept, the oldest are overwritten
+};
+
+struct TraceOptions
+{
+    unsigned sampleEvery = 0;   // trace one in that many requests at random, 0 to disable
+    uint64_t slowNs = 0;        // trace every request slower than that, 0 to disable
+};
+
+// Ticks of the time stamp counter, or ns of CLOCK_MONOTONIC where there is none.
+// Ticks become ns only when the ring is exported, the TSC is assumed invariant.
+inline uint64_t trace_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// Every request of a thread is traced into a buffer of the thread, that costs
+// a counter read per span. Whether the request is kept is decided at its end,
+// so that slow requests are never missed.
+void trace_begin();
+void trace_span(TracePhase phase, uint64_t begin, uint64_t end);
+void trace_end(const TraceOptions &options, std::string_view uri, int status, uint64_t durationNs);
+
+// Chrome trace event JSON of the sampled requests, for chrome://tracing or Perfetto
+void render_trace(std::string &out);
+
+class TraceSpan
+{
+public:
+    explicit TraceSpan(TracePhase phase)
+    : m_phase{phase},
+      m_begin{trace_ticks()}
+    {}
+
+    ~TraceSpan()
+    {
+        trace_span(m_phase, m_begin, trace_ticks());
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan &operator=(const TraceSpan&) = delete;
+
+private:
+    TracePhase m_phase;
+    uint64_t m_begin;
+};
+
+}// namespace http
+
+#endif
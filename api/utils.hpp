@@ -8,11 +8,11 @@ unsigned long long get_total_system_memory();
 unsigned int get_total_cpu_cores();
 unsigned int get_max_threads(unsigned long maxBufLenPerThread);
 size_t get_file_size(std::filesystem::path &filename, std::error_code &ec);
-size_t compress_file(
-			std::filesystem::path &filename,
-			tslogger::Logger &logger,
-			http::Buffer<char, http::MAX_BUFFER_SIZE> &out,
-			std::error_code &ec
-		);
+size_t compress_bound(size_t size);
+size_t compress_to_string(const char *data, size_t size, std::string &out, std::error_code &ec, int level = 9);
+size_t send_all(int sockfd, const char *data, size_t size, std::error_code &ec);
+size_t send_file(int sockfd, int fd, off_t offset, size_t size, std::error_code &ec);
+// reads all of a file range, false on an error or if the file ends before the range
+bool read_range(int fd, char *out, size_t length, off_t offset);
 
 #endif
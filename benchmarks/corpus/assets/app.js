@@ -0,0 +1,116 @@
+(function () {
+    'use strict';
+
+    var STORAGE_KEY = 'esn-theme';
+    var root = document.documentElement;
+
+    function preferredTheme() {
+        var stored = null;
+        try {
+            stored = window.localStorage.getItem(STORAGE_KEY);
+        } catch (e) {
+            // private mode, storage is not available
+        }
+        if (stored === 'light' || stored === 'dark') {
+            return stored;
+        }
+        return window.matchMedia && window.matchMedia('(prefers-color-scheme: dark)').matches ? 'dark' : 'light';
+    }
+
+    function applyTheme(theme) {
+        root.setAttribute('data-theme', theme);
+        var toggle = document.querySelector('.theme-toggle');
+        if (toggle) {
+            toggle.setAttribute('aria-pressed', theme === 'dark' ? 'true' : 'false');
+        }
+    }
+
+    function formatDate(iso) {
+        var date = new Date(iso);
+        if (isNaN(date.getTime())) {
+            return iso;
+        }
+        return date.toLocaleDateString(undefined, { year: 'numeric', month: 'long', day: 'numeric' });
+    }
+
+    function renderArticles(container, items) {
+        var fragment = document.createDocumentFragment();
+        items.slice(0, 10).forEach(function (item) {
+            var article = document.createElement('article');
+            var title = document.createElement('h3');
+            var link = document.createElement('a');
+            link.href = item.url;
+            link.textContent = item.title;
+            title.appendChild(link);
+            var meta = document.createElement('p');
+            meta.className = 'meta';
+            meta.textContent = formatDate(item.date_published) + ' · ' + item.reading_time + ' min read';
+            var summary = document.createElement('p');
+            summary.textContent = item.summary;
+            article.appendChild(title);
+            article.appendChild(meta);
+            article.appendChild(summary);
+            fragment.appendChild(article);
+        });
+        container.innerHTML = '';
+        container.appendChild(fragment);
+    }
+
+    function loadFeed() {
+        var container = document.querySelector('#latest');
+        if (!container || !window.fetch) {
+            return;
+        }
+        fetch('/data.json', { headers: { 'Accept': 'application/json' } })
+            .then(function (response) {
+                if (!response.ok) {
+                    throw new Error('HTTP ' + response.status);
+                }
+                return response.json();
+            })
+            .then(function (feed) {
+                if (feed && Array.isArray(feed.items)) {
+                    renderArticles(container, feed.items);
+                }
+            })
+            .catch(function (error) {
+                console.warn('feed is not available:', error.message);
+            });
+    }
+
+    function trackScroll() {
+        var header = document.querySelector('.site-header');
+        var ticking = false;
+        if (!header) {
+            return;
+        }
+        window.addEventListener('scroll', function () {
+            if (ticking) {
+                return;
+            }
+            ticking = true;
+            window.requestAnimationFrame(function () {
+                header.classList.toggle('scrolled', window.scrollY > 8);
+                ticking = false;
+            });
+        }, { passive: true });
+    }
+
+    document.addEventListener('DOMContentLoaded', function () {
+        applyTheme(preferredTheme());
+        var toggle = document.querySelector('.theme-toggle');
+        if (toggle) {
+            toggle.addEventListener('click', function () {
+                var next = root.getAttribute('data-theme') === 'dark' ? 'light' : 'dark';
+                applyTheme(next);
+                try {
+                    window.localStorage.setItem(STORAGE_KEY, next);
+                } catch (e) {
+                    // ignored, the theme just is not remembered
+                }
+            });
+        }
+        loadFeed();
+        trackScroll();
+    });
+}());
@@ -0,0 +1,193 @@
+// shs-benchmarks [--filter <substring>] [--min-time <seconds>] [--json <file>]
+//                [--compare <file>] [--corpus <dir>]
+// Runs the registered cases and prints ns per call. --json writes the results,
+// --compare prints the change against results written by an earlier build.
+#include "harness.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <unistd.h>
+
+#ifndef SHS_BENCH_CORPUS
+#define SHS_BENCH_CORPUS "benchmarks/corpus"
+#endif
+
+namespace bench
+{
+
+enum {
+    REPETITIONS = 5, // batches per case, the median is reported
+};
+
+struct Result
+{
+    std::string name;
+    size_t iterations;  // per batch
+    double minNs;       // per call
+    double medianNs;
+    double bytesPerSecond;
+};
+
+static std::vector<Case> &cases()
+{
+    static std::vector<Case> all;
+    return all;
+}
+
+void add(const std::string &name, size_t bytes, std::function<void()> op)
+{
+    cases().push_back({name, bytes, std::move(op)});
+}
+
+static double run_batch(const Case &c, size_t iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        c.op();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static Result measure(const Case &c, double minSeconds)
+{
+    // grows the batch until it takes a fair share of the time of the case
+    double target = minSeconds * 1e9 / static_cast<int>(REPETITIONS);
+    size_t iterations = 1;
+    double ns = run_batch(c, iterations);
+    while (ns < target && iterations < (size_t(1) << 40))
+    {
+        size_t next = ns > 0 ? static_cast<size_t>(iterations * target / ns * 1.2) : iterations * 10;
+        iterations = std::clamp(next, iterations + 1, iterations * 10);
+        ns = run_batch(c, iterations);
+    }
+
+    std::vector<double> perCall;
+    for (int r = 0; r < REPETITIONS; ++r)
+        perCall.push_back(run_batch(c, iterations) / iterations);
+    std::sort(perCall.begin(), perCall.end());
+    double median = perCall[perCall.size() / 2];
+    return {c.name, iterations, perCall.front(), median, c.bytes ? c.bytes * 1e9 / median : 0.0};
+}
+
+static std::string json_escape(const std::string &s)
+{
+    std::string out;
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+// one benchmark per line, so --compare can read the file back without a JSON parser
+static bool write_json(const char *path, const std::vector<Result> &results)
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    char date[32];
+    time_t now = time(nullptr);
+    struct tm tm;
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &tm));
+    out << "{\"context\":{\"date\":\"" << date << "\",\"host\":\"" << json_escape(host)
+        << "\",\"compiler\":\"" << json_escape(__VERSION__) << "\"},\n\"benchmarks\":[\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result &r = results[i];
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "{\"name\":\"%s\",\"iterations\":%zu,\"ns_per_op\":%.3f,\"min_ns_per_op\":%.3f,\"bytes_per_second\":%.0f}%s\n",
+                 json_escape(r.name).c_str(), r.iterations, r.medianNs, r.minNs, r.bytesPerSecond,
+                 i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "]}\n";
+    return bool(out);
+}
+
+static std::map<std::string, double> read_json(const char *path)
+{
+    std::map<std::string, double> medians;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t name = line.find("\"name\":\"");
+        size_t ns = line.find("\"ns_per_op\":");
+        if (name == std::string::npos || ns == std::string::npos)
+            continue;
+        name += strlen("\"name\":\"");
+        medians[line.substr(name, line.find('"', name) - name)] = atof(line.c_str() + ns + strlen("\"ns_per_op\":"));
+    }
+    return medians;
+}
+
+}// namespace bench
+
+using namespace bench;
+
+int main(int argc, char *argv[])
+{
+    const char *filter = "";
+    const char *jsonPath = nullptr;
+    const char *comparePath = nullptr;
+    std::string corpus = SHS_BENCH_CORPUS;
+    double minSeconds = 0.5;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--filter") == 0 && hasValue)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "--min-time") == 0 && hasValue)
+            minSeconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0 && hasValue)
+            jsonPath = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && hasValue)
+            comparePath = argv[++i];
+        else if (strcmp(argv[i], "--corpus") == 0 && hasValue)
+            corpus = argv[++i];
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--filter <substring>] [--min-time <seconds>]"
+                      << " [--json <file>] [--compare <file>] [--corpus <dir>]\n";
+            return 1;
+        }
+    }
+
+    register_cases(corpus);
+    std::map<std::string, double> baseline;
+    if (comparePath != nullptr)
+        baseline = read_json(comparePath);
+
+    std::vector<Result> results;
+    printf("%-48s %14s %14s %12s%s\n", "benchmark", "ns/op", "min ns/op", "MB/s", comparePath ? "     change" : "");
+    for (const Case &c : cases())
+    {
+        if (c.name.find(filter) == std::string::npos)
+            continue;
+        Result r = measure(c, minSeconds);
+        printf("%-48s %14.1f %14.1f %12.1f", r.name.c_str(), r.medianNs, r.minNs, r.bytesPerSecond / 1e6);
+        auto old = baseline.find(r.name);
+        if (old != baseline.end() && old->second > 0)
+            printf(" %+10.1f%%", (r.medianNs - old->second) * 100 / old->second);
+        printf("\n");
+        fflush(stdout);
+        results.push_back(r);
+    }
+
+    if (jsonPath != nullptr && !write_json(jsonPath, results)) {
+        std::cerr << jsonPath << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef _HARNESS_HPP
+#define _HARNESS_HPP
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace bench
+{
+
+// One measured operation. bytes is the input size of one call, 0 if a
+// throughput makes no sense for it.
+struct Case
+{
+    std::string name;
+    size_t bytes;
+    std::function<void()> op;
+};
+
+void add(const std::string &name, size_t bytes, std::function<void()> op);
+
+// keeps the compiler from dropping a result that is never used
+template <typename T>
+inline void keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// defined by the benchmark translation units, registers the cases with add()
+void register_cases(const std::string &corpus);
+
+}// namespace bench
+
+#endif
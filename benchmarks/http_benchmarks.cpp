@@ -0,0 +1,424 @@
+// Cases for the request path: parsing, header rendering, MIME lookup,
+// compression and the per-request buffer, on the requests and assets in corpus/;
+// the HPACK, Huffman and base64url codecs are checked against known vectors first
+#include "harness.hpp"
+#include "http_server.hpp"
+#include "http2.hpp"
+#include "hpack.hpp"
+#include "file_cache.hpp"
+#include "mime.hpp"
+#include "rate_limit.hpp"
+#include "utils.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+
+using namespace http;
+
+namespace http
+{
+
+struct RequestHandlerBench
+{
+    static void load(RequestHandler &rh, const std::string &pdu)
+    {
+        memcpy(rh.m_buffer.data(), pdu.data(), pdu.size());
+        rh.m_offset = pdu.size();
+    }
+
+    static void parse(RequestHandler &rh)
+    {
+        rh.parse_incomming_http_pdu();
+    }
+
+    static std::error_code lookup(RequestHandler &rh, const std::string &path)
+    {
+        std::error_code ec;
+        rh.m_source.lookup(path, rh.m_asset, ec);
+        if (!ec.value() && rh.m_asset.deflatable)
+            rh.m_source.deflate(rh.m_asset, ec);
+        return ec;
+    }
+
+    static void render_head(RequestHandler &rh, bool deflate)
+    {
+        rh.m_segments.clear();
+        rh.create_head_response(deflate);
+    }
+};
+
+}// namespace http
+
+namespace bench
+{
+
+struct CorpusRequest
+{
+    std::string name;
+    std::string pdu;
+};
+
+static std::string read_file(const std::filesystem::path &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << path << ": cannot be read\n";
+        exit(1);
+    }
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+// "### <name>" starts a request, lines are sent with CRLF, an empty line ends the header
+static std::vector<CorpusRequest> read_requests(const std::filesystem::path &path)
+{
+    std::vector<CorpusRequest> requests;
+    std::istringstream in(read_file(path));
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.rfind("### ", 0) == 0)
+            requests.push_back({line.substr(4), ""});
+        else if (!requests.empty() && (line.empty() || line[0] != '#'))
+            requests.back().pdu += line + "\r\n";
+    }
+    return requests;
+}
+
+// the validators in the corpus are replaced with the ones of the checked out files
+static void set_field(std::string &pdu, const char *name, std::string_view value)
+{
+    size_t begin = pdu.find(name);
+    if (begin == std::string::npos)
+        return;
+    begin += strlen(name);
+    pdu.replace(begin, pdu.find("\r\n", begin) - begin, value);
+}
+
+// the assets one after another until size bytes, a stand-in for bigger files of the same kind
+static std::string make_input(const std::vector<std::string> &assets, size_t size)
+{
+    std::string out;
+    for (size_t i = 0; out.size() < size; ++i)
+        out += assets[i % assets.size()];
+    out.resize(size);
+    return out;
+}
+
+static std::string size_name(size_t size)
+{
+    return size >= 1048576 ? std::to_string(size / 1048576) + "M" : std::to_string(size / 1024) + "K";
+}
+
+// the octets of hex digits, spaces are skipped
+static std::string unhex(const char *hex)
+{
+    std::string out;
+    for (const char *p = hex; *p != '\0'; ++p)
+    {
+        if (*p == ' ')
+            continue;
+        out += char(std::stoi(std::string(p, 2), nullptr, 16));
+        ++p;
+    }
+    return out;
+}
+
+// A header block of RFC 7541 appendix C, decoded by one decoder after the blocks before it
+struct HpackVector
+{
+    const char *block;
+    std::vector<HeaderField> fields;
+    size_t tableSize;   // of the dynamic table after the block
+};
+
+static const std::vector<HeaderField> C3_1 = {
+    {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}};
+static const std::vector<HeaderField> C3_2 = {
+    {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+    {"cache-control", "no-cache"}};
+static const std::vector<HeaderField> C3_3 = {
+    {":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"}, {":authority", "www.example.com"},
+    {"custom-key", "custom-value"}};
+static const std::vector<HeaderField> C6_1 = {
+    {":status", "302"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+    {"location", "https://www.example.com"}};
+static const std::vector<HeaderField> C6_2 = {
+    {":status", "307"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+    {"location", "https://www.example.com"}};
+static const std::vector<HeaderField> C6_3 = {
+    {":status", "200"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+    {"location", "https://www.example.com"}, {"content-encoding", "gzip"},
+    {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}};
+
+static const std::vector<std::vector<HpackVector>> hpackVectors = {
+    // C.2, one field per block
+    {{"400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572", {{"custom-key", "custom-header"}}, 55}},
+    {{"040c 2f73 616d 706c 652f 7061 7468", {{":path", "/sample/path"}}, 0}},
+    {{"1008 7061 7373 776f 7264 0673 6563 7265 74", {{"password", "secret"}}, 0}},
+    {{"82", {{":method", "GET"}}, 0}},
+    // C.3, requests without Huffman coding
+    {{"8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", C3_1, 57},
+     {"8286 84be 5808 6e6f 2d63 6163 6865", C3_2, 110},
+     {"8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65", C3_3, 164}},
+    // C.4, the same requests with Huffman coding
+    {{"8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", C3_1, 57},
+     {"8286 84be 5886 a8eb 1064 9cbf", C3_2, 110},
+     {"8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf", C3_3, 164}},
+    // C.6, responses with Huffman coding in a table of 256 octets, which entries are evicted
+    // from; the appendix sets the size out of band, here a size update in front does it
+    {{"3fe101 4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+      " 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3", C6_1, 222},
+     {"4883 640e ffc1 c0bf", C6_2, 222},
+     {"88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab"
+      " 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+      " 9587 3160 65c0 03ed 4ee5 b106 3d50 07", C6_3, 215}},
+};
+
+static bool check(bool ok, const std::string &what)
+{
+    if (!ok)
+        std::cerr << "self-check failed: " << what << "\n";
+    return ok;
+}
+
+// the codecs of HTTP/2 against RFC 7541 appendix C and base64url, false on a mismatch
+static bool check_codecs()
+{
+    bool ok = true;
+    std::error_code ec;
+    std::vector<HeaderField> fields;
+
+    for (const std::vector<HpackVector> &sequence : hpackVectors)
+    {
+        HpackDecoder decoder;
+        for (const HpackVector &v : sequence)
+        {
+            fields.clear();
+            decoder.decode(unhex(v.block), fields, ec);
+            ok &= check(!ec.value() && fields == v.fields, std::string("hpack decode ") + v.block);
+            ok &= check(decoder.table().size() == v.tableSize, std::string("hpack table size after ") + v.block);
+        }
+    }
+
+    // a size update to 0 empties the table, an index into it is an error afterwards
+    HpackDecoder decoder;
+    decoder.decode(unhex(hpackVectors[4][0].block), fields, ec);
+    fields.clear();
+    decoder.decode(unhex("20"), fields, ec);
+    ok &= check(!ec.value() && decoder.table().size() == 0, "hpack size update to 0");
+    decoder.decode(unhex("3fe11f be"), fields, ec);
+    ok &= check(ec.value() != 0, "hpack index into an emptied table");
+    // and past what SETTINGS allow
+    HpackDecoder limited;
+    ec.clear();
+    limited.decode(unhex("3fe21f"), fields, ec);
+    ok &= check(ec.value() != 0, "hpack size update over HPACK_TABLE_SIZE");
+
+    // the encoder in a table of 256 octets, read back by a decoder
+    HpackEncoder encoder;
+    HpackDecoder peer;
+    encoder.max_size(256);
+    for (const std::vector<HeaderField> *response : {&C6_1, &C6_2, &C6_3, &C6_3})
+    {
+        std::string block;
+        encoder.begin(block);
+        for (const HeaderField &field : *response)
+            encoder.encode(field.first, field.second, block);
+        fields.clear();
+        ec.clear();
+        peer.decode(block, fields, ec);
+        ok &= check(!ec.value() && fields == *response, "hpack encode " + (*response)[0].second);
+        ok &= check(peer.table().size() <= 256 && peer.table().max_size() == 256, "hpack encoder table size");
+    }
+
+    // C.4.1 and C.6.1 strings
+    const std::pair<const char *, const char *> huffman[] = {
+        {"www.example.com", "f1e3 c2e5 f23a 6ba0 ab90 f4ff"},
+        {"no-cache", "a8eb 1064 9cbf"},
+        {"custom-key", "25a8 49e9 5ba9 7d7f"},
+        {"custom-value", "25a8 49e9 5bb8 e8b4 bf"},
+        {"302", "6402"},
+        {"private", "aec3 771a 4b"},
+        {"Mon, 21 Oct 2013 20:13:21 GMT", "d07a be94 1054 d444 a820 0595 040b 8166 e082 a62d 1bff"},
+        {"https://www.example.com", "9d29 ad17 1863 c78f 0b97 c8e9 ae82 ae43 d3"},
+    };
+    for (const auto &[text, code] : huffman)
+    {
+        std::string encoded, decoded;
+        huffman_encode(text, encoded);
+        ok &= check(encoded == unhex(code) && huffman_length(text) == encoded.size(), std::string("huffman encode ") + text);
+        ok &= check(huffman_decode(unhex(code), decoded) && decoded == text, std::string("huffman decode ") + text);
+    }
+    // the padding is the most significant bits of EOS, and at most 7 of them
+    std::string decoded;
+    ok &= check(huffman_decode(unhex("07"), decoded) && decoded == "0", "huffman padding");
+    ok &= check(!huffman_decode(unhex("00"), decoded), "huffman padding of zeros");
+    ok &= check(!huffman_decode(unhex("6402 ff"), decoded), "huffman padding of 8 bits");
+
+    // HTTP2-Settings, RFC 4648 section 5 without padding
+    const std::pair<const char *, const char *> base64url[] = {
+        {"AAMAAABk", "0003 0000 0064"},
+        {"AAMAAABkAAQAAP__", "0003 0000 0064 0004 0000 ffff"},
+        {"----____", "fbef beff ffff"},
+        {"", ""},
+    };
+    for (const auto &[field, payload] : base64url)
+    {
+        std::string out;
+        ok &= check(h2_settings_payload(field, out) && out == unhex(payload), std::string("base64url ") + field);
+    }
+    std::string out;
+    ok &= check(!h2_settings_payload("AAMA+ABk", out), "base64url with +");
+    ok &= check(!h2_settings_payload("AAMA/ABk", out), "base64url with /");
+    ok &= check(!h2_settings_payload("AAMAAA", out), "base64url of a partial setting");
+    return ok;
+}
+
+void register_cases(const std::string &corpus)
+{
+    const std::filesystem::path assetDir = std::filesystem::path(corpus) / "assets";
+    std::error_code ec;
+
+    // numbers of a codec that is off are worth nothing
+    if (!check_codecs())
+        exit(1);
+
+    // shared by all cases, they run one at a time on this thread
+    static std::filesystem::path root = assetDir;
+    static FileCache cache(root);
+    static StaticResponses responses;
+    static HttpOptions options;
+    options.cacheControl = "no-cache";
+    cache.start(ec);
+    if (ec.value()) {
+        std::cerr << assetDir << ": " << ec.message() << "\n";
+        exit(1);
+    }
+
+    for (const CorpusRequest &corpusRequest : read_requests(std::filesystem::path(corpus) / "requests.txt"))
+    {
+        auto rh = std::make_shared<RequestHandler>(cache, responses, options);
+        auto pdu = std::make_shared<std::string>(corpusRequest.pdu);
+
+        RequestHandlerBench::load(*rh, *pdu);
+        RequestHandlerBench::parse(*rh);
+        std::string path = rh->request().uri.substr(1);
+        if (RequestHandlerBench::lookup(*rh, path).value()) {
+            std::cerr << corpusRequest.name << ": " << path << " is not in " << assetDir << "\n";
+            exit(1);
+        }
+        Asset asset;
+        cache.lookup(path, asset, ec);
+        // the revalidating browser accepts deflate, so it has the ETag of the deflated body
+        set_field(*pdu, "If-None-Match: ", asset.deflatable ? asset.deflatedEtag : asset.etag);
+        set_field(*pdu, "If-Modified-Since: ", asset.lastModified);
+        RequestHandlerBench::load(*rh, *pdu);
+
+        add("parse/" + corpusRequest.name, pdu->size(), [rh] {
+            RequestHandlerBench::parse(*rh);
+            keep(rh->request());
+        });
+        // the whole FSA, the response header overwrites the request in the buffer
+        add("process/" + corpusRequest.name, pdu->size(), [rh, pdu] {
+            RequestHandlerBench::load(*rh, *pdu);
+            rh->process();
+            keep(rh->status());
+        });
+        if (rh->request().cmd == HEAD) {
+            add("create_header/identity", 0, [rh] {
+                RequestHandlerBench::render_head(*rh, false);
+                keep(rh->offset());
+            });
+            add("create_header/deflate", 0, [rh] {
+                RequestHandlerBench::render_head(*rh, true);
+                keep(rh->offset());
+            });
+        }
+    }
+
+    for (const char *ext : {".html", ".css", ".js", ".png", ".jpg", ".ico", ".json", ".svg"})
+    {
+        add(std::string("file_extention2content_type/") + (ext + 1), 0, [ext] {
+            keep(file_extention2content_type(ext));
+        });
+    }
+
+    std::vector<std::string> assets;
+    for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(assetDir))
+        assets.push_back(read_file(entry.path()));
+    for (size_t size : {1024, 16384, 262144, 1048576})
+    {
+        auto input = std::make_shared<std::string>(make_input(assets, size));
+        for (int level : {1, 6, 9})
+        {
+            add("compress_to_string/" + size_name(size) + "/level" + std::to_string(level), size, [input, level] {
+                std::string out;
+                std::error_code ec;
+                keep(compress_to_string(input->data(), input->size(), out, ec, level));
+            });
+        }
+    }
+
+    // RequestHandler owns a RequestBuffer, the echo handler of TcpServer a CharBuffer
+    static std::shared_ptr<CharBuffer> charBuffer = std::make_shared<CharBuffer>();
+    add("buffer/allocate", 0, [] {
+        CharBuffer buffer;
+        keep(buffer.data());
+    });
+    add("buffer/allocate_request", 0, [] {
+        RequestBuffer buffer;
+        keep(buffer.data());
+    });
+    add("buffer/clear", MAX_BUFFER_SIZE, [] {
+        charBuffer->clear();
+        keep(charBuffer->data());
+    });
+    add("request_handler/construct", 0, [] {
+        RequestHandler rh(cache, responses, options);
+        keep(rh.offset());
+    });
+
+    // the check every request of a client makes, one client or many spread over the table
+    static RateLimiter limiter;
+    RateLimitOptions limits;
+    limits.requestsPerSecond = 1000000000;
+    limits.requestBurst = 1000;
+    limiter.configure(limits);
+    static Connection client;
+    client.ipv4 = true;
+    client.client.addr.sin_family = AF_INET;
+    client.client.addr.sin_addr.s_addr = htonl(0x0a000001);
+    add("rate_limit/allow_request", 0, [] {
+        keep(limiter.allow_request(client));
+    });
+    add("rate_limit/allow_request/many_clients", 0, [] {
+        static uint32_t n = 0;
+        client.client.addr.sin_addr.s_addr = htonl(0x0a000000 + (n++ & 0xffff));
+        keep(limiter.allow_request(client));
+    });
+
+    // the requests of RFC 7541 C.4 on a new connection, and a response header on one in use
+    static const std::string c4[] = {unhex(hpackVectors[5][0].block), unhex(hpackVectors[5][1].block),
+                                     unhex(hpackVectors[5][2].block)};
+    add("hpack/decode/requests", c4[0].size() + c4[1].size() + c4[2].size(), [] {
+        HpackDecoder decoder;
+        std::vector<HeaderField> fields;
+        std::error_code ec;
+        for (const std::string &block : c4)
+            decoder.decode(block, fields, ec);
+        keep(fields.size());
+    });
+    static HpackEncoder encoder;
+    add("hpack/encode/response", 0, [] {
+        std::string block;
+        encoder.begin(block);
+        for (const HeaderField &field : C6_3)
+            encoder.encode(field.first, field.second, block);
+        keep(block.size());
+    });
+}
+
+}// namespace bench
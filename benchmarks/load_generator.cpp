@@ -0,0 +1,696 @@
+// shs-bench [options] <path> | @<url file>
+// HTTP load generator for the loopback. Every connection runs on a thread of
+// its own. Closed loop (default) keeps --pipeline requests in flight per
+// connection, open loop (--rate) sends on a fixed schedule and measures from
+// the time a request was due, so a stalled server shows up in the latency
+// instead of slowing the client down (no coordinated omission).
+// A URL file has a path and an optional weight per line, # starts a comment.
+// --unix sends the same load over an AF_UNIX socket, to compare it with the
+// loopback TCP of another run.
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <logger.hpp>
+#include "http_server.hpp"
+#include "metrics.hpp"
+
+using namespace http;
+
+enum {
+    LATENCY_SUB_BUCKET_BITS = 7,     // 128 buckets per power of two, under 1% error
+    LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BUCKET_BITS,
+    LATENCY_MAX_BITS = 40,           // 2^40 ns, about 18 minutes
+    LATENCY_BUCKETS = (LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS,
+    RESPONSE_TIMEOUT_MS = 5000,      // a connection without an answer for that long is reopened
+    RECV_CHUNK = 65536,
+};
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::string unixPath;            // connects to this Unix socket in place of host and port, @ for the abstract namespace
+    unsigned connections = 16;
+    unsigned pipeline = 1;           // requests in flight per connection
+    bool keepAlive = true;
+    double duration = 10;            // seconds measured
+    double warmup = 1;               // seconds before that, not measured
+    double rate = 0;                 // requests per second of all connections, 0 for closed loop
+    std::vector<std::string> headers;
+    const char *serveRoot = nullptr; // doc root or bundle of an in-process server
+    bool pinWorkers = false;         // the in-process server pins its threads to NUMA nodes
+    std::string profile = "default"; // socket profile of the in-process server
+    const char *jsonPath = nullptr;
+    double minRps = 0;               // exit code 2 below that throughput
+};
+
+// Log bucketed like the server metrics but finer, the percentiles are exact to the bucket
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()
+    : m_buckets(LATENCY_BUCKETS, 0),
+      m_count{0},
+      m_sum{0},
+      m_max{0}
+    {}
+
+    void record(uint64_t ns)
+    {
+        ++m_buckets[bucket(ns)];
+        ++m_count;
+        m_sum += ns;
+        m_max = std::max(m_max, ns);
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < m_buckets.size(); ++i)
+            m_buckets[i] += other.m_buckets[i];
+        m_count += other.m_count;
+        m_sum += other.m_sum;
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    // upper bound of the bucket holding the quantile
+    uint64_t percentile(double q) const
+    {
+        uint64_t rank = static_cast<uint64_t>(q * m_count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            seen += m_buckets[i];
+            if (seen > rank)
+                return std::min(limit(i), m_max);
+        }
+        return m_max;
+    }
+
+    uint64_t count() const
+    {
+        return m_count;
+    }
+
+    double mean() const
+    {
+        return m_count ? double(m_sum) / m_count : 0;
+    }
+
+    uint64_t max() const
+    {
+        return m_max;
+    }
+
+private:
+    static size_t bucket(uint64_t ns)
+    {
+        if (ns < LATENCY_SUB_BUCKETS)
+            return ns;
+        unsigned msb = 63 - __builtin_clzll(ns);
+        if (msb >= LATENCY_MAX_BITS)
+            return LATENCY_BUCKETS - 1;
+        return (msb - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS
+             + ((ns >> (msb - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+    }
+
+    static uint64_t limit(size_t i)
+    {
+        if (i < LATENCY_SUB_BUCKETS)
+            return i + 1;
+        size_t shift = i / LATENCY_SUB_BUCKETS - 1;
+        return uint64_t(LATENCY_SUB_BUCKETS + i % LATENCY_SUB_BUCKETS + 1) << shift;
+    }
+
+private:
+    std::vector<uint64_t> m_buckets;
+    uint64_t m_count;
+    uint64_t m_sum;
+    uint64_t m_max;
+};
+
+struct Stats
+{
+    LatencyHistogram latency;
+    uint64_t responses[6] = {}; // by status class, [0] for anything unexpected
+    uint64_t bytes = 0;
+    uint64_t errors = 0;        // connects, sends and receives that failed or timed out
+    uint64_t late = 0;          // open loop requests sent after they were due
+
+    void merge(const Stats &other)
+    {
+        latency.merge(other.latency);
+        for (size_t i = 0; i < 6; ++i)
+            responses[i] += other.responses[i];
+        bytes += other.bytes;
+        errors += other.errors;
+        late += other.late;
+    }
+};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+    struct timespec ts = {static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+    {}
+}
+
+// the URLs repeated by weight, connections walk it from different offsets
+static bool read_urls(const char *arg, std::vector<std::string> &paths)
+{
+    if (arg[0] != '@') {
+        paths.push_back(arg);
+        return true;
+    }
+    std::ifstream in(arg + 1);
+    if (!in) {
+        std::cerr << (arg + 1) << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string path;
+        unsigned weight = 1;
+        if (!(fields >> path) || path[0] == '#')
+            continue;
+        fields >> weight;
+        paths.insert(paths.end(), weight, path);
+    }
+    if (paths.empty())
+        std::cerr << (arg + 1) << ": no URLs\n";
+    return !paths.empty();
+}
+
+static std::string make_request(const Options &options, const std::string &path)
+{
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + options.host + ":" + std::to_string(options.port)
+                        + "\r\nUser-Agent: shs-bench\r\nAccept: */*\r\n";
+    for (const std::string &header : options.headers)
+        request += header + "\r\n";
+    request += options.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    return request;
+}
+
+class Client
+{
+public:
+    Client(const Options &options, const std::vector<std::string> &requests, unsigned id)
+    : m_options{options},
+      m_requests{requests},
+      m_next{id * requests.size() / std::max(options.connections, 1u)},
+      m_fd{-1},
+      m_in{},
+      m_sent{}
+    {}
+
+    ~Client()
+    {
+        disconnect();
+    }
+
+    void run(uint64_t start, uint64_t measureFrom, uint64_t end, unsigned id, Stats &stats)
+    {
+        if (m_options.rate > 0)
+            open_loop(start, measureFrom, end, id, stats);
+        else
+            closed_loop(measureFrom, end, stats);
+    }
+
+private:
+    void closed_loop(uint64_t measureFrom, uint64_t end, Stats &stats)
+    {
+        while (now_ns() < end)
+        {
+            while (m_sent.size() < m_options.pipeline)
+            {
+                if (!send_next(now_ns(), stats))
+                    break;
+            }
+            if (!m_sent.empty())
+                receive(measureFrom, stats);
+        }
+    }
+
+    void open_loop(uint64_t start, uint64_t measureFrom, uint64_t end, unsigned id, Stats &stats)
+    {
+        // every connection sends at its share of the rate, the connections are staggered
+        uint64_t interval = static_cast<uint64_t>(1e9 * m_options.connections / m_options.rate);
+        uint64_t due = start + interval * id / m_options.connections;
+        while (due < end || !m_sent.empty())
+        {
+            uint64_t now = now_ns();
+            while (due < end && due <= now && m_sent.size() < m_options.pipeline)
+            {
+                if (now - due > interval)
+                    ++stats.late;
+                if (!send_next(due, stats))
+                    break;
+                due += interval;
+            }
+            if (!m_sent.empty()) {
+                if (!receive(measureFrom, stats) && now_ns() > end + uint64_t(RESPONSE_TIMEOUT_MS) * 1000000)
+                    break;
+            }
+            else if (due < end) {
+                sleep_until(due);
+            }
+        }
+    }
+
+    bool connect(Stats &stats)
+    {
+        int result;
+        if (!m_options.unixPath.empty()) {
+            m_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            struct sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            const std::string &path = m_options.unixPath;
+            memcpy(addr.sun_path, path.data(), std::min(path.size(), sizeof(addr.sun_path) - 1));
+            // a name in the abstract namespace has no terminating 0
+            socklen_t len = offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+            if (path[0] == '@') {
+                addr.sun_path[0] = 0;
+                --len;
+            }
+            result = ::connect(m_fd, reinterpret_cast<struct sockaddr *>(&addr), len);
+        }
+        else {
+            m_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(m_options.port);
+            inet_pton(AF_INET, m_options.host.c_str(), &addr.sin_addr);
+            int one = 1;
+            setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            result = ::connect(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+        }
+        if (result == -1) {
+            ++stats.errors;
+            disconnect();
+            // a refused connection would otherwise spin
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            return false;
+        }
+        return true;
+    }
+
+    void disconnect()
+    {
+        if (m_fd != -1)
+            ::close(m_fd);
+        m_fd = -1;
+        m_in.clear();
+        m_sent.clear();
+    }
+
+    // due is the time the latency of the request is measured from
+    bool send_next(uint64_t due, Stats &stats)
+    {
+        if (m_fd == -1 && !connect(stats))
+            return false;
+        const std::string &request = m_requests[m_next++ % m_requests.size()];
+        if (send_all(request) != request.size()) {
+            ++stats.errors;
+            disconnect();
+            return false;
+        }
+        m_sent.push_back(due);
+        return true;
+    }
+
+    size_t send_all(const std::string &data)
+    {
+        size_t total = 0;
+        while (total < data.size())
+        {
+            ssize_t n = ::send(m_fd, data.data() + total, data.size() - total, MSG_NOSIGNAL);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            total += n;
+        }
+        return total;
+    }
+
+    // waits for one response, false on a timeout or a broken connection
+    bool receive(uint64_t measureFrom, Stats &stats)
+    {
+        size_t length;
+        int status;
+        while (!complete_response(length, status))
+        {
+            struct pollfd pfd = {m_fd, POLLIN, 0};
+            int ready = ::poll(&pfd, 1, RESPONSE_TIMEOUT_MS);
+            if (ready == -1 && errno == EINTR)
+                continue;
+            char chunk[RECV_CHUNK];
+            ssize_t n = ready == 1 ? ::recv(m_fd, chunk, sizeof(chunk), 0) : -1;
+            if (n <= 0) {
+                stats.errors += m_sent.size();
+                disconnect();
+                return false;
+            }
+            m_in.append(chunk, n);
+        }
+        uint64_t now = now_ns();
+        if (m_sent.front() >= measureFrom) {
+            stats.latency.record(now - m_sent.front());
+            ++stats.responses[status >= 100 && status < 600 ? status / 100 : 0];
+            stats.bytes += length;
+        }
+        m_in.erase(0, length);
+        m_sent.pop_front();
+        if (!m_options.keepAlive && m_sent.empty())
+            disconnect();
+        return true;
+    }
+
+    // a whole response is buffered, length covers the header and the body
+    bool complete_response(size_t &length, int &status) const
+    {
+        size_t headerEnd = m_in.find("\r\n\r\n");
+        if (headerEnd == std::string::npos)
+            return false;
+        status = m_in.compare(0, 5, "HTTP/") == 0 && m_in.size() > 12 ? atoi(m_in.c_str() + 9) : 0;
+        size_t bodySize = 0;
+        for (size_t line = m_in.find("\r\n") + 2; line < headerEnd; line = m_in.find("\r\n", line) + 2)
+        {
+            if (strncasecmp(m_in.c_str() + line, "Content-Length:", 15) == 0) {
+                bodySize = strtoull(m_in.c_str() + line + 15, nullptr, 10);
+                break;
+            }
+        }
+        length = headerEnd + 4 + bodySize;
+        return m_in.size() >= length;
+    }
+
+private:
+    const Options &m_options;
+    const std::vector<std::string> &m_requests;
+    size_t m_next;
+    int m_fd;
+    std::string m_in;
+    std::deque<uint64_t> m_sent; // due times of the requests in flight
+};
+
+// the accept loop of main(), for a server that lives as long as the run
+class InProcessServer
+{
+public:
+    InProcessServer(const Options &options, std::error_code &ec)
+    : m_handler{std::filesystem::temp_directory_path().c_str(), tslogger::ERROR, std::clog, ec},
+      m_logger{m_handler.get_queue_ptr(), "shs-bench-server.log", tslogger::FLAGS_OUTPUT_TO_FILE_ONLY},
+      m_server{options.serveRoot, options.port, true, options.connections, false, ec},
+      m_port{options.port}
+    {
+        if (ec.value())
+            return;
+        m_server.options().cacheControl = "no-cache";
+        m_server.pin_workers(options.pinWorkers);
+        m_server.socket_options(socket_profile(options.profile, ec), ec);
+        if (!options.unixPath.empty() && !ec.value())
+            m_server.listen_unix(options.unixPath, 0600, ec);
+        if (ec.value())
+            return;
+        m_logThread = std::jthread([this](std::stop_token st){
+            AsyncLog::instance().run(m_logger, m_handler, st);
+        });
+        m_acceptThread = std::jthread([this]{
+            while (m_server.is_running())
+            {
+                Connection conn;
+                std::error_code ec;
+                m_server.accept(conn, ec);
+                if (ec.value())
+                    continue;
+                if (!m_server.is_running()) {
+                    ::close(conn.sockfd);
+                    break;
+                }
+                m_server.new_thread(std::move(conn));
+            }
+        });
+        m_removerThread = std::jthread([this](std::stop_token st){
+            while (!st.stop_requested())
+            {
+                std::error_code ec;
+                m_server.thread_remover(ec);
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        });
+    }
+
+    ~InProcessServer()
+    {
+        if (!m_acceptThread.joinable())
+            return;
+        m_server.stop();
+        // accept() waits in select(), a connection wakes it up
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(m_port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+        ::close(fd);
+        m_acceptThread.join();
+        m_removerThread.request_stop();
+        m_removerThread.join();
+        m_logThread.request_stop();
+        m_logThread.join();
+    }
+
+private:
+    tslogger::Handler m_handler;
+    tslogger::Logger m_logger;
+    HttpServer m_server;
+    int m_port;
+    std::jthread m_logThread;
+    std::jthread m_acceptThread;
+    std::jthread m_removerThread;
+};
+
+static void usage(const char *name)
+{
+    std::cerr << "Usage: " << name << " [options] <path> | @<url file>\n"
+              << "  --host <address>     server address, 127.0.0.1\n"
+              << "  --port <port>        8080\n"
+              << "  --unix <path>        connect to a Unix socket instead, @ for the abstract namespace\n"
+              << "  -c <connections>     16\n"
+              << "  -d <seconds>         measured time, 10\n"
+              << "  --warmup <seconds>   time before that, 1\n"
+              << "  --pipeline <depth>   requests in flight per connection, 1\n"
+              << "  --no-keepalive       a connection per request\n"
+              << "  --rate <rps>         open loop at that total rate, closed loop without it\n"
+              << "  -H <field: value>    header field added to every request\n"
+              << "  --serve <doc root>   run the server in this process on --port, and on --unix\n"
+              << "  --pin                the server of --serve pins its threads to NUMA nodes\n"
+              << "  --profile <name>     socket profile of the server of --serve, default\n"
+              << "  --json <file>        write the results as JSON\n"
+              << "  --min-rps <rps>      exit with 2 if the throughput is lower\n";
+}
+
+static bool parse_options(int argc, char *argv[], Options &options, const char *&urls)
+{
+    urls = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--host" && hasValue)
+            options.host = argv[++i];
+        else if (arg == "--port" && hasValue)
+            options.port = atoi(argv[++i]);
+        else if (arg == "--unix" && hasValue)
+            options.unixPath = argv[++i];
+        else if (arg == "-c" && hasValue)
+            options.connections = std::max(atoi(argv[++i]), 1);
+        else if (arg == "-d" && hasValue)
+            options.duration = atof(argv[++i]);
+        else if (arg == "--warmup" && hasValue)
+            options.warmup = atof(argv[++i]);
+        else if (arg == "--pipeline" && hasValue)
+            options.pipeline = std::max(atoi(argv[++i]), 1);
+        else if (arg == "--no-keepalive")
+            options.keepAlive = false;
+        else if (arg == "--rate" && hasValue)
+            options.rate = atof(argv[++i]);
+        else if (arg == "-H" && hasValue)
+            options.headers.push_back(argv[++i]);
+        else if (arg == "--serve" && hasValue)
+            options.serveRoot = argv[++i];
+        else if (arg == "--pin")
+            options.pinWorkers = true;
+        else if (arg == "--profile" && hasValue)
+            options.profile = argv[++i];
+        else if (arg == "--json" && hasValue)
+            options.jsonPath = argv[++i];
+        else if (arg == "--min-rps" && hasValue)
+            options.minRps = atof(argv[++i]);
+        else if (arg[0] != '-' && urls == nullptr)
+            urls = argv[i];
+        else
+            return false;
+    }
+    // without keep-alive the server would answer pipelined requests on a closed connection
+    if (!options.keepAlive)
+        options.pipeline = 1;
+    return urls != nullptr && options.duration > 0 && options.unixPath.size() < sizeof(sockaddr_un::sun_path);
+}
+
+// TCP_INFO the in-process server took of its connections, see observe_tcp_info()
+struct ServerTcpStats
+{
+    bool valid = false;
+    double segmentsPerResponse = 0;
+    uint64_t retransmits = 0;
+    uint64_t fastOpen = 0;
+};
+
+// the connections of the clients are closed, the server records them as its threads notice
+static ServerTcpStats server_tcp_stats()
+{
+    ServerTcpStats tcp;
+    uint64_t deadline = now_ns() + 2000000000;
+    while (metric_total(METRIC_CONNECTIONS_CLOSED) < metric_total(METRIC_CONNECTIONS_OPENED) && now_ns() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_POLL_MS));
+    uint64_t requests = metric_total(METRIC_REQUESTS);
+    tcp.valid = requests > 0;
+    tcp.segmentsPerResponse = requests ? double(metric_total(METRIC_TCP_SEGMENTS_SENT)) / requests : 0;
+    tcp.retransmits = metric_total(METRIC_TCP_RETRANSMITS);
+    tcp.fastOpen = metric_total(METRIC_TCP_FASTOPEN);
+    return tcp;
+}
+
+static void report(const Options &options, const Stats &stats, double seconds, const ServerTcpStats &tcp)
+{
+    uint64_t responses = stats.latency.count();
+    double rps = responses / seconds;
+    printf("%u %s connections, pipeline %u, %s, %s\n", options.connections,
+           options.unixPath.empty() ? "TCP" : "Unix socket", options.pipeline,
+           options.keepAlive ? "keep-alive" : "no keep-alive",
+           options.rate > 0 ? ("open loop at " + std::to_string(static_cast<long>(options.rate)) + " rps").c_str() : "closed loop");
+    printf("  requests     %lu in %.1f s, %.1f rps, %.1f MB/s\n", (unsigned long)responses, seconds, rps,
+           stats.bytes / seconds / 1e6);
+    printf("  status       2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu, other %lu\n",
+           (unsigned long)stats.responses[2], (unsigned long)stats.responses[3], (unsigned long)stats.responses[4],
+           (unsigned long)stats.responses[5], (unsigned long)(stats.responses[0] + stats.responses[1]));
+    printf("  errors       %lu\n", (unsigned long)stats.errors);
+    if (options.rate > 0)
+        printf("  late sends   %lu\n", (unsigned long)stats.late);
+    printf("  latency us   mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+           stats.latency.mean() / 1e3, stats.latency.percentile(0.5) / 1e3, stats.latency.percentile(0.9) / 1e3,
+           stats.latency.percentile(0.99) / 1e3, stats.latency.percentile(0.999) / 1e3, stats.latency.max() / 1e3);
+    if (tcp.valid) {
+        printf("  server TCP   profile %s, %.2f segments per response, %lu retransmits, %lu fast opens\n",
+               options.profile.c_str(), tcp.segmentsPerResponse, (unsigned long)tcp.retransmits,
+               (unsigned long)tcp.fastOpen);
+    }
+
+    if (options.jsonPath == nullptr)
+        return;
+    FILE *out = fopen(options.jsonPath, "w");
+    if (out == nullptr) {
+        std::cerr << options.jsonPath << ": " << strerror(errno) << "\n";
+        return;
+    }
+    fprintf(out, "{\"transport\":\"%s\",\"connections\":%u,\"pipeline\":%u,\"keep_alive\":%s,\"pin_workers\":%s,\"rate\":%.0f,\"duration\":%.3f,"
+                 "\"requests\":%lu,\"requests_per_second\":%.1f,\"bytes_per_second\":%.0f,\"errors\":%lu,\"late\":%lu,"
+                 "\"status\":{\"2xx\":%lu,\"3xx\":%lu,\"4xx\":%lu,\"5xx\":%lu},"
+                 "\"latency_ns\":{\"mean\":%.0f,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p99.9\":%lu,\"max\":%lu}",
+            options.unixPath.empty() ? "tcp" : "unix", options.connections, options.pipeline,
+            options.keepAlive ? "true" : "false",
+            options.pinWorkers ? "true" : "false", options.rate, seconds,
+            (unsigned long)responses, rps, stats.bytes / seconds, (unsigned long)stats.errors, (unsigned long)stats.late,
+            (unsigned long)stats.responses[2], (unsigned long)stats.responses[3], (unsigned long)stats.responses[4],
+            (unsigned long)stats.responses[5], stats.latency.mean(), (unsigned long)stats.latency.percentile(0.5),
+            (unsigned long)stats.latency.percentile(0.9), (unsigned long)stats.latency.percentile(0.99),
+            (unsigned long)stats.latency.percentile(0.999), (unsigned long)stats.latency.max());
+    if (tcp.valid) {
+        fprintf(out, ",\"server_tcp\":{\"profile\":\"%s\",\"segments_per_response\":%.3f,\"retransmits\":%lu,"
+                     "\"fast_opens\":%lu}",
+                options.profile.c_str(), tcp.segmentsPerResponse, (unsigned long)tcp.retransmits,
+                (unsigned long)tcp.fastOpen);
+    }
+    fprintf(out, "}\n");
+    fclose(out);
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    const char *urls;
+    if (!parse_options(argc, argv, options, urls)) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::vector<std::string> paths;
+    if (!read_urls(urls, paths))
+        return 1;
+    std::vector<std::string> requests;
+    for (const std::string &path : paths)
+        requests.push_back(make_request(options, path));
+
+    std::error_code ec;
+    std::unique_ptr<InProcessServer> server;
+    if (options.serveRoot != nullptr) {
+        server = std::make_unique<InProcessServer>(options, ec);
+        if (ec.value()) {
+            std::cerr << options.serveRoot << ": " << ec.message() << "\n";
+            return 1;
+        }
+    }
+
+    uint64_t start = now_ns() + 10000000; // all threads are running by then
+    uint64_t measureFrom = start + static_cast<uint64_t>(options.warmup * 1e9);
+    uint64_t end = measureFrom + static_cast<uint64_t>(options.duration * 1e9);
+    std::vector<Stats> stats(options.connections);
+    {
+        std::vector<std::jthread> threads;
+        for (unsigned i = 0; i < options.connections; ++i)
+        {
+            threads.emplace_back([&, i]{
+                Client client(options, requests, i);
+                sleep_until(start);
+                client.run(start, measureFrom, end, i, stats[i]);
+            });
+        }
+    }
+
+    Stats total;
+    for (const Stats &s : stats)
+        total.merge(s);
+    // a Unix socket has no TCP_INFO
+    bool tcp = server && options.unixPath.empty();
+    report(options, total, options.duration, tcp ? server_tcp_stats() : ServerTcpStats());
+    server.reset();
+    return options.minRps > 0 && total.latency.count() / options.duration < options.minRps ? 2 : 0;
+}
@@ -12,8 +12,19 @@ if [[ $1 = "clean" ]] ; then
     exit 0
 fi
 
-# build.sh all
+# build.sh [Debug|Release|ReleaseLTO] [pgo], Release by default,
+# pgo leaves the profile-guided server in build/pgo
+
+BUILD_TYPE=${1:-Release}
+if [[ $BUILD_TYPE = "all" ]] ; then
+    BUILD_TYPE=Release
+fi
+
 mkdir -p build
 cd build
-cmake ..
-make 
+cmake -DCMAKE_BUILD_TYPE=$BUILD_TYPE ..
+make
+
+if [[ $2 = "pgo" ]] ; then
+    make pgo
+fi
@@ -0,0 +1,293 @@
+#include "access_log.hpp"
+#include "http_error.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+namespace http
+{
+
+// Workers are linked into a list the writer walks for aged batches.
+// theWorkersMutex comes before the mutex of a worker, and that before the
+// mutex of a log; stop() clears theAccessLog under it, so an exiting thread
+// never hands its batch to a log that is gone.
+struct AccessLogWorker;
+static std::mutex theWorkersMutex;
+static AccessLogWorker *theWorkers = nullptr;
+static std::atomic<AccessLog *> theAccessLog{nullptr};
+
+// The batch a worker thread is filling, handed over when it is full or aged,
+// or when the thread exits
+struct AccessLogWorker
+{
+    std::mutex mutex;
+    AccessLog *log = nullptr;
+    std::unique_ptr<AccessLog::Batch> batch;
+    AccessLogWorker *prev = nullptr;
+    AccessLogWorker *next = nullptr;
+
+    AccessLogWorker()
+    {
+        std::lock_guard lg(theWorkersMutex);
+        next = theWorkers;
+        if (next != nullptr)
+            next->prev = this;
+        theWorkers = this;
+    }
+
+    ~AccessLogWorker()
+    {
+        std::lock_guard lg(theWorkersMutex);
+        if (prev != nullptr)
+            prev->next = next;
+        else
+            theWorkers = next;
+        if (next != nullptr)
+            next->prev = prev;
+        if (log != nullptr && log == theAccessLog && batch && batch->size > 0)
+            log->submit(std::move(batch));
+    }
+};
+
+static thread_local AccessLogWorker worker;
+
+AccessLog::AccessLog(const std::filesystem::path &dir, size_t segmentSize, time_t segmentSeconds)
+: m_dir{dir},
+  m_segmentSize{segmentSize},
+  m_segmentSeconds{segmentSeconds},
+  m_fd{-1},
+  m_segmentBytes{0},
+  m_segmentStart{0},
+  m_segmentSeq{0},
+  m_mutex{},
+  m_cv{},
+  m_queue{},
+  m_free{},
+  m_dropped{0},
+  m_writer{}
+{}
+
+AccessLog::~AccessLog()
+{
+    stop();
+}
+
+void AccessLog::start(std::error_code &ec)
+{
+    if (!std::filesystem::is_directory(m_dir)) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_NOT_DIRECTORY);
+        return;
+    }
+    if (!open_segment()) {
+        ec = make_system_error(errno);
+        return;
+    }
+    theAccessLog = this;
+    m_writer = std::jthread([this](std::stop_token st){ writer(st); });
+}
+
+void AccessLog::stop()
+{
+    {
+        std::lock_guard lg(theWorkersMutex);
+        if (theAccessLog == this)
+            collect(UINT64_MAX);
+        theAccessLog = nullptr;
+    }
+    if (m_writer.joinable()) {
+        m_writer.request_stop();
+        m_writer.join();
+    }
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void AccessLog::append(const AccessRecord &record, std::string_view uri)
+{
+    if (uri.size() > ACCESS_LOG_MAX_URI)
+        uri = uri.substr(0, ACCESS_LOG_MAX_URI);
+    size_t size = (sizeof(AccessRecord) + uri.size() + ACCESS_RECORD_ALIGNMENT - 1) & ~size_t(ACCESS_RECORD_ALIGNMENT - 1);
+
+    AccessLogWorker &w = worker;
+    std::lock_guard lg(w.mutex);
+    if (w.log != this) {
+        w.log = this;
+        w.batch.reset();
+    }
+    if (w.batch && w.batch->size > 0
+        && (w.batch->size + size > ACCESS_LOG_BATCH_SIZE
+            || record.timestamp - w.batch->first > uint64_t(ACCESS_LOG_FLUSH_MS) * 1000000))
+        w.batch = submit(std::move(w.batch));
+    if (!w.batch)
+        w.batch = std::make_unique<Batch>();
+
+    Batch &b = *w.batch;
+    if (b.size == 0)
+        b.first = record.timestamp;
+    char *out = b.data + b.size;
+    memcpy(out, &record, sizeof(AccessRecord));
+    reinterpret_cast<AccessRecord *>(out)->uriSize = uri.size();
+    memcpy(out + sizeof(AccessRecord), uri.data(), uri.size());
+    memset(out + sizeof(AccessRecord) + uri.size(), 0, size - sizeof(AccessRecord) - uri.size());
+    b.size += size;
+    ++b.records;
+}
+
+// takes a full batch, gives back an empty one if there is a spare
+std::unique_ptr<AccessLog::Batch> AccessLog::submit(std::unique_ptr<Batch> batch)
+{
+    std::unique_ptr<Batch> spare;
+    {
+        std::lock_guard lg(m_mutex);
+        if (theAccessLog != this || m_queue.size() >= ACCESS_LOG_MAX_QUEUED) {
+            m_dropped += batch->records;
+            spare = std::move(batch);
+        }
+        else {
+            m_queue.push_back(std::move(batch));
+            if (!m_free.empty()) {
+                spare = std::move(m_free.back());
+                m_free.pop_back();
+            }
+        }
+    }
+    m_cv.notify_one();
+    if (spare) {
+        spare->size = 0;
+        spare->records = 0;
+    }
+    return spare;
+}
+
+// hands the batches of the workers with a record before cutoff to the writer,
+// theWorkersMutex is held
+void AccessLog::collect(uint64_t cutoff)
+{
+    for (AccessLogWorker *w = theWorkers; w != nullptr; w = w->next)
+    {
+        std::lock_guard lg(w->mutex);
+        if (w->log == this && w->batch && w->batch->size > 0 && w->batch->first < cutoff)
+            w->batch = submit(std::move(w->batch));
+    }
+}
+
+bool AccessLog::open_segment()
+{
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_segmentStart = ::time(nullptr);
+    struct tm tm;
+    char name[64];
+    size_t len = strftime(name, sizeof(name), "access-%Y%m%d-%H%M%S", gmtime_r(&m_segmentStart, &tm));
+    snprintf(name + len, sizeof(name) - len, "-%u.log", m_segmentSeq++);
+    std::filesystem::path path = m_dir / name;
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd == -1)
+        return false;
+
+    AccessLogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic));
+    header.version = ACCESS_LOG_VERSION;
+    header.recordSize = sizeof(AccessRecord);
+    ssize_t written = ::write(m_fd, &header, sizeof(header));
+    if (written != sizeof(header)) {
+        // shs-access-log can't read a segment without its header, it goes
+        int error = written == -1 ? errno : ENOSPC;
+        ::close(m_fd);
+        m_fd = -1;
+        ::unlink(path.c_str());
+        errno = error;
+        return false;
+    }
+    m_segmentBytes = sizeof(header);
+    return true;
+}
+
+void AccessLog::writer(std::stop_token st)
+{
+    std::vector<std::unique_ptr<Batch>> batches;
+    struct iovec iov[ACCESS_LOG_MAX_QUEUED];
+
+    while (true)
+    {
+        bool stopping = st.stop_requested();
+        // records of a thread waiting on an idle connection are not left behind
+        if (!stopping) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            uint64_t now = uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+            std::lock_guard lg(theWorkersMutex);
+            collect(now - uint64_t(ACCESS_LOG_FLUSH_MS) * 1000000);
+        }
+        {
+            std::unique_lock ul(m_mutex);
+            if (!stopping)
+                m_cv.wait_for(ul, st, std::chrono::milliseconds(ACCESS_LOG_FLUSH_MS), [this]{ return !m_queue.empty(); });
+            batches.swap(m_queue);
+        }
+
+        if (!batches.empty()) {
+            // a segment that failed to open or to be written is retried with every batch
+            if (m_fd == -1 || m_segmentBytes >= m_segmentSize || ::time(nullptr) - m_segmentStart >= m_segmentSeconds)
+                open_segment();
+
+            // the whole queue goes to the disk with one system call
+            size_t count = 0;
+            for (const std::unique_ptr<Batch> &b : batches)
+            {
+                iov[count].iov_base = b->data;
+                iov[count].iov_len = b->size;
+                ++count;
+            }
+            struct iovec *vec = iov;
+            while (m_fd != -1 && count > 0)
+            {
+                ssize_t written = ::writev(m_fd, vec, count);
+                if (written == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    ::close(m_fd);
+                    m_fd = -1;
+                    break;
+                }
+                m_segmentBytes += written;
+                while (count > 0 && size_t(written) >= vec->iov_len)
+                {
+                    written -= vec->iov_len;
+                    ++vec;
+                    --count;
+                }
+                if (count > 0) {
+                    vec->iov_base = static_cast<char *>(vec->iov_base) + written;
+                    vec->iov_len -= written;
+                }
+            }
+            // the disk is full or gone, the records not written are counted as dropped
+            for (size_t i = vec - iov; i < batches.size(); ++i)
+                m_dropped += batches[i]->records;
+
+            std::lock_guard lg(m_mutex);
+            for (std::unique_ptr<Batch> &b : batches)
+            {
+                b->size = 0;
+                b->records = 0;
+                m_free.push_back(std::move(b));
+            }
+            batches.clear();
+        }
+        if (stopping)
+            break;
+    }
+}
+
+}// namespace http
@@ -0,0 +1,144 @@
+#include "admission.hpp"
+#include <cmath>
+#include <ctime>
+
+namespace http
+{
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+AdmissionControl::AdmissionControl()
+: m_mutex{},
+  m_pending{},
+  m_active{0},
+  m_maxActive{1},
+  m_maxPending{ADMISSION_PENDING_PER_SLOT},
+  m_firstAbove{0},
+  m_dropNext{0},
+  m_dropCount{0},
+  m_dropping{false},
+  m_delaySum{0},
+  m_delayCount{0}
+{}
+
+void AdmissionControl::limits(unsigned maxActive, unsigned maxPending)
+{
+    std::lock_guard lg(m_mutex);
+    m_maxActive = maxActive ? maxActive : 1;
+    m_maxPending = maxPending;
+}
+
+AdmissionDecision AdmissionControl::admit(const Connection &conn)
+{
+    std::lock_guard lg(m_mutex);
+    if (m_active < m_maxActive) {
+        ++m_active;
+        return ADMISSION_RUN;
+    }
+    if (m_pending.size() >= m_maxPending)
+        return ADMISSION_REJECT;
+    m_pending.push_back({conn, monotonic_ns()});
+    return ADMISSION_QUEUED;
+}
+
+AdmissionNext AdmissionControl::next(Connection &conn)
+{
+    std::lock_guard lg(m_mutex);
+    if (m_pending.empty()) {
+        --m_active;
+        // an empty queue ends a shedding period
+        m_firstAbove = 0;
+        m_dropping = false;
+        return ADMISSION_NONE;
+    }
+    uint64_t now = monotonic_ns();
+    conn = m_pending.front().conn;
+    uint64_t sojourn = now - m_pending.front().queued;
+    m_pending.pop_front();
+    m_delaySum += sojourn;
+    ++m_delayCount;
+    return shed(sojourn, now) ? ADMISSION_SHED : ADMISSION_SERVE;
+}
+
+bool AdmissionControl::waiting() const
+{
+    std::lock_guard lg(m_mutex);
+    return !m_pending.empty();
+}
+
+unsigned AdmissionControl::active() const
+{
+    std::lock_guard lg(m_mutex);
+    return m_active;
+}
+
+unsigned AdmissionControl::limit() const
+{
+    std::lock_guard lg(m_mutex);
+    return m_maxActive;
+}
+
+bool AdmissionControl::promote(Connection &conn)
+{
+    std::lock_guard lg(m_mutex);
+    if (m_pending.empty() || m_active >= m_maxActive)
+        return false;
+    conn = m_pending.front().conn;
+    m_delaySum += monotonic_ns() - m_pending.front().queued;
+    ++m_delayCount;
+    m_pending.pop_front();
+    ++m_active;
+    return true;
+}
+
+uint64_t AdmissionControl::queue_delay()
+{
+    std::lock_guard lg(m_mutex);
+    // connections still waiting count with their wait so far, a stuck queue has no leavers
+    uint64_t now = monotonic_ns();
+    uint64_t sum = m_delaySum;
+    unsigned count = m_delayCount;
+    for (const Pending &pending : m_pending)
+    {
+        sum += now - pending.queued;
+        ++count;
+    }
+    m_delaySum = 0;
+    m_delayCount = 0;
+    return count ? sum / count : 0;
+}
+
+bool AdmissionControl::shed(uint64_t sojourn, uint64_t now)
+{
+    const uint64_t target = uint64_t(ADMISSION_TARGET_MS) * 1000000;
+    const uint64_t interval = uint64_t(ADMISSION_INTERVAL_MS) * 1000000;
+    if (sojourn < target) {
+        m_firstAbove = 0;
+        m_dropping = false;
+        return false;
+    }
+    if (!m_dropping) {
+        if (m_firstAbove == 0) {
+            m_firstAbove = now + interval;
+            return false;
+        }
+        if (now < m_firstAbove)
+            return false;
+        m_dropping = true;
+        m_dropCount = 1;
+        m_dropNext = now + interval;
+        return true;
+    }
+    if (now < m_dropNext)
+        return false;
+    ++m_dropCount;
+    m_dropNext = now + static_cast<uint64_t>(interval / std::sqrt(double(m_dropCount)));
+    return true;
+}
+
+}// namespace http
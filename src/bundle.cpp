@@ -0,0 +1,168 @@
+#include "bundle.hpp"
+#include "http_error.hpp"
+#include "mime.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace http
+{
+
+static bool in_range(uint64_t offset, uint64_t size, uint64_t limit)
+{
+    return offset <= limit && size <= limit - offset;
+}
+
+Bundle::Bundle()
+: m_fd{-1},
+  m_data{nullptr},
+  m_size{0},
+  m_header{nullptr},
+  m_records{nullptr},
+  m_table{nullptr},
+  m_strings{nullptr}
+{}
+
+Bundle::~Bundle()
+{
+    if (m_data != nullptr)
+        ::munmap(const_cast<char *>(m_data), m_size);
+    if (m_fd != -1)
+        ::close(m_fd);
+}
+
+void Bundle::open(const std::filesystem::path &path, std::error_code &ec)
+{
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd == -1) {
+        ec = make_system_error(errno);
+        return;
+    }
+    struct stat st;
+    if (::fstat(m_fd, &st) == -1) {
+        ec = make_system_error(errno);
+        return;
+    }
+    if (static_cast<size_t>(st.st_size) < sizeof(BundleHeader)) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_INVALID_BUNDLE);
+        return;
+    }
+    void *data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        ec = make_system_error(errno);
+        return;
+    }
+    m_data = static_cast<const char *>(data);
+    m_size = st.st_size;
+
+    m_header = reinterpret_cast<const BundleHeader *>(m_data);
+    if (!validate()) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_INVALID_BUNDLE);
+        return;
+    }
+    m_records = reinterpret_cast<const BundleRecord *>(m_data + m_header->recordsOffset);
+    m_table = reinterpret_cast<const uint32_t *>(m_data + m_header->tableOffset);
+    m_strings = m_data + m_header->stringsOffset;
+}
+
+// everything is checked once here, so lookups can trust the offsets
+bool Bundle::validate() const
+{
+    const BundleHeader &h = *m_header;
+    if (memcmp(h.magic, BUNDLE_MAGIC, sizeof(h.magic)) != 0
+        || h.version != BUNDLE_VERSION
+        || h.size != m_size
+        || h.slots == 0 || (h.slots & (h.slots - 1)) != 0 || h.slots < h.count
+        || h.recordsOffset % alignof(BundleRecord) != 0
+        || h.tableOffset % alignof(uint32_t) != 0
+        || !in_range(h.recordsOffset, uint64_t(h.count) * sizeof(BundleRecord), m_size)
+        || !in_range(h.tableOffset, uint64_t(h.slots) * sizeof(uint32_t), m_size)
+        || h.stringsOffset > m_size)
+        return false;
+
+    const BundleRecord *records = reinterpret_cast<const BundleRecord *>(m_data + h.recordsOffset);
+    const uint32_t *table = reinterpret_cast<const uint32_t *>(m_data + h.tableOffset);
+    uint64_t stringsSize = m_size - h.stringsOffset;
+    for (uint32_t i = 0; i < h.count; ++i)
+    {
+        const BundleRecord &r = records[i];
+        if (!in_range(r.pathOffset, r.pathSize, stringsSize)
+            || !in_range(r.etagOffset, r.etagSize, stringsSize)
+            || !in_range(r.deflateEtagOffset, r.deflateEtagSize, stringsSize)
+            || !in_range(r.lastModifiedOffset, r.lastModifiedSize, stringsSize)
+            || !in_range(r.rawOffset, r.rawSize, m_size)
+            || !in_range(r.deflateOffset, r.deflateSize, m_size)
+            || r.type > UNKNOWN)
+            return false;
+    }
+    for (uint32_t i = 0; i < h.slots; ++i)
+    {
+        if (table[i] > h.count)
+            return false;
+    }
+    return true;
+}
+
+const BundleRecord *Bundle::find(std::string_view path) const
+{
+    uint64_t hash = bundle_hash(path);
+    uint32_t mask = m_header->slots - 1;
+    for (uint32_t i = hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, ++probes)
+    {
+        uint32_t index = m_table[i];
+        if (index == 0)
+            return nullptr;
+        const BundleRecord *r = &m_records[index - 1];
+        if (r->hash == hash && string(r->pathOffset, r->pathSize) == path)
+            return r;
+    }
+    return nullptr;
+}
+
+BundleSource::BundleSource(const std::filesystem::path &path)
+: m_path{path},
+  m_bundle{}
+{}
+
+void BundleSource::start(std::error_code &ec)
+{
+    reload(ec);
+}
+
+void BundleSource::lookup(const std::string &path, Asset &out, std::error_code &ec)
+{
+    std::shared_ptr<const Bundle> bundle = m_bundle.load();
+    const BundleRecord *r = bundle ? bundle->find(path) : nullptr;
+    if (r == nullptr) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_FILE_NOT_FOUND);
+        return;
+    }
+    out.data = bundle->data() + r->rawOffset;
+    out.size = r->rawSize;
+    out.fd = bundle->fd();
+    out.fileOffset = r->rawOffset;
+    out.mtime = r->mtime;
+    out.contentType = content_type2str(static_cast<ContentType>(r->type));
+    out.etag = bundle->string(r->etagOffset, r->etagSize);
+    out.deflatedEtag = bundle->string(r->deflateEtagOffset, r->deflateEtagSize);
+    out.lastModified = bundle->string(r->lastModifiedOffset, r->lastModifiedSize);
+    // the builder keeps the deflated body only when it is smaller, otherwise the file goes as is
+    out.deflatable = r->deflateSize != 0;
+    if (out.deflatable)
+        out.deflated = std::string_view(bundle->data() + r->deflateOffset, r->deflateSize);
+    out.holder = bundle;
+}
+
+void BundleSource::reload(std::error_code &ec)
+{
+    std::shared_ptr<Bundle> bundle = std::make_shared<Bundle>();
+    bundle->open(m_path, ec);
+    if (ec.value())
+        return;
+    m_bundle.store(bundle);
+}
+
+}// namespace http
@@ -0,0 +1,26 @@
+#include "embedded_assets.hpp"
+#include "http_error.hpp"
+
+namespace http
+{
+
+void EmbeddedSource::lookup(const std::string &path, Asset &out, std::error_code &ec)
+{
+    const EmbeddedAsset *asset = embedded_find(m_assets, path);
+    if (asset == nullptr) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_FILE_NOT_FOUND);
+        return;
+    }
+    out.data = asset->data;
+    out.size = asset->size;
+    out.mtime = asset->mtime;
+    out.contentType = content_type2str(asset->type);
+    out.etag = asset->etag;
+    out.deflatedEtag = asset->deflatedEtag;
+    out.lastModified = asset->lastModified;
+    out.deflatable = asset->deflated != nullptr;
+    if (out.deflatable)
+        out.deflated = std::string_view(asset->deflated, asset->deflatedSize);
+}
+
+}// namespace http
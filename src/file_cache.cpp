@@ -0,0 +1,423 @@
+#include "file_cache.hpp"
+#include "http_error.hpp"
+#include "utils.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+namespace http
+{
+
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE
+                                 | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+static std::string join_path(const std::string &dir, const char *name)
+{
+    if (dir.empty())
+        return name;
+    return dir + "/" + name;
+}
+
+FileCache::FileCache(const std::filesystem::path &root, size_t capacity)
+: m_root{root},
+  m_resolver{root},
+  m_capacity{capacity},
+  m_maxFiles{std::max<size_t>(FILE_CACHE_SHARDS, cached_descriptors_limit() / 2)},
+  m_cachedBytes{0},
+  m_generation{0},
+  m_shards{},
+  m_inotifyFd{-1},
+  m_watchMutex{},
+  m_watches{},
+  m_unwatched{},
+  m_watcher{},
+  m_flightMutex{},
+  m_flights{}
+{}
+
+FileCache::~FileCache()
+{
+    stop();
+}
+
+void FileCache::start(std::error_code &ec)
+{
+    m_resolver.start(ec);
+    if (ec.value())
+        return;
+    m_inotifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyFd == -1) {
+        ec = make_system_error(errno);
+        return;
+    }
+    watch_tree("");
+    m_watcher = std::jthread([this](std::stop_token st){ watcher(st); });
+}
+
+void FileCache::stop()
+{
+    if (m_watcher.joinable()) {
+        m_watcher.request_stop();
+        m_watcher.join();
+    }
+    if (m_inotifyFd != -1) {
+        ::close(m_inotifyFd);
+        m_inotifyFd = -1;
+    }
+    clear();
+    m_resolver.stop();
+}
+
+FileEntryPtr FileCache::get(const std::string &path, std::error_code &ec)
+{
+    Shard &s = shard(path);
+    {
+        std::lock_guard lg(s.mutex);
+        auto iter = s.entries.find(path);
+        if (iter != s.entries.end()) {
+            metric_add(METRIC_CACHE_HITS);
+            s.lru.splice(s.lru.begin(), s.lru, iter->second.lru);
+            return iter->second.entry;
+        }
+    }
+    metric_add(METRIC_CACHE_MISSES);
+    // the generation is taken before the file is opened, so a change
+    // reported while it is being loaded keeps the stale copy out of the cache
+    unsigned long generation = m_generation;
+    // nothing would tell about a change of a file in an unwatched directory
+    bool keep = watched(path);
+    FileEntryPtr entry = load(path, keep, ec);
+    if (ec.value())
+        return nullptr;
+
+    if (!keep || entry->size > FILE_CACHE_MAX_FILE_SIZE || entry->size > m_capacity / FILE_CACHE_SHARDS)
+        return entry;
+
+    std::lock_guard lg(s.mutex);
+    if (generation != m_generation)
+        return entry;
+    auto [iter, inserted] = s.entries.try_emplace(path, Slot{entry, {}, entry->size});
+    if (!inserted)
+        return iter->second.entry;
+    iter->second.lru = s.lru.insert(s.lru.begin(), &iter->first);
+    s.bytes += entry->size;
+    m_cachedBytes += entry->size;
+    evict(s);
+    return entry;
+}
+
+void FileCache::lookup(const std::string &path, Asset &out, std::error_code &ec)
+{
+    FileEntryPtr entry = get(path, ec);
+    if (ec.value())
+        return;
+    out.data = nullptr;
+    out.size = entry->size;
+    out.fd = entry->file->fd;
+    out.fileOffset = 0;
+    out.mtime = entry->mtime.tv_sec;
+    out.contentType = content_type2str(entry->type);
+    out.etag = entry->etag;
+    out.deflatedEtag = entry->deflatedEtag;
+    out.lastModified = entry->lastModified;
+    // deflated copies are kept for files up to the cacheable size only, bigger ones are sent as is
+    out.deflatable = entry->size <= FILE_CACHE_MAX_FILE_SIZE;
+    std::shared_ptr<const std::string> body = entry->deflated.load();
+    if (body) {
+        out.deflated = *body;
+        out.deflatedHolder = body;
+    }
+    out.holder = entry;
+}
+
+void FileCache::deflate(Asset &asset, std::error_code &ec)
+{
+    if (!asset.deflated.empty())
+        return;
+    std::shared_ptr<const std::string> body = deflate(*std::static_pointer_cast<const FileEntry>(asset.holder), ec);
+    if (ec.value())
+        return;
+    asset.deflated = *body;
+    asset.deflatedHolder = body;
+}
+
+// picks up a doc root that was swapped, e.g. by pointing its symlink to another release
+void FileCache::reload(std::error_code &ec)
+{
+    m_resolver.reload(ec);
+    if (ec.value())
+        return;
+    if (m_inotifyFd != -1) {
+        // the watches are on the directories of the old tree, their IN_IGNORED events find no watch
+        {
+            std::lock_guard lg(m_watchMutex);
+            for (const auto &[wd, dir] : m_watches)
+                ::inotify_rm_watch(m_inotifyFd, wd);
+            m_watches.clear();
+            m_unwatched.clear();
+        }
+        watch_tree("");
+    }
+    clear();
+}
+
+std::shared_ptr<const std::string> FileCache::deflate(const FileEntry &entry, std::error_code &ec)
+{
+    std::shared_ptr<const std::string> body = entry.deflated.load();
+    if (body)
+        return body;
+
+    std::string key = entry.path + '\0' + "deflate" + '\0' + entry.etag;
+    std::shared_ptr<Flight> flight;
+    bool leader;
+    {
+        std::lock_guard lg(m_flightMutex);
+        auto [iter, inserted] = m_flights.try_emplace(key);
+        if (inserted)
+            iter->second = std::make_shared<Flight>();
+        flight = iter->second;
+        leader = inserted;
+    }
+    if (!leader) {
+        TraceSpan span(TRACE_COMPRESS_WAIT);
+        std::unique_lock ul(flight->mutex);
+        flight->cv.wait(ul, [&flight]{ return flight->done; });
+        ec = flight->ec;
+        return flight->result;
+    }
+
+    std::string out;
+    uint64_t started = metric_now();
+    {
+        TraceSpan span(TRACE_COMPRESS);
+        // a file cut short under the read fails the request, the watcher drops the entry
+        std::string data(entry.size, '\0');
+        errno = 0;
+        if (!read_range(entry.file->fd, data.data(), data.size(), 0))
+            ec = errno ? make_system_error(errno) : make_error_code(HttpStatus::HTTP_ERR_INTERNAL_SERVER_ERROR);
+        else
+            compress_to_string(data.data(), data.size(), out, ec);
+    }
+    metric_observe(METRIC_COMPRESSION_TIME, metric_now() - started);
+    metric_add(METRIC_COMPRESSIONS);
+    if (!ec.value()) {
+        body = std::make_shared<const std::string>(std::move(out));
+        entry.deflated.store(body);
+        charge_deflated(entry, body->size());
+    }
+    {
+        std::lock_guard lg(flight->mutex);
+        flight->result = body;
+        flight->ec = ec;
+        flight->done = true;
+    }
+    flight->cv.notify_all();
+
+    std::lock_guard lg(m_flightMutex);
+    m_flights.erase(key);
+    return body;
+}
+
+FileEntryPtr FileCache::load(const std::string &path, bool keep, std::error_code &ec)
+{
+    OpenFilePtr file = m_resolver.open(path, keep, ec);
+    if (ec.value())
+        return nullptr;
+
+    const struct statx &stx = file->stx;
+    if (S_ISDIR(stx.stx_mode)) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_NOT_IMPLEMENTED);
+        return nullptr;
+    }
+    if (!S_ISREG(stx.stx_mode)) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_FORBIDDEN);
+        return nullptr;
+    }
+
+    std::shared_ptr<FileEntry> entry = std::make_shared<FileEntry>();
+    char etag[64];
+    int len = snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx",
+        (unsigned long)stx.stx_ino,
+        (unsigned long)stx.stx_size,
+        (unsigned long)(stx.stx_mtime.tv_sec * 1000000000L + stx.stx_mtime.tv_nsec));
+
+    entry->path = path;
+    entry->file = file;
+    entry->size = stx.stx_size;
+    entry->mtime.tv_sec = stx.stx_mtime.tv_sec;
+    entry->mtime.tv_nsec = stx.stx_mtime.tv_nsec;
+    entry->inode = stx.stx_ino;
+    entry->type = file_extention2content_type(std::filesystem::path(path).extension().string().c_str());
+    entry->etag.assign(etag, len).append("\"");
+    entry->deflatedEtag.assign(etag, len).append("-z\"");
+    struct tm tm;
+    time_t mtime = entry->mtime.tv_sec;
+    strftime(entry->lastModified, sizeof(entry->lastModified), HTTP_DATE_FORMAT, gmtime_r(&mtime, &tm));
+    return entry;
+}
+
+void FileCache::erase(Shard &s, std::unordered_map<std::string, Slot>::iterator iter)
+{
+    s.bytes -= iter->second.bytes;
+    m_cachedBytes -= iter->second.bytes;
+    s.lru.erase(iter->second.lru);
+    s.entries.erase(iter);
+}
+
+void FileCache::evict(Shard &s)
+{
+    while (s.bytes > m_capacity / FILE_CACHE_SHARDS || s.entries.size() > m_maxFiles / FILE_CACHE_SHARDS)
+        erase(s, s.entries.find(*s.lru.back()));
+}
+
+void FileCache::charge_deflated(const FileEntry &entry, size_t bytes)
+{
+    Shard &s = shard(entry.path);
+    std::lock_guard lg(s.mutex);
+    // an entry dropped meanwhile frees its copy with its last user
+    auto iter = s.entries.find(entry.path);
+    if (iter == s.entries.end() || iter->second.entry.get() != &entry)
+        return;
+    iter->second.bytes += bytes;
+    s.bytes += bytes;
+    m_cachedBytes += bytes;
+    evict(s);
+}
+
+void FileCache::invalidate_file(const std::string &path)
+{
+    ++m_generation;
+    m_resolver.invalidate(path, false);
+    Shard &s = shard(path);
+    std::lock_guard lg(s.mutex);
+    auto iter = s.entries.find(path);
+    if (iter != s.entries.end())
+        erase(s, iter);
+}
+
+void FileCache::invalidate(const std::string &path)
+{
+    ++m_generation;
+    m_resolver.invalidate(path, true);
+    std::string prefix = path + "/";
+    for (Shard &s : m_shards)
+    {
+        std::lock_guard lg(s.mutex);
+        for (auto iter = s.entries.begin(); iter != s.entries.end();)
+        {
+            auto next = std::next(iter);
+            if (path.empty() || iter->first == path || iter->first.starts_with(prefix))
+                erase(s, iter);
+            iter = next;
+        }
+    }
+}
+
+void FileCache::clear()
+{
+    invalidate("");
+}
+
+// whether inotify reports the changes of the files in the directory of path
+bool FileCache::watched(const std::string &path)
+{
+    std::lock_guard lg(m_watchMutex);
+    if (m_unwatched.empty())
+        return true;
+    size_t slash = path.rfind('/');
+    return !m_unwatched.contains(slash == std::string::npos ? std::string() : path.substr(0, slash));
+}
+
+void FileCache::add_watch(const std::string &dir)
+{
+    std::filesystem::path dirPath = dir.empty() ? m_root : m_root / dir;
+    int wd = ::inotify_add_watch(m_inotifyFd, dirPath.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if (wd == -1) {
+        // ENOSPC once fs.inotify.max_user_watches are used up
+        LOG_W("Files of %s are not cached, inotify_add_watch: %s\n", dirPath.c_str(), strerror(errno));
+        std::lock_guard lg(m_watchMutex);
+        m_unwatched.insert(dir);
+        return;
+    }
+    std::lock_guard lg(m_watchMutex);
+    m_watches[wd] = dir;
+    m_unwatched.erase(dir);
+}
+
+void FileCache::watch_tree(const std::string &dir)
+{
+    add_watch(dir);
+    std::error_code ec;
+    std::filesystem::path dirPath = dir.empty() ? m_root : m_root / dir;
+    for (auto iter = std::filesystem::recursive_directory_iterator(dirPath, ec);
+        !ec && iter != std::filesystem::recursive_directory_iterator(); iter.increment(ec))
+    {
+        if (iter->is_directory(ec))
+            add_watch(std::filesystem::relative(iter->path(), m_root, ec).string());
+    }
+}
+
+void FileCache::watcher(std::stop_token st)
+{
+    alignas(struct inotify_event) char events[16384];
+    struct pollfd pfd = { m_inotifyFd, POLLIN, 0 };
+
+    while (!st.stop_requested())
+    {
+        int status = ::poll(&pfd, 1, 1000);
+        if (status <= 0)
+            continue;
+
+        ssize_t len;
+        while ((len = ::read(m_inotifyFd, events, sizeof(events))) > 0)
+        {
+            for (char *ptr = events; ptr < events + len;)
+            {
+                const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+                ptr += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    clear();
+                    continue;
+                }
+                std::string dir;
+                {
+                    std::lock_guard lg(m_watchMutex);
+                    auto iter = m_watches.find(event->wd);
+                    if (iter == m_watches.end())
+                        continue;
+                    dir = iter->second;
+                    if (event->mask & IN_IGNORED) {
+                        m_watches.erase(iter);
+                        continue;
+                    }
+                }
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    invalidate(dir);
+                    continue;
+                }
+                if (event->len == 0)
+                    continue;
+
+                std::string path = join_path(dir, event->name);
+                if (!(event->mask & IN_ISDIR)) {
+                    invalidate_file(path);
+                    continue;
+                }
+                invalidate(path);
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    watch_tree(path);
+            }
+        }
+    }
+}
+
+}// namespace http
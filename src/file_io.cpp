@@ -0,0 +1,133 @@
+#include "file_io.hpp"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "metrics.hpp"
+
+namespace http
+{
+
+enum {
+    FILE_IO_PAGE = 4096,
+};
+
+bool FileRead::done() const
+{
+    std::lock_guard lg(m_mutex);
+    return m_done;
+}
+
+void FileRead::wait() const
+{
+    std::unique_lock ul(m_mutex);
+    m_cv.wait(ul, [this]{ return m_done; });
+}
+
+// Whether the first and the last page of a range are in the page cache, pages
+// in between are mostly there too as the kernel reads ahead. Where RWF_NOWAIT
+// is not supported every range counts as there, and is read as before.
+static bool resident(int fd, off_t offset, size_t length)
+{
+    char byte;
+    struct iovec iov = {&byte, 1};
+    off_t last = offset + off_t(length) - 1;
+    for (off_t at : {offset, last})
+    {
+        ssize_t n = ::preadv2(fd, &iov, 1, at, RWF_NOWAIT);
+        if (n == -1 && errno == EAGAIN)
+            return false;
+        if (last / FILE_IO_PAGE == offset / FILE_IO_PAGE)
+            break;
+    }
+    return true;
+}
+
+FileIo &FileIo::instance()
+{
+    static FileIo io;
+    return io;
+}
+
+FileIo::FileIo()
+: m_mutex{},
+  m_cv{},
+  m_queue{},
+  m_threads{}
+{
+    for (int i = 0; i < FILE_IO_THREADS; ++i)
+        m_threads.emplace_back([this](std::stop_token st){ worker(st); });
+}
+
+FileIo::~FileIo()
+{
+    for (std::jthread &thread : m_threads)
+        thread.request_stop();
+    m_threads.clear();
+}
+
+FileReadPtr FileIo::prefetch(int fd, off_t offset, size_t length, std::shared_ptr<const void> holder)
+{
+    if (length == 0 || resident(fd, offset, length))
+        return nullptr;
+
+    FileReadPtr read = std::make_shared<FileRead>();
+    read->m_fd = fd;
+    read->m_offset = offset;
+    read->m_length = length;
+    read->m_holder = std::move(holder);
+    read->m_queued = metric_now();
+    {
+        std::lock_guard lg(m_mutex);
+        if (m_queue.size() >= FILE_IO_QUEUE) {
+            metric_add(METRIC_FILE_READS_INLINE);
+            return nullptr;
+        }
+        // counted before a thread can take it, the queue depth never goes below zero
+        metric_add(METRIC_FILE_READS);
+        m_queue.push_back(read);
+    }
+    m_cv.notify_one();
+    return read;
+}
+
+void FileIo::worker(std::stop_token st)
+{
+    std::vector<char> scratch(FILE_IO_SCRATCH);
+    while (true)
+    {
+        FileReadPtr read;
+        {
+            std::unique_lock ul(m_mutex);
+            if (!m_cv.wait(ul, st, [this]{ return !m_queue.empty(); }))
+                return;
+            read = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        // the bytes are dropped, what counts is that the pages are in the page cache
+        // afterwards; errors are left to the caller, who reads the range again
+        off_t offset = read->m_offset;
+        size_t left = read->m_length;
+        while (left > 0)
+        {
+            ssize_t n = ::pread(read->m_fd, scratch.data(), std::min(left, scratch.size()), offset);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            offset += n;
+            left -= n;
+        }
+        metric_observe(METRIC_FILE_READ_TIME, metric_now() - read->m_queued);
+        metric_add(METRIC_FILE_READS_DONE);
+
+        {
+            std::lock_guard lg(read->m_mutex);
+            read->m_done = true;
+            read->m_holder.reset();
+        }
+        read->m_cv.notify_all();
+    }
+}
+
+}// namespace http
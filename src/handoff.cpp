@@ -0,0 +1,146 @@
+#include "handoff.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "http_error.hpp"
+
+namespace http
+{
+
+static const char HANDOFF_CONFIRM = 'R';
+
+static socklen_t handoff_address(int port, struct sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    // sun_path[0] stays 0, the name is in the abstract namespace and goes with the process
+    int len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "simple-http-server-%d", port);
+    return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + 1 + len);
+}
+
+static bool same_user(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == ::geteuid();
+}
+
+int handoff_receive(int port, std::vector<int> &listenFds, std::error_code &ec)
+{
+    listenFds.clear();
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        ec = make_system_error(errno);
+        return -1;
+    }
+    struct sockaddr_un addr;
+    socklen_t addrLen = handoff_address(port, addr);
+    if (::connect(fd, (struct sockaddr *)&addr, addrLen) == -1) {
+        // nobody offers a socket, the caller binds one
+        ::close(fd);
+        return -1;
+    }
+    if (!same_user(fd)) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_HANDOFF);
+        ::close(fd);
+        return -1;
+    }
+    // the old server answers within a poll period, it is not waited for forever
+    struct timeval tv = {HANDOFF_RECEIVE_TIMEOUT_SECONDS, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char data;
+    struct iovec iov = {&data, 1};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(HANDOFF_MAX_SOCKETS * sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t received;
+    do {
+        received = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (received == -1 && errno == EINTR);
+
+    struct cmsghdr *cmsg = received == 1 ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_HANDOFF);
+        ::close(fd);
+        return -1;
+    }
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    listenFds.resize(count);
+    memcpy(listenFds.data(), CMSG_DATA(cmsg), count * sizeof(int));
+    if (count == 0) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_HANDOFF);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void handoff_confirm(int peer, std::error_code &ec)
+{
+    if (::send(peer, &HANDOFF_CONFIRM, 1, MSG_NOSIGNAL) != 1)
+        ec = make_system_error(errno);
+    ::close(peer);
+}
+
+int handoff_listen(int port, std::error_code &ec)
+{
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        ec = make_system_error(errno);
+        return -1;
+    }
+    struct sockaddr_un addr;
+    socklen_t addrLen = handoff_address(port, addr);
+    if (::bind(fd, (struct sockaddr *)&addr, addrLen) == -1 || ::listen(fd, 1) == -1) {
+        ec = make_system_error(errno);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void handoff_send(int peer, const std::vector<int> &listenFds, std::error_code &ec)
+{
+    if (!same_user(peer) || listenFds.empty() || listenFds.size() > HANDOFF_MAX_SOCKETS) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_HANDOFF);
+        return;
+    }
+    char data = 0;
+    struct iovec iov = {&data, 1};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(HANDOFF_MAX_SOCKETS * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(listenFds.size() * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(listenFds.size() * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), listenFds.data(), listenFds.size() * sizeof(int));
+    if (::sendmsg(peer, &msg, MSG_NOSIGNAL) != 1)
+        ec = make_system_error(errno);
+}
+
+bool handoff_confirmed(int peer, int timeoutMs)
+{
+    struct pollfd pfd = {peer, POLLIN, 0};
+    if (::poll(&pfd, 1, timeoutMs) != 1)
+        return false;
+    char data = 0;
+    return ::recv(peer, &data, 1, 0) == 1 && data == HANDOFF_CONFIRM;
+}
+
+}// namespace http
@@ -0,0 +1,487 @@
+#include "hpack.hpp"
+#include <algorithm>
+#include <cstring>
+#include "http_error.hpp"
+
+namespace http
+{
+
+// RFC 7541 appendix A
+static const struct
+{
+    const char *name;
+    const char *value;
+} STATIC_TABLE[HPACK_STATIC_ENTRIES] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// RFC 7541 appendix B, code and length in bits per symbol, EOS is left out
+static const struct
+{
+    uint32_t code;
+    uint8_t bits;
+} HUFFMAN_CODES[256] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+};
+
+void HpackTable::add(std::string_view name, std::string_view value)
+{
+    size_t size = name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+    if (size > m_maxSize) {
+        evict(0);
+        return;
+    }
+    evict(m_maxSize - size);
+    m_entries.emplace_front(name, value);
+    m_size += size;
+}
+
+void HpackTable::max_size(size_t value)
+{
+    m_maxSize = value;
+    evict(value);
+}
+
+void HpackTable::evict(size_t limit)
+{
+    while (m_size > limit)
+    {
+        const HeaderField &oldest = m_entries.back();
+        m_size -= oldest.first.size() + oldest.second.size() + HPACK_ENTRY_OVERHEAD;
+        m_entries.pop_back();
+    }
+}
+
+const HeaderField *HpackTable::get(size_t index) const
+{
+    // the static entries are copied once, so both kinds of entries are returned alike
+    static const std::vector<HeaderField> staticEntries = []{
+        std::vector<HeaderField> entries;
+        for (const auto &entry : STATIC_TABLE)
+            entries.emplace_back(entry.name, entry.value);
+        return entries;
+    }();
+    if (index == 0)
+        return nullptr;
+    if (index <= HPACK_STATIC_ENTRIES)
+        return &staticEntries[index - 1];
+    index -= HPACK_STATIC_ENTRIES + 1;
+    return index < m_entries.size() ? &m_entries[index] : nullptr;
+}
+
+size_t HpackTable::find(std::string_view name, std::string_view value, bool &nameOnly) const
+{
+    size_t byName = 0;
+    for (size_t i = 0; i < HPACK_STATIC_ENTRIES; ++i)
+    {
+        if (name != STATIC_TABLE[i].name)
+            continue;
+        if (value == STATIC_TABLE[i].value) {
+            nameOnly = false;
+            return i + 1;
+        }
+        if (byName == 0)
+            byName = i + 1;
+    }
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        if (name != m_entries[i].first)
+            continue;
+        if (value == m_entries[i].second) {
+            nameOnly = false;
+            return HPACK_STATIC_ENTRIES + 1 + i;
+        }
+        if (byName == 0)
+            byName = HPACK_STATIC_ENTRIES + 1 + i;
+    }
+    nameOnly = true;
+    return byName;
+}
+
+// an integer with an N bit prefix, RFC 7541 5.1
+static bool decode_integer(std::string_view in, size_t &pos, unsigned prefixBits, size_t &value)
+{
+    if (pos >= in.size())
+        return false;
+    size_t max = (1U << prefixBits) - 1;
+    value = static_cast<unsigned char>(in[pos++]) & max;
+    if (value < max)
+        return true;
+    for (unsigned shift = 0; shift < 28; shift += 7)
+    {
+        if (pos >= in.size())
+            return false;
+        unsigned char b = in[pos++];
+        value += size_t(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void encode_integer(size_t value, unsigned prefixBits, unsigned char pattern, std::string &out)
+{
+    size_t max = (1U << prefixBits) - 1;
+    if (value < max) {
+        out += static_cast<char>(pattern | value);
+        return;
+    }
+    out += static_cast<char>(pattern | max);
+    value -= max;
+    while (value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static bool decode_string(std::string_view in, size_t &pos, std::string &out)
+{
+    if (pos >= in.size())
+        return false;
+    bool huffman = in[pos] & 0x80;
+    size_t length;
+    if (!decode_integer(in, pos, 7, length) || length > in.size() - pos)
+        return false;
+    std::string_view data = in.substr(pos, length);
+    pos += length;
+    out.clear();
+    if (huffman)
+        return huffman_decode(data, out);
+    out.assign(data);
+    return true;
+}
+
+static void encode_string(std::string_view value, std::string &out)
+{
+    size_t length = huffman_length(value);
+    if (length < value.size()) {
+        encode_integer(length, 7, 0x80, out);
+        huffman_encode(value, out);
+    }
+    else {
+        encode_integer(value.size(), 7, 0, out);
+        out += value;
+    }
+}
+
+void HpackDecoder::decode(std::string_view block, std::vector<HeaderField> &fields, std::error_code &ec)
+{
+    size_t pos = 0;
+    size_t listSize = 0;
+    bool tooLarge = false;
+    std::string name, value;
+    while (pos < block.size())
+    {
+        unsigned char b = block[pos];
+        size_t index;
+        if (b & 0x80) {
+            // indexed field
+            const HeaderField *field = decode_integer(block, pos, 7, index) ? m_table.get(index) : nullptr;
+            if (field == nullptr) {
+                ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+                return;
+            }
+            name = field->first;
+            value = field->second;
+        }
+        else if ((b & 0xe0) == 0x20) {
+            // a table size update, only allowed in front of the fields and up to what SETTINGS allow
+            if (!fields.empty() || listSize != 0 || !decode_integer(block, pos, 5, index) || index > HPACK_TABLE_SIZE) {
+                ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+                return;
+            }
+            m_table.max_size(index);
+            continue;
+        }
+        else {
+            // a literal, with incremental indexing (01), without indexing (0000) or never indexed (0001)
+            bool indexing = b & 0x40;
+            if (!decode_integer(block, pos, indexing ? 6 : 4, index)) {
+                ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+                return;
+            }
+            if (index != 0) {
+                const HeaderField *field = m_table.get(index);
+                if (field == nullptr) {
+                    ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+                    return;
+                }
+                name = field->first;
+            }
+            else if (!decode_string(block, pos, name)) {
+                ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+                return;
+            }
+            if (!decode_string(block, pos, value)) {
+                ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+                return;
+            }
+            if (indexing)
+                m_table.add(name, value);
+        }
+        listSize += name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+        // the rest of the block is still decoded, the table has to stay in step with the peer
+        if (listSize > HPACK_MAX_HEADER_LIST)
+            tooLarge = true;
+        if (!tooLarge)
+            fields.emplace_back(std::move(name), std::move(value));
+    }
+    if (tooLarge)
+        ec = make_error_code(HttpStatus::HTTP_ERR_HEADER_FIELDS_TOO_LARGE);
+}
+
+void HpackEncoder::max_size(size_t value)
+{
+    value = std::min<size_t>(value, HPACK_TABLE_SIZE);
+    if (value != m_table.max_size()) {
+        m_table.max_size(value);
+        m_sizeUpdate = true;
+    }
+}
+
+void HpackEncoder::begin(std::string &out)
+{
+    if (m_sizeUpdate)
+        encode_integer(m_table.max_size(), 5, 0x20, out);
+    m_sizeUpdate = false;
+}
+
+// values that would only push the repeated ones out of the table
+static bool changing(std::string_view name)
+{
+    for (const char *field : {"content-length", "content-range", "etag", "last-modified", "date"})
+    {
+        if (name == field)
+            return true;
+    }
+    return false;
+}
+
+void HpackEncoder::encode(std::string_view name, std::string_view value, std::string &out)
+{
+    bool nameOnly;
+    size_t index = m_table.find(name, value, nameOnly);
+    if (index != 0 && !nameOnly) {
+        encode_integer(index, 7, 0x80, out);
+        return;
+    }
+    bool indexing = !changing(name);
+    encode_integer(index, indexing ? 6 : 4, indexing ? 0x40 : 0, out);
+    if (index == 0)
+        encode_string(name, out);
+    encode_string(value, out);
+    if (indexing)
+        m_table.add(name, value);
+}
+
+// The code as a binary tree, a node is either inner or holds a symbol
+struct HuffmanTree
+{
+    struct Node
+    {
+        int child[2];
+        int symbol;
+    };
+    std::vector<Node> nodes;
+
+    HuffmanTree()
+    : nodes(1, Node{{0, 0}, -1})
+    {
+        for (int symbol = 0; symbol < 256; ++symbol)
+        {
+            size_t node = 0;
+            for (int bit = HUFFMAN_CODES[symbol].bits - 1; bit >= 0; --bit)
+            {
+                int b = (HUFFMAN_CODES[symbol].code >> bit) & 1;
+                if (nodes[node].child[b] == 0) {
+                    nodes[node].child[b] = static_cast<int>(nodes.size());
+                    nodes.push_back(Node{{0, 0}, -1});
+                }
+                node = nodes[node].child[b];
+            }
+            nodes[node].symbol = symbol;
+        }
+    }
+};
+
+bool huffman_decode(std::string_view in, std::string &out)
+{
+    static const HuffmanTree tree;
+    size_t node = 0;
+    unsigned depth = 0;     // bits since the last symbol
+    bool ones = true;       // and all of them set, the only padding allowed
+    for (unsigned char c : in)
+    {
+        for (int bit = 7; bit >= 0; --bit)
+        {
+            int b = (c >> bit) & 1;
+            node = tree.nodes[node].child[b];
+            // EOS, the only code left out of the tree, is 30 ones
+            if (node == 0)
+                return false;
+            ++depth;
+            ones = ones && b;
+            if (tree.nodes[node].symbol != -1) {
+                out += static_cast<char>(tree.nodes[node].symbol);
+                node = 0;
+                depth = 0;
+                ones = true;
+            }
+        }
+    }
+    return depth < 8 && ones;
+}
+
+void huffman_encode(std::string_view in, std::string &out)
+{
+    uint64_t bits = 0;
+    unsigned count = 0;
+    for (unsigned char c : in)
+    {
+        bits = (bits << HUFFMAN_CODES[c].bits) | HUFFMAN_CODES[c].code;
+        count += HUFFMAN_CODES[c].bits;
+        while (count >= 8)
+        {
+            count -= 8;
+            out += static_cast<char>(bits >> count);
+        }
+    }
+    // padded with the most significant bits of EOS
+    if (count > 0)
+        out += static_cast<char>((bits << (8 - count)) | (0xff >> count));
+}
+
+size_t huffman_length(std::string_view in)
+{
+    size_t bits = 0;
+    for (unsigned char c : in)
+        bits += HUFFMAN_CODES[c].bits;
+    return (bits + 7) / 8;
+}
+
+}// namespace http
@@ -0,0 +1,781 @@
+#include "http2.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+namespace http
+{
+
+const char *H2_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+const char *H2_SWITCHING_PROTOCOLS = "HTTP/1.1 101 Switching Protocols\r\n"\
+"Connection: Upgrade\r\n"\
+"Upgrade: h2c\r\n"\
+"\r\n";
+
+static uint32_t read32(const char *p)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    return uint32_t(u[0]) << 24 | uint32_t(u[1]) << 16 | uint32_t(u[2]) << 8 | u[3];
+}
+
+static void append32(std::string &out, uint32_t value)
+{
+    char bytes[4] = {char(value >> 24), char(value >> 16), char(value >> 8), char(value)};
+    out.append(bytes, sizeof(bytes));
+}
+
+bool h2_preface_prefix(const char *data, size_t size)
+{
+    // "PRI " tells it from the HTTP/1 methods
+    return size >= 4 && memcmp(data, H2_PREFACE, std::min<size_t>(size, H2_PREFACE_SIZE)) == 0;
+}
+
+bool h2_settings_payload(std::string_view field, std::string &payload)
+{
+    uint32_t bits = 0;
+    unsigned count = 0;
+    payload.clear();
+    for (char c : field)
+    {
+        uint32_t value;
+        if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            value = c - '0' + 52;
+        else if (c == '-')
+            value = 62;
+        else if (c == '_')
+            value = 63;
+        else if (c == '=')
+            break; // padding, base64url leaves it out
+        else
+            return false;
+        bits = (bits << 6 | value) & 0xffff;
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            payload += char(bits >> count);
+        }
+    }
+    return payload.size() % 6 == 0;
+}
+
+// the fields of HTTP/1.1 that HTTP/2 does not have
+static bool connection_specific(std::string_view name)
+{
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection"
+        || name == "transfer-encoding" || name == "upgrade";
+}
+
+Http2Session::Http2Session(HttpServer &server, const Connection &conn)
+: m_server{server},
+  m_conn{conn},
+  m_decoder{},
+  m_encoder{},
+  m_streams{},
+  m_resetStreams{},
+  m_in{},
+  m_out{},
+  m_outSent{0},
+  m_preface{false},
+  m_lastStream{0},
+  m_nextStream{0},
+  m_headerStream{0},
+  m_headerEndStream{false},
+  m_headerNewStream{false},
+  m_headerBlock{},
+  m_window{H2_WINDOW},
+  m_initialWindow{H2_WINDOW},
+  m_receiveWindow{H2_WINDOW},
+  m_goAway{false},
+  m_peerGoAway{false},
+  m_failed{false},
+  m_reading{false}
+{
+    metric_add(METRIC_HTTP2_CONNECTIONS);
+    // the server preface, a stream holds a RequestHandler and its buffer
+    frame(H2_SETTINGS, 0, 0, 6);
+    m_out += char(0);
+    m_out += char(H2_SETTINGS_MAX_CONCURRENT_STREAMS);
+    append32(m_out, H2_MAX_STREAMS);
+}
+
+void Http2Session::run(std::string_view data, std::error_code &ec)
+{
+    LOG_I("<-- HTTP/2 with prior knowledge\n");
+    metric_add(METRIC_BYTES_RECEIVED, data.size());
+    m_in.assign(data);
+    serve(ec);
+}
+
+void Http2Session::run_upgrade(const RequestHandler &rh, std::string_view settings, std::string_view data, std::error_code &ec)
+{
+    LOG_I("<-- HTTP/2 by Upgrade\n");
+    // the 101 has acknowledged the settings, they apply to stream 1 already
+    if (apply_settings(settings)) {
+        m_lastStream = 1;
+        Stream stream{};
+        stream.rh = &rh;
+        stream.timestamp = m_server.access_timestamp();
+        stream.started = metric_now();
+        respond(1, std::move(stream));
+    }
+    m_in.assign(data);
+    serve(ec);
+}
+
+void Http2Session::serve(std::error_code &ec)
+{
+    bool idle = false;
+    while (true)
+    {
+        // a drain lets the open streams finish, a stop ends the connection right away
+        if (!m_server.is_running() && !m_server.is_draining())
+            return;
+        if (!m_failed)
+            process_frames();
+        // as serve() does with an idle HTTP/1 connection
+        if (!m_goAway && (m_server.is_draining()
+            || (idle && m_streams.empty() && m_server.admission().waiting())))
+            go_away(H2_NO_ERROR);
+        // after an Upgrade the bodies wait for the client preface, clients read
+        // what follows the 101 into the buffer of the HTTP/1 response
+        if (!m_failed && m_preface)
+            fill_output();
+        if (m_failed) {
+            // the GOAWAY is sent if it fits into the socket buffer
+            flush(ec);
+            return;
+        }
+        bool pending = m_outSent < m_out.size();
+        if (!pending && (m_goAway || m_peerGoAway) && m_streams.empty())
+            return;
+
+        struct pollfd pfd = {m_conn.sockfd, 0, 0};
+        if (pending)
+            pfd.events |= POLLOUT;
+        if (m_out.size() - m_outSent < H2_MAX_OUTPUT)
+            pfd.events |= POLLIN;
+        int ready = ::poll(&pfd, 1, m_reading ? int(FILE_IO_POLL_MS) : int(IDLE_POLL_MS));
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            ec = make_system_error(errno);
+            return;
+        }
+        idle = ready == 0;
+        if ((pfd.revents & (POLLERR | POLLNVAL)) || (pfd.revents & (POLLHUP | POLLIN)) == POLLHUP)
+            return;
+        if ((pfd.revents & POLLOUT) && !flush(ec))
+            return;
+        if ((pfd.revents & POLLIN) && !receive(ec))
+            return;
+    }
+}
+
+bool Http2Session::receive(std::error_code &ec)
+{
+    char chunk[H2_FRAME_HEADER_SIZE + H2_FRAME_SIZE];
+    ssize_t received = ::recv(m_conn.sockfd, chunk, sizeof(chunk), MSG_DONTWAIT);
+    if (received == -1) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            return true;
+        ec = make_system_error(errno);
+        return false;
+    }
+    if (received == 0)
+        return false;
+    metric_add(METRIC_BYTES_RECEIVED, received);
+    m_in.append(chunk, received);
+    return true;
+}
+
+bool Http2Session::flush(std::error_code &ec)
+{
+    while (m_outSent < m_out.size())
+    {
+        ssize_t sent = ::send(m_conn.sockfd, m_out.data() + m_outSent, m_out.size() - m_outSent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            ec = make_system_error(errno);
+            return false;
+        }
+        m_outSent += sent;
+    }
+    if (m_outSent == m_out.size()) {
+        m_out.clear();
+        m_outSent = 0;
+    }
+    else if (m_outSent >= H2_OUTPUT_BATCH) {
+        m_out.erase(0, m_outSent);
+        m_outSent = 0;
+    }
+    return true;
+}
+
+void Http2Session::process_frames()
+{
+    size_t pos = 0;
+    if (!m_preface) {
+        size_t size = std::min<size_t>(m_in.size(), H2_PREFACE_SIZE);
+        if (memcmp(m_in.data(), H2_PREFACE, size) != 0) {
+            go_away(H2_PROTOCOL_ERROR);
+            return;
+        }
+        if (size < H2_PREFACE_SIZE)
+            return;
+        m_preface = true;
+        pos = H2_PREFACE_SIZE;
+    }
+    while (!m_failed && m_in.size() - pos >= H2_FRAME_HEADER_SIZE)
+    {
+        const char *header = m_in.data() + pos;
+        size_t length = read32(header) >> 8;
+        if (length > H2_FRAME_SIZE) {
+            go_away(H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        if (m_in.size() - pos < H2_FRAME_HEADER_SIZE + length)
+            break;
+        process_frame(header[3], header[4], read32(header + 5) & H2_MAX_WINDOW,
+                      std::string_view(header + H2_FRAME_HEADER_SIZE, length));
+        pos += H2_FRAME_HEADER_SIZE + length;
+    }
+    m_in.erase(0, pos);
+}
+
+void Http2Session::process_frame(uint8_t type, uint8_t flags, uint32_t id, std::string_view payload)
+{
+    // a header block is not interrupted by other frames
+    if ((m_headerStream != 0) != (type == H2_CONTINUATION) || (m_headerStream != 0 && id != m_headerStream)) {
+        go_away(H2_PROTOCOL_ERROR);
+        return;
+    }
+    switch (type)
+    {
+    case H2_DATA:
+    {
+        if (id == 0 || (id & 1) == 0 || id > m_lastStream) {
+            go_away(H2_PROTOCOL_ERROR);
+            return;
+        }
+        // request bodies are not used, the window is given back as it shrinks
+        m_receiveWindow -= payload.size();
+        if (m_receiveWindow < 0) {
+            go_away(H2_FLOW_CONTROL_ERROR);
+            return;
+        }
+        if (m_receiveWindow < H2_WINDOW / 2) {
+            window_update(0, H2_WINDOW - m_receiveWindow);
+            m_receiveWindow = H2_WINDOW;
+        }
+        Stream *stream = receiving_stream(id);
+        if (stream != nullptr && (flags & H2_FLAG_END_STREAM))
+            stream->requestOpen = false;
+        break;
+    }
+    case H2_HEADERS:
+    {
+        if (id == 0 || (id & 1) == 0) {
+            go_away(H2_PROTOCOL_ERROR);
+            return;
+        }
+        size_t skip = 0, padding = 0;
+        if (flags & H2_FLAG_PADDED) {
+            if (payload.empty()) {
+                go_away(H2_PROTOCOL_ERROR);
+                return;
+            }
+            padding = static_cast<unsigned char>(payload[0]);
+            skip = 1;
+        }
+        if (flags & H2_FLAG_PRIORITY)
+            skip += 5;
+        if (skip + padding > payload.size()) {
+            go_away(H2_PROTOCOL_ERROR);
+            return;
+        }
+        // a lower id is the trailer of a stream
+        m_headerNewStream = id > m_lastStream;
+        if (m_headerNewStream)
+            m_lastStream = id;
+        m_headerEndStream = flags & H2_FLAG_END_STREAM;
+        m_headerBlock.assign(payload.substr(skip, payload.size() - skip - padding));
+        if (flags & H2_FLAG_END_HEADERS)
+            process_headers(id, m_headerNewStream);
+        else
+            m_headerStream = id;
+        break;
+    }
+    case H2_CONTINUATION:
+        m_headerBlock.append(payload);
+        if (m_headerBlock.size() > HPACK_MAX_HEADER_LIST) {
+            go_away(H2_ENHANCE_YOUR_CALM);
+            return;
+        }
+        if (flags & H2_FLAG_END_HEADERS) {
+            m_headerStream = 0;
+            process_headers(id, m_headerNewStream);
+        }
+        break;
+    case H2_PRIORITY:
+        if (id == 0) {
+            go_away(H2_PROTOCOL_ERROR);
+            return;
+        }
+        if (payload.size() != 5)
+            reset_stream(id, H2_FRAME_SIZE_ERROR);
+        break;
+    case H2_RST_STREAM:
+    {
+        if (id == 0 || id > m_lastStream) {
+            go_away(H2_PROTOCOL_ERROR);
+            return;
+        }
+        if (payload.size() != 4) {
+            go_away(H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        auto it = m_streams.find(id);
+        if (it != m_streams.end()) {
+            it->second.requestOpen = false;
+            finish_stream(id, it->second);
+            m_streams.erase(it);
+        }
+        break;
+    }
+    case H2_SETTINGS:
+        if (id != 0) {
+            go_away(H2_PROTOCOL_ERROR);
+            return;
+        }
+        if ((flags & H2_FLAG_ACK) ? !payload.empty() : payload.size() % 6 != 0) {
+            go_away(H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        if (!(flags & H2_FLAG_ACK) && apply_settings(payload))
+            frame(H2_SETTINGS, H2_FLAG_ACK, 0, 0);
+        break;
+    case H2_PUSH_PROMISE:
+        go_away(H2_PROTOCOL_ERROR);
+        return;
+    case H2_PING:
+        if (id != 0) {
+            go_away(H2_PROTOCOL_ERROR);
+            return;
+        }
+        if (payload.size() != 8) {
+            go_away(H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        if (!(flags & H2_FLAG_ACK)) {
+            frame(H2_PING, H2_FLAG_ACK, 0, payload.size());
+            m_out.append(payload);
+        }
+        break;
+    case H2_GOAWAY:
+        if (id != 0) {
+            go_away(H2_PROTOCOL_ERROR);
+            return;
+        }
+        m_peerGoAway = true;
+        break;
+    case H2_WINDOW_UPDATE:
+    {
+        if (payload.size() != 4) {
+            go_away(H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        int64_t increment = read32(payload.data()) & H2_MAX_WINDOW;
+        if (id == 0) {
+            m_window += increment;
+            if (increment == 0 || m_window > H2_MAX_WINDOW)
+                go_away(increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+            break;
+        }
+        auto it = m_streams.find(id);
+        if (it == m_streams.end())
+            break;
+        it->second.window += increment;
+        if (increment == 0 || it->second.window > H2_MAX_WINDOW) {
+            reset_stream(id, increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+            it->second.requestOpen = false;
+            finish_stream(id, it->second);
+            m_streams.erase(it);
+        }
+        break;
+    }
+    default:
+        // unknown frame types are ignored
+        break;
+    }
+}
+
+void Http2Session::process_headers(uint32_t id, bool newStream)
+{
+    std::vector<HeaderField> fields;
+    std::error_code ec;
+    m_decoder.decode(m_headerBlock, fields, ec);
+    m_headerBlock.clear();
+    if (ec == make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST)) {
+        go_away(H2_COMPRESSION_ERROR);
+        return;
+    }
+    // trailers are not used but end the request, new streams after a GOAWAY are not answered
+    if (!newStream) {
+        Stream *stream = receiving_stream(id);
+        if (stream != nullptr && m_headerEndStream)
+            stream->requestOpen = false;
+        return;
+    }
+    if (m_goAway)
+        return;
+    if (m_streams.size() >= H2_MAX_STREAMS) {
+        reset_stream(id, H2_REFUSED_STREAM);
+        return;
+    }
+
+    Request request;
+    request.cmd = GET;
+    request.version = "HTTP/2";
+    bool method = false, path = false, scheme = false, regular = false, malformed = false;
+    for (HeaderField &field : fields)
+    {
+        const std::string &name = field.first;
+        if (!name.empty() && name[0] == ':') {
+            // pseudo-header fields come first
+            malformed |= regular;
+            if (name == ":method") {
+                method = true;
+                if (!parse_method(field.second, request.cmd) && !ec.value())
+                    ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+            }
+            else if (name == ":path") {
+                path = !field.second.empty();
+                request.uri = std::move(field.second);
+                // the limit of the HTTP/1 request line
+                if (request.uri.size() > 2000 && !ec.value())
+                    ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+            }
+            else if (name == ":scheme")
+                scheme = true;
+            else if (name == ":authority")
+                request.fields.emplace_back("host", std::move(field.second));
+            else
+                malformed = true;
+        }
+        else {
+            regular = true;
+            malformed |= name.empty() || connection_specific(name)
+                || std::any_of(name.begin(), name.end(), [](char c) { return isupper(static_cast<unsigned char>(c)); });
+            request.fields.push_back(std::move(field));
+        }
+    }
+    // a list too large to decode in full is answered with 431
+    if (!ec.value() && (malformed || !method || !path || !scheme)) {
+        reset_stream(id, H2_PROTOCOL_ERROR);
+        return;
+    }
+    if (!ec.value() && !m_server.rate_limiter().allow_request(m_conn)) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_TOO_MANY_REQUESTS);
+        metric_add(METRIC_REQUESTS_RATE_LIMITED);
+    }
+    start_stream(id, std::move(request), ec);
+}
+
+bool Http2Session::apply_settings(std::string_view payload)
+{
+    for (size_t pos = 0; pos + 6 <= payload.size(); pos += 6)
+    {
+        uint16_t setting = static_cast<unsigned char>(payload[pos]) << 8 | static_cast<unsigned char>(payload[pos + 1]);
+        uint32_t value = read32(payload.data() + pos + 2);
+        switch (setting)
+        {
+        case H2_SETTINGS_HEADER_TABLE_SIZE:
+            m_encoder.max_size(value);
+            break;
+        case H2_SETTINGS_ENABLE_PUSH:
+            if (value > 1) {
+                go_away(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            break;
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+            if (value > H2_MAX_WINDOW) {
+                go_away(H2_FLOW_CONTROL_ERROR);
+                return false;
+            }
+            for (auto &[id, stream] : m_streams)
+                stream.window += int64_t(value) - m_initialWindow;
+            m_initialWindow = value;
+            break;
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+            // frames stay at H2_FRAME_SIZE, larger ones would delay the other streams
+            if (value < H2_FRAME_SIZE || value > H2_MAX_FRAME_SIZE) {
+                go_away(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+void Http2Session::start_stream(uint32_t id, Request &&request, const std::error_code &ec)
+{
+    Stream stream{};
+    stream.timestamp = m_server.access_timestamp();
+    stream.started = metric_now();
+    stream.requestOpen = !m_headerEndStream;
+    stream.handler = std::make_unique<RequestHandler>(*m_server.m_source, m_server.m_responses, m_server.m_options);
+    stream.rh = stream.handler.get();
+    stream.handler->local(m_conn.local());
+    trace_begin();
+    stream.handler->process(std::move(request), ec);
+    trace_end(m_server.m_options.trace, stream.rh->request().uri, stream.rh->status(), metric_now() - stream.started);
+    respond(id, std::move(stream));
+}
+
+void Http2Session::respond(uint32_t id, Stream &&stream)
+{
+    metric_add(METRIC_HTTP2_STREAMS);
+    std::vector<Segment> segments;
+    stream.rh->response(segments);
+    // the HTTP/1.1 header is in front of the first segment
+    const Segment &first = segments.front();
+    std::string_view text = first.data ? std::string_view(first.data + first.offset, first.length) : std::string_view();
+    size_t end = text.find("\r\n\r\n");
+    size_t space = text.find(' ');
+    if (end == std::string_view::npos || space > end) {
+        LOG_E("stream %u: no response header\n", id);
+        reset_stream(id, H2_INTERNAL_ERROR);
+        finish_stream(id, stream);
+        return;
+    }
+
+    std::string block;
+    m_encoder.begin(block);
+    m_encoder.encode(":status", text.substr(space + 1, 3), block);
+    size_t line = text.find("\r\n") + 2;
+    while (line < end + 2)
+    {
+        size_t next = text.find("\r\n", line);
+        std::string_view field = text.substr(line, next - line);
+        line = next + 2;
+        size_t colon = field.find(':');
+        if (colon == std::string_view::npos)
+            continue;
+        std::string name(field.substr(0, colon));
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return tolower(c); });
+        if (connection_specific(name))
+            continue;
+        std::string_view value = field.substr(colon + 1);
+        value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+        if (name == "content-length")
+            value.remove_prefix(std::min(value.find_first_not_of('0'), value.size() - 1));
+        m_encoder.encode(name, value, block);
+    }
+
+    if (end + 4 < first.length)
+        stream.body.push_back(Segment{first.data, -1, first.offset + end + 4, first.length - end - 4});
+    stream.body.insert(stream.body.end(), segments.begin() + 1, segments.end());
+    std::erase_if(stream.body, [](const Segment &segment) { return segment.length == 0; });
+    bool endStream = stream.body.empty();
+
+    // HEADERS, and CONTINUATION for a block larger than a frame
+    size_t pos = 0;
+    do {
+        size_t length = std::min<size_t>(block.size() - pos, H2_FRAME_SIZE);
+        uint8_t flags = pos + length == block.size() ? H2_FLAG_END_HEADERS : 0;
+        if (pos == 0 && endStream)
+            flags |= H2_FLAG_END_STREAM;
+        frame(pos == 0 ? H2_HEADERS : H2_CONTINUATION, flags, id, length);
+        m_out.append(block, pos, length);
+        pos += length;
+    } while (pos < block.size());
+    stream.sent = block.size();
+
+    if (endStream) {
+        finish_stream(id, stream);
+        return;
+    }
+    stream.window = m_initialWindow;
+    m_streams.emplace(id, std::move(stream));
+}
+
+// Whether the next frame of a stream can be read from its file without waiting
+// for the disk. The chunk the frame is in is asked of FileIo and the chunk
+// after it is read ahead, fill_output() cuts frames at the end of a chunk.
+bool Http2Session::file_ready(Stream &stream, const Segment &segment)
+{
+    size_t at = segment.offset + stream.position;
+    size_t end = segment.offset + segment.length;
+    if (at < stream.chunkBegin || at >= stream.chunkEnd) {
+        FileIo &io = FileIo::instance();
+        if (stream.next && at == stream.chunkEnd) {
+            stream.read = std::move(stream.next);
+            stream.chunkEnd = stream.nextEnd;
+        }
+        else {
+            stream.chunkEnd = std::min<size_t>(at + FILE_IO_CHUNK, end);
+            stream.read = io.prefetch(segment.fd, at, stream.chunkEnd - at, stream.rh->holder());
+        }
+        stream.chunkBegin = at;
+        stream.nextEnd = std::min<size_t>(stream.chunkEnd + FILE_IO_CHUNK, end);
+        stream.next = io.prefetch(segment.fd, stream.chunkEnd, stream.nextEnd - stream.chunkEnd, stream.rh->holder());
+    }
+    if (stream.read && !stream.read->done()) {
+        m_reading = true;
+        return false;
+    }
+    stream.read.reset();
+    return true;
+}
+
+void Http2Session::fill_output()
+{
+    m_reading = false;
+    while (!m_streams.empty() && m_window > 0 && m_out.size() - m_outSent < H2_OUTPUT_BATCH)
+    {
+        bool progress = false;
+        auto it = m_streams.lower_bound(m_nextStream);
+        // a frame per stream in turn, starting where the last batch stopped
+        for (size_t turns = m_streams.size(); turns > 0 && m_window > 0 && m_out.size() - m_outSent < H2_OUTPUT_BATCH; --turns)
+        {
+            if (it == m_streams.end())
+                it = m_streams.begin();
+            uint32_t id = it->first;
+            Stream &stream = it->second;
+            if (stream.window <= 0) {
+                ++it;
+                continue;
+            }
+            const Segment &segment = stream.body[stream.segment];
+            if (segment.data == nullptr && !file_ready(stream, segment)) {
+                ++it;
+                continue;
+            }
+            size_t length = std::min<int64_t>({int64_t(segment.length - stream.position), stream.window, m_window, H2_FRAME_SIZE});
+            if (segment.data == nullptr)
+                length = std::min(length, stream.chunkEnd - segment.offset - stream.position);
+            bool last = stream.segment + 1 == stream.body.size() && stream.position + length == segment.length;
+            frame(H2_DATA, last ? H2_FLAG_END_STREAM : 0, id, length);
+            size_t at = m_out.size();
+            if (segment.data != nullptr)
+                m_out.append(segment.data + segment.offset + stream.position, length);
+            else {
+                m_out.resize(at + length);
+                if (!read_range(segment.fd, m_out.data() + at, length, segment.offset + stream.position)) {
+                    LOG_E("stream %u: %s\n", id, strerror(errno));
+                    m_out.resize(at - H2_FRAME_HEADER_SIZE);
+                    reset_stream(id, H2_INTERNAL_ERROR);
+                    stream.requestOpen = false;
+                    finish_stream(id, stream);
+                    it = m_streams.erase(it);
+                    continue;
+                }
+            }
+            progress = true;
+            stream.window -= length;
+            m_window -= length;
+            stream.sent += length;
+            stream.position += length;
+            if (stream.position == segment.length) {
+                ++stream.segment;
+                stream.position = 0;
+            }
+            if (last) {
+                finish_stream(id, stream);
+                it = m_streams.erase(it);
+            }
+            else
+                ++it;
+        }
+        m_nextStream = it == m_streams.end() ? 0 : it->first;
+        if (!progress)
+            break;
+    }
+}
+
+void Http2Session::finish_stream(uint32_t id, Stream &stream)
+{
+    // the response is complete, the rest of a request body is not needed
+    if (stream.requestOpen)
+        reset_stream(id, H2_NO_ERROR);
+    m_server.count_request(m_conn, *stream.rh, stream.sent, stream.timestamp, stream.started, metric_now());
+}
+
+void Http2Session::frame(uint8_t type, uint8_t flags, uint32_t id, size_t length)
+{
+    char header[H2_FRAME_HEADER_SIZE] = {
+        char(length >> 16), char(length >> 8), char(length),
+        char(type), char(flags),
+        char((id >> 24) & 0x7f), char(id >> 16), char(id >> 8), char(id)
+    };
+    m_out.append(header, sizeof(header));
+}
+
+// The stream a DATA frame or trailers go to, nullptr if the peer has ended
+// its side of it. That is a stream error on a stream still being answered and
+// a connection error on one that is closed, RFC 9113 5.1, except for streams
+// the server reset, frames that were in flight are ignored then.
+Http2Session::Stream *Http2Session::receiving_stream(uint32_t id)
+{
+    auto it = m_streams.find(id);
+    if (it != m_streams.end() && it->second.requestOpen)
+        return &it->second;
+    if (it != m_streams.end()) {
+        reset_stream(id, H2_STREAM_CLOSED);
+        finish_stream(id, it->second);
+        m_streams.erase(it);
+    }
+    else if (!m_goAway && std::find(m_resetStreams.begin(), m_resetStreams.end(), id) == m_resetStreams.end())
+        go_away(H2_STREAM_CLOSED);
+    return nullptr;
+}
+
+void Http2Session::reset_stream(uint32_t id, H2Error error)
+{
+    frame(H2_RST_STREAM, 0, id, 4);
+    append32(m_out, error);
+    m_resetStreams.push_back(id);
+    if (m_resetStreams.size() > H2_RESET_STREAMS)
+        m_resetStreams.pop_front();
+}
+
+void Http2Session::go_away(H2Error error)
+{
+    // a NO_ERROR one is sent once, an error ends the connection
+    if (m_failed || (m_goAway && error == H2_NO_ERROR))
+        return;
+    if (error != H2_NO_ERROR) {
+        LOG_E("HTTP/2 connection error %d\n", error);
+        m_failed = true;
+    }
+    m_goAway = true;
+    frame(H2_GOAWAY, 0, 0, 8);
+    append32(m_out, m_lastStream);
+    append32(m_out, error);
+}
+
+void Http2Session::window_update(uint32_t id, uint32_t increment)
+{
+    frame(H2_WINDOW_UPDATE, 0, id, 4);
+    append32(m_out, increment);
+}
+
+}// namespace http
@@ -45,6 +45,22 @@ std::string HttpErrorCategory::message(int ev) const
             return "Timeout expired";
         case HttpStatus::HTTP_ERR_INTERNAL_SERVER_ERROR:
             return "500 Internal Server Error";
+        case HttpStatus::HTTP_ERR_REQUEST_TIMEOUT:
+            return "408 Request Timeout";
+        case HttpStatus::HTTP_ERR_PAYLOAD_TOO_LARGE:
+            return "413 Content Too Large";
+        case HttpStatus::HTTP_ERR_HEADER_FIELDS_TOO_LARGE:
+            return "431 Request Header Fields Too Large";
+        case HttpStatus::HTTP_ERR_SERVICE_UNAVAILABLE:
+            return "503 Service Unavailable";
+        case HttpStatus::HTTP_ERR_INVALID_BUNDLE:
+            return "The file is not a valid site bundle";
+        case HttpStatus::HTTP_ERR_TOO_MANY_REQUESTS:
+            return "429 Too Many Requests";
+        case HttpStatus::HTTP_ERR_HANDOFF:
+            return "Failed to take over the listening socket of the running server";
+        case HttpStatus::HTTP_ERR_INTERRUPTED:
+            return "Interrupted to stop or reload the server";
     }
     return "Unknown error";
 }
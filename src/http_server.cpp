@@ -1,8 +1,15 @@
 #include "http_server.hpp"
+#include "http2.hpp"
+#include "file_io.hpp"
 #include "utils.hpp"
+#include "metrics.hpp"
 #include <cstring>
+#include <ctime>
+#include <strings.h>
+#include <charconv>
 #include <filesystem>
 #include <fstream>
+#include <poll.h>
 
 using namespace tslogger;
 
@@ -14,21 +21,33 @@ const char *CONTENT_SEPARATOR = "\r\n\r\n";
 
 const char *RESPONSE_HEADER_TEMPLATE = "HTTP/1.1 %s\r\n"\
 "Server: simple-http-server\r\n"\
-"Content-Encoding: %s\r\n"\
-"Content-Length: %08d\r\n"\
+"%s"\
+"Content-Length: %08zu\r\n"\
 "Content-Type: %s\r\n"\
+"%s"\
 "\r\n";
 
-const char *ERROR_PAGE_TEMPLATE = "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">"\
-"<html>"\
-"<head>"\
-"\t<title>%s</title>"\
-"</head>"\
-"<body>"\
-"\t<h1>%s</h1>"\
-"\t<p>%s</p>"\
-"</body>"\
-"</html>";
+// HEAD responses whose deflated length is not known yet leave Content-Length out
+const char *RESPONSE_HEADER_NO_LENGTH_TEMPLATE = "HTTP/1.1 %s\r\n"\
+"Server: simple-http-server\r\n"\
+"%s"\
+"Content-Type: %s\r\n"\
+"%s"\
+"\r\n";
+
+const size_t UNKNOWN_CONTENT_LENGTH = static_cast<size_t>(-1);
+
+const char *CONTENT_ENCODING_DEFLATE = "Content-Encoding: deflate\r\n";
+
+const char *METRICS_CONTENT_TYPE = "text/plain; version=0.0.4";
+const char *TRACE_CONTENT_TYPE = "application/json";
+
+const char *BYTERANGES_BOUNDARY = "SIMPLE_HTTP_SERVER_BYTERANGES";
+
+const char *NOT_MODIFIED_TEMPLATE = "HTTP/1.1 304 Not Modified\r\n"\
+"Server: simple-http-server\r\n"\
+"%s"\
+"\r\n";
 
 
 const RequestHandler::fsa_state_handler_ptr RequestHandler::s_fsa_state_handler[] = {
@@ -39,16 +58,19 @@ const RequestHandler::fsa_state_handler_ptr RequestHandler::s_fsa_state_handler[
 
 void RequestHandler::parse_incomming_http_pdu(void *data)
 {
+	TraceSpan span(TRACE_PARSE);
 	((RequestHandler *)data)->parse_incomming_http_pdu();
 }
 
 void RequestHandler::handle_get_request(void *data)
 {
+	TraceSpan span(TRACE_HANDLE);
 	((RequestHandler *)data)->handle_get_request();
 }
 
 void RequestHandler::done(void *data)
 {
+	TraceSpan span(TRACE_DONE);
 	((RequestHandler *)data)->done();
 }
 
@@ -77,206 +99,582 @@ static const char *cmd2str(Command cmd)
 	}
 }
 
-static const char *content_type2str(ContentType t)
+bool parse_method(std::string_view token, Command &cmd)
 {
-	switch(t)
+	for (Command method : { OPTIONS, GET, HEAD, POST, PUT, DELETE, TRACE, CONNECT })
 	{
-	case TEXT_HTML:
-		return "text/html";
-	case TEXT_CSS:
-		return "text/css";
-	case TEXT_JS:
-		return "text/javascript";
-	case IMAGE_PNG:
-		return "image/png";
-	case IMAGE_JPEG:
-		return "image/jpeg";
-	case IMAGE_ICON:
-		return "image/vnd.microsoft.icon";
-	default:
-		return "application/octet-stream";
+		if (token == cmd2str(method))
+		{
+			cmd = method;
+			return true;
+		}
 	}
+	return false;
 }
 
-static ContentType file_extention2content_type(const char *extension)
+static void parse_command(std::string_view token, Request &rqst, std::error_code &ec)
 {
-	size_t el = strlen(extension);
-	std::map<std::string, ContentType> ctm = { 
-		{".html",TEXT_HTML}, {".css",TEXT_CSS}, {".js",TEXT_JS},
-		{".png",IMAGE_PNG}, {".jpeg",IMAGE_JPEG}, {".jpg",IMAGE_JPEG}, {".ico",IMAGE_ICON}
-	};
-	for (const auto& [key, value] : ctm)
+	if (!parse_method(token, rqst.cmd))
+		ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+} 
+
+static void parse_uri(std::string_view token, Request &rqst, std::error_code &ec)
+{
+	if (token.size() > 2000) // if uri is longer than 2000 characters, there is an error
 	{
-		if (strncmp(key.c_str(), extension, el) == 0)
-			return value;
+		ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+		return;
 	}
-	return UNKNOWN;
+	rqst.uri = token;
 }
 
-static void parse_command(const char *line, Request &rqst, std::error_code &ec)
+static void parse_version(std::string_view token, Request &rqst, std::error_code &ec)
 {
-	for (Command cmd : { OPTIONS, GET, HEAD, POST, PUT, DELETE, TRACE, CONNECT })
+	if (token.size() > strlen("HTTP/1.1"))
 	{
-		const char *cmdStr = cmd2str(cmd);
-		if (strncmp(line, cmdStr, strlen(cmdStr)) == 0)
-		{
-			rqst.cmd = cmd;
-			return;
-		}
+		ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+		return;
 	}
-	ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
-} 
+	rqst.version = token;
+}
 
-static void parse_uri(const char *line, Request &rqst, std::error_code &ec)
+static std::string_view trim(std::string_view value)
 {
-	if (strlen(line) > 2000) // if uri is longer than 2000 characters, there is an error
+	while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+		value.remove_prefix(1);
+	while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+		value.remove_suffix(1);
+	return value;
+}
+
+static void parse_field(std::string_view line, Request &rqst, std::error_code &ec)
+{
+	size_t colon = line.find(':');
+	if (colon == std::string_view::npos || colon == 0)
 	{
 		ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
 		return;
 	}
-	rqst.uri = line;
+	rqst.fields.emplace_back(line.substr(0, colon), trim(line.substr(colon + 1)));
 }
 
-static void parse_version(const char *line, Request &rqst, std::error_code &ec)
+// whether a body follows the header, chunked or of a Content-Length
+static bool has_body(const Request &request)
 {
-	if (strlen(line) > strlen("HTTP/1.1"))
+	const std::string *length = request.field("Content-Length");
+	return request.field("Transfer-Encoding") != nullptr
+		|| (length != nullptr && *length != "0");
+}
+
+const std::string *Request::field(const char *name) const
+{
+	for (const auto &[key, value] : fields)
 	{
-		ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
-		return;
+		if (strcasecmp(key.c_str(), name) == 0)
+			return &value;
 	}
-	rqst.version = line;
+	return nullptr;
 }
 
 void RequestHandler::parse_incomming_http_pdu()
 {
-	m_logger.log(DEBUG, "%s:%d <<< Entering\n", __FILE__, __LINE__);
-	char request [m_offset];
-	memcpy (request, m_buffer.data(), m_offset);
+	ENTER();
+	std::string_view pdu(m_buffer.data(), m_offset);
+	m_request = Request();
 	// split to header and content
 
-	char *token = strstr(request, CONTENT_SEPARATOR);
-	if (token != NULL)
+	size_t headerEnd = pdu.find(CONTENT_SEPARATOR);
+	if (headerEnd != std::string_view::npos)
 	{
-		token += strlen(CONTENT_SEPARATOR);
-		m_request.content = token; // copy content of the request
+		m_request.content = pdu.substr(headerEnd + strlen(CONTENT_SEPARATOR)); // copy content of the request
+		pdu = pdu.substr(0, headerEnd);
 	}
-	token = strtok(request, HEADER_SEPARATOR);
-	if (token == NULL)
+	size_t lineEnd = pdu.find(HEADER_SEPARATOR);
+	std::string_view line = pdu.substr(0, lineEnd);
+	if (line.empty())
 	{
 		m_ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
-		m_logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
+		LOG_E("%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
 		m_fsaState = FSA_STATE_DONE;
 		return;
 	}
-	// parse header
+	// parse request line
 
-	typedef void (*header_parser_t)(const char *line, Request &rqst, std::error_code &ec);
+	typedef void (*header_parser_t)(std::string_view token, Request &rqst, std::error_code &ec);
 	header_parser_t parsers[] = {
 		parse_command,
 		parse_uri,
 		parse_version,
 		nullptr
 	};
-	token = strtok(request, " ");
 	int state = 0;
-	while(token != NULL && parsers[state] != nullptr)
+	while(!line.empty() && parsers[state] != nullptr)
 	{
-		parsers[state++](token, m_request, m_ec);
+		size_t space = line.find(' ');
+		parsers[state++](line.substr(0, space), m_request, m_ec);
 		if (m_ec.value())
 		{
 			m_fsaState = FSA_STATE_DONE;
-			m_logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
+			LOG_E("%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
 			return;			
 		}
-		token = strtok(NULL, " ");
+		line = space == std::string_view::npos ? std::string_view() : line.substr(space + 1);
+	}
+	LOG_D("m_request.uri = %s\n", m_request.uri.c_str());
+	// parse header fields
+
+	while (lineEnd != std::string_view::npos)
+	{
+		pdu.remove_prefix(lineEnd + strlen(HEADER_SEPARATOR));
+		lineEnd = pdu.find(HEADER_SEPARATOR);
+		parse_field(pdu.substr(0, lineEnd), m_request, m_ec);
+		if (m_ec.value())
+		{
+			m_fsaState = FSA_STATE_DONE;
+			LOG_E("%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
+			return;
+		}
 	}
-	m_logger.log(DEBUG, "m_request.uri = %s\n", m_request.uri.c_str());
 	// parse command
 
-	if (m_request.cmd != GET)
+	if (m_request.cmd != GET && m_request.cmd != HEAD)
 	{
 		m_ec = make_error_code(HttpStatus::HTTP_ERR_NOT_IMPLEMENTED);
-		m_logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
+		LOG_E("%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
 		m_fsaState = FSA_STATE_DONE;
 		return;	
 	}
+	// a GET or HEAD has no use for a body, it is not read either
+	if (has_body(m_request))
+	{
+		m_ec = make_error_code(HttpStatus::HTTP_ERR_PAYLOAD_TOO_LARGE);
+		LOG_E("%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
+		m_fsaState = FSA_STATE_DONE;
+		return;
+	}
 	m_fsaState = FSA_STATE_HANDLE_GET_REQUEST;
-	m_logger.log(DEBUG, "%s:%d >>> Exiting\n", __FILE__, __LINE__);
+	EXIT();
+}
+
+// etag is the one of the representation that is sent, see Asset::deflatedEtag
+static int create_file_fields(const Asset &asset, std::string_view etag, const HttpOptions &options, char (&out)[384])
+{
+	int len = snprintf(out, sizeof(out), "ETag: %.*s\r\nLast-Modified: %.*s\r\nAccept-Ranges: bytes\r\nVary: Accept-Encoding\r\n",
+						static_cast<int>(etag.size()), etag.data(),
+						static_cast<int>(asset.lastModified.size()), asset.lastModified.data());
+	if (!options.cacheControl.empty() && len > 0 && static_cast<size_t>(len) < sizeof(out))
+		len += snprintf(out + len, sizeof(out) - len, "Cache-Control: %s\r\n", options.cacheControl.c_str());
+	return len < static_cast<int>(sizeof(out)) ? len : sizeof(out) - 1;
+}
+
+static size_t create_header(
+		const Asset &asset,
+		const HttpOptions &options,
+		const char *status,
+		const char *encoding,
+		size_t contentSize,
+		const char *contentType,
+		const char *extra,
+		char (&out)[512]
+	)
+{
+    char fields[384];
+    int len = create_file_fields(asset, *encoding != '\0' ? asset.deflatedEtag : asset.etag, options, fields);
+    snprintf(fields + len, sizeof(fields) - len, "%s", extra);
+    if (contentSize == UNKNOWN_CONTENT_LENGTH)
+		len = snprintf(out, sizeof(out), RESPONSE_HEADER_NO_LENGTH_TEMPLATE, status, encoding, contentType, fields);
+    else
+		len = snprintf(out, sizeof(out), RESPONSE_HEADER_TEMPLATE, status, encoding, contentSize, contentType, fields);
+    return len < static_cast<int>(sizeof(out)) ? len : sizeof(out) - 1;
+}
+
+static bool parse_number(std::string_view value, size_t &out)
+{
+	auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), out);
+	return ec == std::errc() && ptr == value.data() + value.size();
+}
+
+// Parses a "bytes=" Range field against a file of the given size. Unsatisfiable
+// ranges are dropped, false is returned if the whole field has to be ignored.
+static bool parse_ranges(std::string_view value, size_t size, std::vector<ByteRange> &ranges)
+{
+	if (!value.starts_with("bytes="))
+		return false;
+	value.remove_prefix(strlen("bytes="));
+	while (!value.empty())
+	{
+		size_t comma = value.find(',');
+		std::string_view spec = trim(value.substr(0, comma));
+		value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+		if (spec.empty())
+			continue;
+
+		size_t dash = spec.find('-');
+		if (dash == std::string_view::npos)
+			return false;
+		size_t first, last;
+		if (dash == 0) {
+			// suffix range, the last N bytes
+			if (!parse_number(spec.substr(1), last))
+				return false;
+			if (last == 0 || size == 0)
+				continue;
+			first = last < size ? size - last : 0;
+			last = size - 1;
+		}
+		else {
+			if (!parse_number(spec.substr(0, dash), first))
+				return false;
+			if (dash + 1 == spec.size())
+				last = size - 1;
+			else if (!parse_number(spec.substr(dash + 1), last) || last < first)
+				return false;
+			if (first >= size)
+				continue;
+			if (last >= size)
+				last = size - 1;
+		}
+		if (ranges.size() == MAX_BYTE_RANGES)
+			return false;
+		ranges.push_back({first, last});
+	}
+	return true;
+}
+
+// If-Range only allows a strong comparison of the entity tag or an exact date,
+// ranges are sent from the identity representation
+static bool if_range_matches(const Request &rqst, const Asset &asset)
+{
+	const std::string *value = rqst.field("If-Range");
+	if (value == nullptr)
+		return true;
+	if (value->starts_with("\""))
+		return *value == asset.etag;
+	return *value == asset.lastModified;
+}
+
+static bool accepts_deflate(const Request &rqst)
+{
+	const std::string *value = rqst.field("Accept-Encoding");
+	if (value == nullptr)
+		return false;
+	std::string_view list = *value;
+	while (!list.empty())
+	{
+		size_t comma = list.find(',');
+		std::string_view coding = trim(list.substr(0, comma));
+		list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+
+		size_t semicolon = coding.find(';');
+		std::string_view name = trim(coding.substr(0, semicolon));
+		if (strncasecmp(name.data(), "deflate", name.size()) != 0 || name.size() != strlen("deflate"))
+			continue;
+		if (semicolon == std::string_view::npos)
+			return true;
+		std::string_view params = coding.substr(semicolon + 1);
+		size_t q = params.find("q=");
+		return q == std::string_view::npos || strtod(std::string(params.substr(q + 2)).c_str(), nullptr) > 0;
+	}
+	return false;
+}
+
+// true if one of the entity tags listed in If-None-Match matches the file,
+// the weak comparison is used as required for If-None-Match
+static bool etag_matches(std::string_view list, std::string_view etag)
+{
+	while (!list.empty())
+	{
+		size_t comma = list.find(',');
+		std::string_view tag = trim(list.substr(0, comma));
+		if (tag == "*")
+			return true;
+		if (tag.starts_with("W/"))
+			tag.remove_prefix(2);
+		if (tag == etag)
+			return true;
+		list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+	}
+	return false;
 }
 
-static void create_header(std::filesystem::path &filePath, size_t contentSize, char (&out)[256])
+static bool not_modified(const Request &rqst, const Asset &asset, std::string_view etag)
 {
-    const char *ct = content_type2str( file_extention2content_type( filePath.extension().string().c_str() ) );
-    sprintf(out, RESPONSE_HEADER_TEMPLATE, "200 OK", "deflate", contentSize, ct);
+	const std::string *value = rqst.field("If-None-Match");
+	if (value != nullptr)
+		return etag_matches(*value, etag);
+
+	value = rqst.field("If-Modified-Since");
+	if (value == nullptr)
+		return false;
+	struct tm tm = {};
+	const char *end = strptime(value->c_str(), HTTP_DATE_FORMAT, &tm);
+	if (end == nullptr || *end != '\0')
+		return false;
+	return asset.mtime <= timegm(&tm);
 }
 
 void RequestHandler::handle_get_request()
 {
-	m_logger.log(DEBUG, "%s:%d <<< Entering\n", __FILE__, __LINE__);
+	ENTER();
 	m_fsaState = FSA_STATE_DONE;
 
-	m_logger.log(DEBUG, "%s:%d %s\n", __FILE__, __LINE__, m_root.string().c_str());
-	
-	if (m_request.uri != "/" && m_request.uri[0] == '/') {
-		m_request.uri.erase(0,1);
+	bool debug = m_local || m_options.debugRemote;
+	if (debug && !m_options.metricsPath.empty() && m_request.uri == m_options.metricsPath) {
+		m_generated.clear();
+		render_metrics(m_generated);
+		create_generated_response(METRICS_CONTENT_TYPE);
+		EXIT();
+		return;
+	}
+	if (debug && !m_options.tracePath.empty() && m_request.uri == m_options.tracePath) {
+		m_generated.clear();
+		render_trace(m_generated);
+		create_generated_response(TRACE_CONTENT_TYPE);
+		EXIT();
+		return;
 	}
 
-	std::filesystem::path filePath = (m_request.uri == "/") ? (m_root / std::filesystem::path("index.html")) : (m_root / std::filesystem::path(m_request.uri));
-    m_logger.log(DEBUG, "%s:%d %s\n", __FILE__, __LINE__, filePath.string().c_str());
+	normalize_uri(m_request.uri, m_ec);
+	if (m_ec.value()) {
+		LOG_E("%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
+		return;
+	}
+	if (m_request.uri.empty()) {
+		m_request.uri = "index.html";
+	}
+    LOG_D("%s:%d %s\n", __FILE__, __LINE__, m_request.uri.c_str());
 
-    if (std::filesystem::is_directory(filePath)) {
-		m_ec = make_error_code(HttpStatus::HTTP_ERR_NOT_IMPLEMENTED);
-		m_logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
+    {
+		TraceSpan span(TRACE_LOOKUP);
+		m_source.lookup(m_request.uri, m_asset, m_ec);
+    }
+    if (m_ec.value()) {
+		LOG_E("%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
+		return;
+    }
+    // validators are checked before the file is touched, a match is answered with headers only,
+    // the ETag is the one of the representation that would be sent
+    bool deflate = accepts_deflate(m_request) && m_asset.deflatable;
+    std::string_view etag = deflate ? m_asset.deflatedEtag : m_asset.etag;
+    if (not_modified(m_request, m_asset, etag)) {
+		char fields[384];
+		create_file_fields(m_asset, etag, m_options, fields);
+		m_offset = snprintf(m_buffer.data(), m_buffer.size(), NOT_MODIFIED_TEMPLATE, fields);
+		m_status = 304;
+		EXIT();
+		return;
+    }
+    if (m_request.cmd == HEAD) {
+		create_head_response(deflate);
+		EXIT();
 		return;
     }
-    // content size is required here only to calculate a header size
-	size_t contentSize = MAX_BUFFER_SIZE;
-    char header[256];
-    create_header(filePath, contentSize, header);
-
-	m_buffer.clear();
-	// copy the header to the output buffer
-    strncpy(m_buffer.data(), header, strlen(header));
-	m_offset = strlen(header);
-	m_buffer.offset(m_offset);
-	// compress the requested file
-	contentSize = compress_file(filePath, m_logger, m_buffer, m_ec);
+
+    const std::string *range = m_request.field("Range");
+    if (range != nullptr && if_range_matches(m_request, m_asset)) {
+		std::vector<ByteRange> ranges;
+		if (parse_ranges(*range, m_asset.size, ranges)) {
+			create_range_response(ranges);
+			EXIT();
+			return;
+		}
+    }
+    if (deflate) {
+		create_deflate_response();
+    }
+    else {
+		create_identity_response();
+    }
+	EXIT();
+}
+
+// metrics and traces are rendered into m_generated when they are requested
+void RequestHandler::create_generated_response(const char *contentType)
+{
+	m_offset = snprintf(m_buffer.data(), m_buffer.size(), RESPONSE_HEADER_TEMPLATE, "200 OK", "",
+						m_generated.size(), contentType, "Cache-Control: no-store\r\n");
+	m_segments.push_back({m_buffer.data(), -1, 0, m_offset});
+	if (m_request.cmd != HEAD)
+		m_segments.push_back({m_generated.data(), -1, 0, m_generated.size()});
+}
+
+// HEAD is answered from the metadata only, the file is neither read nor compressed
+void RequestHandler::create_head_response(bool deflate)
+{
+    char header[512];
+    size_t contentSize = m_asset.size;
+    if (deflate)
+		contentSize = m_asset.deflated.empty() ? UNKNOWN_CONTENT_LENGTH : m_asset.deflated.size();
+    m_offset = create_header(m_asset, m_options, "200 OK", deflate ? CONTENT_ENCODING_DEFLATE : "",
+    						contentSize, m_asset.contentType, "", header);
+    memcpy(m_buffer.data(), header, m_offset);
+}
+
+void RequestHandler::create_deflate_response()
+{
+	// concurrent requests for the same file version share one compression
+	m_source.deflate(m_asset, m_ec);
 	if (m_ec.value()) {
-		m_logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
+		LOG_E("%s:%d %s\n", __FILE__, __LINE__, m_ec.message().c_str());
 		return;
 	}
+    char header[512];
+    size_t len = create_header(m_asset, m_options, "200 OK", CONTENT_ENCODING_DEFLATE, m_asset.deflated.size(),
+    							m_asset.contentType, "", header);
+	memcpy(m_buffer.data(), header, len);
+	m_offset = len;
+	m_segments.push_back({m_buffer.data(), -1, 0, len});
+	m_segments.push_back({m_asset.deflated.data(), -1, 0, m_asset.deflated.size()});
+}
 
-	// create header again due to the Content-Lenght has been changed
-	create_header(filePath, contentSize, header);
-	strncpy(m_buffer.data(), header, strlen(header));
-	m_offset = strlen(header);
+// identity bytes go straight from the file to the socket whenever there is a descriptor
+void RequestHandler::push_identity_segment(size_t offset, size_t length)
+{
+	if (m_asset.fd != -1)
+		m_segments.push_back({nullptr, m_asset.fd, static_cast<size_t>(m_asset.fileOffset) + offset, length});
+	else
+		m_segments.push_back({m_asset.data, -1, offset, length});
+}
+
+void RequestHandler::create_identity_response()
+{
+    char header[512];
+    size_t len = create_header(m_asset, m_options, "200 OK", "", m_asset.size, m_asset.contentType, "", header);
+	memcpy(m_buffer.data(), header, len);
+	m_offset = len;
+	m_segments.push_back({m_buffer.data(), -1, 0, len});
+	if (m_asset.size > 0)
+		push_identity_segment(0, m_asset.size);
+}
+
+void RequestHandler::create_range_response(const std::vector<ByteRange> &ranges)
+{
+    char header[512];
+    char extra[128];
+    const char *ct = m_asset.contentType;
+    size_t len;
+
+    if (ranges.empty()) {
+		snprintf(extra, sizeof(extra), "Content-Range: bytes */%zu\r\n", m_asset.size);
+		m_offset = create_header(m_asset, m_options, "416 Range Not Satisfiable", "", 0, ct, extra, header);
+		m_status = 416;
+		memcpy(m_buffer.data(), header, m_offset);
+		return;
+    }
+    if (ranges.size() == 1) {
+		const ByteRange &r = ranges.front();
+		snprintf(extra, sizeof(extra), "Content-Range: bytes %zu-%zu/%zu\r\n", r.first, r.last, m_asset.size);
+		len = create_header(m_asset, m_options, "206 Partial Content", "", r.last - r.first + 1, ct, extra, header);
+		m_status = 206;
+		memcpy(m_buffer.data(), header, len);
+		m_offset = len;
+		m_segments.push_back({m_buffer.data(), -1, 0, len});
+		push_identity_segment(r.first, r.last - r.first + 1);
+		return;
+    }
+    // multipart/byteranges, the part headers are rendered first as they count to Content-Length
+    std::string parts;
+    std::vector<size_t> partEnds;
+    size_t contentSize = 0;
+    for (const ByteRange &r : ranges)
+    {
+		char part[256];
+		int n = snprintf(part, sizeof(part), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+							BYTERANGES_BOUNDARY, ct, r.first, r.last, m_asset.size);
+		parts.append(part, n);
+		partEnds.push_back(parts.size());
+		contentSize += n + r.last - r.first + 1;
+    }
+    parts += "\r\n--";
+    parts += BYTERANGES_BOUNDARY;
+    parts += "--\r\n";
+    contentSize += parts.size() - partEnds.back();
+
+    char type[128];
+    snprintf(type, sizeof(type), "multipart/byteranges; boundary=%s", BYTERANGES_BOUNDARY);
+    len = create_header(m_asset, m_options, "206 Partial Content", "", contentSize, type, "", header);
+    m_status = 206;
+    memcpy(m_buffer.data(), header, len);
+    memcpy(m_buffer.data() + len, parts.data(), parts.size());
+    m_offset = len + parts.size();
+
+    size_t begin = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+		m_segments.push_back({m_buffer.data(), -1, (i == 0 ? 0 : len) + begin, (i == 0 ? len : 0) + partEnds[i] - begin});
+		push_identity_segment(ranges[i].first, ranges[i].last - ranges[i].first + 1);
+		begin = partEnds[i];
+    }
+    m_segments.push_back({m_buffer.data(), -1, len + begin, parts.size() - begin});
+}
 
-	m_offset += contentSize;
-	m_logger.log(DEBUG, "%s:%d >>> Exiting\n", __FILE__, __LINE__);
+// A file goes out in chunks. FileIo reads the next chunk into the page cache
+// while the current one is sent, so the disk and the network overlap instead
+// of sendfile() waiting for the disk one readahead window after the other.
+size_t RequestHandler::send_file_segment(int sockfd, const Segment &segment, std::error_code &ec)
+{
+	FileIo &io = FileIo::instance();
+	size_t total = 0;
+	FileReadPtr read = io.prefetch(segment.fd, segment.offset, std::min<size_t>(segment.length, FILE_IO_CHUNK), m_asset.holder);
+	while (total < segment.length && !ec.value())
+	{
+		size_t chunk = std::min<size_t>(segment.length - total, FILE_IO_CHUNK);
+		size_t next = std::min<size_t>(segment.length - total - chunk, FILE_IO_CHUNK);
+		FileReadPtr nextRead = io.prefetch(segment.fd, segment.offset + total + chunk, next, m_asset.holder);
+		if (read) {
+			TraceSpan span(TRACE_FILE_WAIT);
+			read->wait();
+		}
+		TraceSpan span(TRACE_SENDFILE);
+		total += send_file(sockfd, segment.fd, segment.offset + total, chunk, ec);
+		read = std::move(nextRead);
+	}
+	return total;
 }
 
-static void create_error_content(std::error_code &ec, std::string &out)
+size_t RequestHandler::send(int sockfd, bool cork, std::error_code &ec)
 {
-	char header[256];
-	char html[256];
-	sprintf(html, ERROR_PAGE_TEMPLATE, ec.message().c_str(), ec.message().c_str(), ec.message().c_str());
-	sprintf(header, RESPONSE_HEADER_TEMPLATE, ec.message().c_str(), "deflate", strlen(html), "text/html");
-	out = header;
-	out += html;
+	if (m_segments.empty()) {
+		TraceSpan span(TRACE_SEND);
+		return send_all(sockfd, m_buffer.data(), m_offset, ec);
+	}
+
+	// the header would otherwise leave in a segment of its own ahead of the body
+	cork = cork && m_segments.size() > 1;
+	if (cork)
+		cork_socket(sockfd, true);
+	size_t total = 0;
+	for (const Segment &segment : m_segments)
+	{
+		if (segment.data == nullptr)
+			total += send_file_segment(sockfd, segment, ec);
+		else {
+			TraceSpan span(TRACE_SEND);
+			total += send_all(sockfd, segment.data + segment.offset, segment.length, ec);
+		}
+		if (ec.value())
+			break;
+	}
+	if (cork)
+		cork_socket(sockfd, false);
+	return total;
 }
 
 void RequestHandler::done()
 {
-	m_logger.log(DEBUG, "%s:%d <<< Entering\n", __FILE__, __LINE__);
+	ENTER();
 	m_processing = false;
 	if (m_ec.value())
 	{
-		std::string answer;
-		create_error_content(m_ec, answer);
-		memcpy(m_buffer.data(), answer.c_str(), answer.size());
-		m_offset = answer.size();
+		m_segments.clear();
+		m_asset = Asset();
+		// error responses are rendered at startup and go out with a single write
+		std::string_view response = m_responses.get(m_ec, m_request.cmd == HEAD);
+		m_status = m_responses.code(m_ec);
+		m_segments.push_back({response.data(), -1, 0, response.size()});
+		m_offset = 0;
 	}
-	m_logger.log(DEBUG, "%s:%d >>> Exiting\n", __FILE__, __LINE__);
+	EXIT();
 }
 
 HttpServer::HttpServer(
@@ -284,36 +682,156 @@ HttpServer::HttpServer(
 		int port,
 		bool ipv4,
 		const unsigned int maxClients,
-		tslogger::Handler &handler,
-		const char *logFileName,
-		bool logToStdout,
+		bool takeOver,
 		std::error_code &ec
 	):
 	TcpServer(
 		port,
 		ipv4,
 		maxClients,
-		handler,
-		logFileName,
-		logToStdout,
+		takeOver,
 		ec
 	),
-	m_root{root}
+	m_root{root},
+	m_cache{m_root},
+	m_bundle{m_root},
+	m_source{&m_cache},
+	m_responses{},
+	m_options{},
+	m_accessLog{}
 {
 	if (ec.value())
 		return;
+	// a regular file in place of the doc root is a site bundle built by shs-bundle
+	if (std::filesystem::is_regular_file(m_root)) {
+		m_source = &m_bundle;
+		m_bundle.start(ec);
+		return;
+	}
 	if (!std::filesystem::is_directory(m_root)) {
         ec = make_error_code(HttpStatus::HTTP_ERR_NOT_DIRECTORY);
+        return;
     }
+    m_cache.start(ec);
+}
+
+HttpServer::HttpServer(
+		ContentSource &source,
+		int port,
+		bool ipv4,
+		const unsigned int maxClients,
+		bool takeOver,
+		std::error_code &ec
+	):
+	TcpServer(
+		port,
+		ipv4,
+		maxClients,
+		takeOver,
+		ec
+	),
+	m_root{},
+	m_cache{m_root},
+	m_bundle{m_root},
+	m_source{&source},
+	m_responses{},
+	m_options{},
+	m_accessLog{}
+{}
+
+void HttpServer::reload(std::error_code &ec)
+{
+	m_source->reload(ec);
+}
+
+void HttpServer::warm_up(std::error_code &ec)
+{
+	// bundles and embedded assets are in memory already
+	if (m_source != &m_cache)
+		return;
+	size_t loaded = 0;
+	for (auto iter = std::filesystem::recursive_directory_iterator(m_root, ec);
+		!ec.value() && iter != std::filesystem::recursive_directory_iterator() && loaded < WARM_UP_BYTES;
+		iter.increment(ec))
+	{
+		if (!iter->is_regular_file())
+			continue;
+		std::error_code lookupEc;
+		Asset asset;
+		m_cache.lookup(std::filesystem::relative(iter->path(), m_root).generic_string(), asset, lookupEc);
+		if (lookupEc.value())
+			continue;
+		if (asset.deflatable)
+			m_cache.deflate(asset, lookupEc);
+		loaded += asset.size;
+	}
+}
+
+void HttpServer::error_pages(const char *dir, std::error_code &ec)
+{
+	m_responses.load(dir, ec);
+}
+
+void HttpServer::access_log(const char *dir, std::error_code &ec)
+{
+	m_accessLog = std::make_unique<AccessLog>(dir);
+	m_accessLog->start(ec);
+	if (ec.value())
+		m_accessLog.reset();
+}
+
+void HttpServer::stop_access_log()
+{
+	if (m_accessLog)
+		m_accessLog->stop();
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void log_access(
+			AccessLog &log,
+			const Connection &conn,
+			const RequestHandler &rh,
+			size_t sent,
+			uint64_t timestamp,
+			uint64_t started
+		)
+{
+	AccessRecord record;
+	memset(&record, 0, sizeof(record));
+	record.timestamp = timestamp;
+	record.bytes = sent;
+	record.latency = (metric_now() - started) / 1000;
+	record.status = rh.status();
+	record.method = rh.request().cmd;
+	if (conn.local()) {
+		record.family = AF_UNIX;
+	}
+	else if (conn.ipv4) {
+		record.family = AF_INET;
+		record.port = ntohs(conn.client.addr.sin_port);
+		memcpy(record.addr, &conn.client.addr.sin_addr, sizeof(conn.client.addr.sin_addr));
+	}
+	else {
+		record.family = AF_INET6;
+		record.port = ntohs(conn.client.addr6.sin6_port);
+		memcpy(record.addr, &conn.client.addr6.sin6_addr, sizeof(conn.client.addr6.sin6_addr));
+	}
+	log.append(record, rh.request().uri);
 }
 
 void HttpServer::incoming_handler(
 			const Connection &conn,
-			tslogger::Logger &logger,
 			std::error_code &ec
 		)
 {
-	RequestHandler rh(logger, m_root);
+	RequestHandler rh(*m_source, m_responses, m_options);
+	rh.local(conn.local());
 	ssize_t received, sent;
 	socklen_t addr_len;
 	struct sockaddr *client_addr;
@@ -328,24 +846,201 @@ void HttpServer::incoming_handler(
 	}
 	memset(client_addr, 0, addr_len);
 
+	trace_begin();
+	uint64_t receiving = trace_ticks();
 	received = ::recvfrom(conn.sockfd, rh.buffer().data(), rh.buffer().size(), MSG_DONTWAIT, client_addr, &addr_len);
-	if (received > 0) {
-		logger.log(INFO, "<-- %d bytes received\n", received);
+	if (received > 0)
 		rh.offset(received);
-		rh.process();
-		//log_connection(logger, static_cast<const Connection&>(inconn));
-		if (sent = ::sendto(conn.sockfd, rh.buffer().data(), rh.offset(), MSG_DONTWAIT, client_addr, addr_len) == -1) {
-			ec = make_system_error(errno);
-			logger.log(ERROR, "%s\n", ec.message().c_str());
-			ec.clear();
+	// the preface of HTTP/2 holds an empty line as well, it is found in the same way
+	size_t headerEnd = received > 0 ? receive_header(conn, rh, ec) : std::string_view::npos;
+	trace_span(TRACE_RECEIVE, receiving, trace_ticks());
+	received = rh.offset();
+	if (headerEnd == std::string_view::npos) {
+		if (!ec.value())
+			ec = make_error_code(HttpStatus::HTTP_ERR_CLOSED_CONNECTION);
+	}
+	else if (m_options.http2 && h2_preface_prefix(rh.buffer().data(), received)) {
+		// HTTP/2 with prior knowledge, the session keeps the connection till its end
+		Http2Session session(*this, conn);
+		session.run(std::string_view(rh.buffer().data(), received), ec);
+		ec = make_error_code(HttpStatus::HTTP_ERR_CLOSED_CONNECTION);
+	}
+	else {
+		metric_add(METRIC_BYTES_RECEIVED, received);
+		// requests a client sent without waiting for the responses are answered in turn
+		while (true)
+		{
+			if (!rate_limiter().allow_request(conn)) {
+				// answered without parsing, the connection is closed after it
+				metric_add(METRIC_REQUESTS_RATE_LIMITED);
+				refuse(conn, HttpStatus::HTTP_ERR_TOO_MANY_REQUESTS, ec);
+				return;
+			}
+			uint64_t timestamp = access_timestamp();
+			uint64_t started = metric_now();
+			LOG_I("<-- %zd bytes received\n", received);
+			// the response is rendered into the buffer, the next requests are kept apart
+			std::string next(rh.buffer().data() + headerEnd, rh.offset() - headerEnd);
+			rh.offset(headerEnd);
+			rh.process();
+			//log_connection(static_cast<const Connection&>(inconn));
+			if (m_options.http2 && upgrade(conn, rh, next)) {
+				ec = make_error_code(HttpStatus::HTTP_ERR_CLOSED_CONNECTION);
+				return;
+			}
+			uint64_t sending = metric_now();
+			sent = rh.send(conn.sockfd, socket_options().cork && !conn.local(), ec);
+			uint64_t finished = metric_now();
+			metric_observe(METRIC_SEND_TIME, finished - sending);
+			if (ec.value())
+				LOG_E("%s\n", ec.message().c_str());
+			else
+				LOG_I("--> %zd bytes sent\n", sent);
+			count_request(conn, rh, sent, timestamp, started, finished);
+			trace_end(m_options.trace, rh.request().uri, rh.status(), finished - started);
+			// a body is not read, what follows it could not be told apart from a request
+			if (ec.value() || has_body(rh.request())) {
+				ec = make_error_code(HttpStatus::HTTP_ERR_CLOSED_CONNECTION);
+				return;
+			}
+			if (next.empty())
+				return;
+
+			trace_begin();
+			memcpy(rh.buffer().data(), next.data(), next.size());
+			rh.offset(next.size());
+			headerEnd = receive_header(conn, rh, ec);
+			if (headerEnd == std::string_view::npos) {
+				if (!ec.value())
+					ec = make_error_code(HttpStatus::HTTP_ERR_CLOSED_CONNECTION);
+				return;
+			}
+			received = rh.offset() - next.size();
+			metric_add(METRIC_BYTES_RECEIVED, received);
 		}
-		else {
-			logger.log(INFO, "--> %d bytes sent\n", rh.offset());
+	}
+}
+
+size_t HttpServer::receive_header(const Connection &conn, RequestHandler &rh, std::error_code &ec)
+{
+	// a request is only answered once all of its header is there, a part of it
+	// could be taken for a request of its own
+	RequestBuffer &buffer = rh.buffer();
+	while (true)
+	{
+		std::string_view data(buffer.data(), rh.offset());
+		size_t headerEnd = data.find(CONTENT_SEPARATOR);
+		if (headerEnd != std::string_view::npos)
+			return headerEnd + strlen(CONTENT_SEPARATOR);
+		if (rh.offset() == buffer.size()) {
+			refuse(conn, HttpStatus::HTTP_ERR_HEADER_FIELDS_TOO_LARGE, ec);
+			return std::string_view::npos;
 		}
+
+		struct pollfd pfd = {conn.sockfd, POLLIN, 0};
+		int ready = ::poll(&pfd, 1, REQUEST_HEADER_TIMEOUT_MS);
+		if (ready == -1 && errno == EINTR)
+			continue;
+		if (ready == 0)
+			refuse(conn, HttpStatus::HTTP_ERR_REQUEST_TIMEOUT, ec);
+		if (ready <= 0)
+			return std::string_view::npos;
+		ssize_t received = ::recv(conn.sockfd, buffer.data() + rh.offset(), buffer.size() - rh.offset(), MSG_DONTWAIT);
+		if (received == -1 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if (received <= 0)
+			return std::string_view::npos;
+		rh.offset(rh.offset() + received);
 	}
-	else {
-		ec = make_error_code(HttpStatus::HTTP_ERR_CLOSED_CONNECTION);
+}
+
+void HttpServer::refuse(const Connection &conn, HttpStatus status, std::error_code &ec)
+{
+	std::error_code error = make_error_code(status);
+	std::string_view response = m_responses.get(error, false);
+	::send(conn.sockfd, response.data(), response.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+	// the rest of the request is not read, a close with unread data resets the
+	// connection and might take the answer with it
+	::shutdown(conn.sockfd, SHUT_WR);
+	char discard[4096];
+	for (int i = 0; i < 4 && ::recv(conn.sockfd, discard, sizeof(discard), MSG_DONTWAIT) > 0; ++i)
+		;
+	metric_add(METRIC_RESPONSES_4XX);
+	trace_end(m_options.trace, "", m_responses.code(error), 0);
+	ec = make_error_code(HttpStatus::HTTP_ERR_CLOSED_CONNECTION);
+}
+
+void HttpServer::count_request(
+			const Connection &conn,
+			const RequestHandler &rh,
+			size_t sent,
+			uint64_t timestamp,
+			uint64_t started,
+			uint64_t finished
+		)
+{
+	metric_observe(METRIC_REQUEST_TIME, finished - started);
+	metric_add(METRIC_REQUESTS);
+	metric_add(METRIC_BYTES_SENT, sent);
+	int status = rh.status();
+	if (status >= 200 && status < 600)
+		metric_add(static_cast<MetricCounter>(METRIC_RESPONSES_2XX + status / 100 - 2));
+	if (m_accessLog)
+		log_access(*m_accessLog, conn, rh, sent, timestamp, started);
+}
+
+uint64_t HttpServer::access_timestamp() const
+{
+	return m_accessLog ? clock_ns(CLOCK_REALTIME) : 0;
+}
+
+// whether the comma separated list holds the token, case-insensitive
+static bool has_token(std::string_view list, std::string_view token)
+{
+	while (!list.empty())
+	{
+		size_t comma = list.find(',');
+		std::string_view item = trim(list.substr(0, comma));
+		if (item.size() == token.size() && strncasecmp(item.data(), token.data(), token.size()) == 0)
+			return true;
+		list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
 	}
+	return false;
+}
+
+bool HttpServer::upgrade(const Connection &conn, const RequestHandler &rh, std::string_view data)
+{
+	const Request &request = rh.request();
+	const std::string *protocols = request.field("Upgrade");
+	const std::string *settings = request.field("HTTP2-Settings");
+	std::string payload;
+	// a request with a body would have to be read before the protocol changes
+	if (protocols == nullptr || settings == nullptr || !has_token(*protocols, "h2c")
+		|| (request.cmd != GET && request.cmd != HEAD) || !h2_settings_payload(*settings, payload))
+		return false;
+	std::error_code ec;
+	send_all(conn.sockfd, H2_SWITCHING_PROTOCOLS, strlen(H2_SWITCHING_PROTOCOLS), ec);
+	if (ec.value()) {
+		LOG_E("%s\n", ec.message().c_str());
+		return true;
+	}
+	// the request is answered on stream 1, anything after it is the client preface
+	Http2Session session(*this, conn);
+	session.run_upgrade(rh, payload, data, ec);
+	return true;
+}
+
+void HttpServer::reject(const Connection &conn)
+{
+	// a request already sent is read first, closing with unread data resets the connection
+	// and the client might not get to see the answer
+	char discard[4096];
+	for (int i = 0; i < 4 && ::recv(conn.sockfd, discard, sizeof(discard), MSG_DONTWAIT) > 0; ++i)
+		;
+	std::string_view response = m_responses.get(make_error_code(HttpStatus::HTTP_ERR_SERVICE_UNAVAILABLE), false);
+	::send(conn.sockfd, response.data(), response.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+	::shutdown(conn.sockfd, SHUT_WR);
+	::close(conn.sockfd);
 }
 
 }
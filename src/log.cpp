@@ -0,0 +1,136 @@
+#include "log.hpp"
+#include <chrono>
+
+namespace http
+{
+
+char *LogRing::reserve(size_t size)
+{
+    if (size > LOG_RING_SIZE / 2)
+        return nullptr;
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    uint64_t tail = m_tail.load(std::memory_order_acquire);
+    // a record never wraps, the rest of the ring is skipped instead
+    size_t pos = head & (LOG_RING_SIZE - 1);
+    size_t pad = pos + size > LOG_RING_SIZE ? LOG_RING_SIZE - pos : 0;
+    if (head + pad + size - tail > LOG_RING_SIZE)
+        return nullptr;
+    if (pad >= sizeof(LogRecord)) {
+        LogRecord *padding = reinterpret_cast<LogRecord *>(m_data + pos);
+        padding->size = pad;
+        padding->format = nullptr;
+    }
+    m_reserved = head + pad + size;
+    return m_data + ((head + pad) & (LOG_RING_SIZE - 1));
+}
+
+void LogRing::commit()
+{
+    m_head.store(m_reserved, std::memory_order_release);
+}
+
+// closes the ring of a thread when the thread exits
+struct LogRingHolder
+{
+    std::shared_ptr<LogRing> ring;
+
+    ~LogRingHolder()
+    {
+        if (ring)
+            ring->close();
+    }
+};
+
+static tslogger::LogLevel to_tslogger(uint32_t level)
+{
+    switch (level)
+    {
+    case LOG_LEVEL_DEBUG:
+        return tslogger::DEBUG;
+    case LOG_LEVEL_INFO:
+        return tslogger::INFO;
+    case LOG_LEVEL_WARNING:
+        return tslogger::WARNING;
+    default:
+        return tslogger::ERROR;
+    }
+}
+
+AsyncLog::AsyncLog()
+: m_ringsMutex{},
+  m_rings{},
+  m_wakeMutex{},
+  m_wake{},
+  m_urgent{false},
+  m_running{false},
+  m_dropped{0}
+{}
+
+AsyncLog &AsyncLog::instance()
+{
+    static AsyncLog log;
+    return log;
+}
+
+LogRing *AsyncLog::thread_ring()
+{
+    thread_local LogRingHolder holder;
+    if (!holder.ring) {
+        holder.ring = std::make_shared<LogRing>();
+        std::lock_guard lg(m_ringsMutex);
+        m_rings.push_back(holder.ring);
+    }
+    return holder.ring.get();
+}
+
+void AsyncLog::drain(tslogger::Logger &sink)
+{
+    std::vector<std::shared_ptr<LogRing>> rings;
+    {
+        std::lock_guard lg(m_ringsMutex);
+        rings = m_rings;
+    }
+    char line[LOG_LINE_SIZE];
+    for (const std::shared_ptr<LogRing> &ring : rings)
+    {
+        // closed is read first, a record committed before the close is still drained
+        bool closed = ring->closed();
+        ring->consume([&sink, &line](const LogRecord &record, const char *args) {
+            record.format(record.fmt, args, line, sizeof(line));
+            sink.log(to_tslogger(record.level), "%s", line);
+        });
+        if (closed) {
+            std::lock_guard lg(m_ringsMutex);
+            std::erase(m_rings, ring);
+        }
+    }
+
+    static uint64_t reported = 0;
+    uint64_t dropped = m_dropped;
+    if (dropped != reported) {
+        sink.log(tslogger::WARNING, "%lu log records dropped, the rings were full\n", (unsigned long)(dropped - reported));
+        reported = dropped;
+    }
+}
+
+void AsyncLog::run(tslogger::Logger &sink, tslogger::Handler &handler, std::stop_token st)
+{
+    m_running = true;
+    while (!st.stop_requested())
+    {
+        {
+            std::unique_lock ul(m_wakeMutex);
+            m_wake.wait_for(ul, st, std::chrono::milliseconds(LOG_DRAIN_INTERVAL_MS),
+                            [this]{ return m_urgent.load(); });
+            m_urgent = false;
+        }
+        drain(sink);
+        handler.process();
+    }
+    // records written from now on are not drained any more
+    m_running = false;
+    drain(sink);
+    handler.process();
+}
+
+}// namespace http
@@ -11,6 +11,8 @@ using namespace tslogger;
 using namespace http;
 
 static HttpServer *serverPtr = nullptr;
+static volatile sig_atomic_t reloadRequested = 0;
+static const unsigned int DRAIN_TIMEOUT_MS = 30000; // connections still busy after a SIGTERM are cut then
 
 static void stop_server(void *obj)
 {
@@ -27,6 +29,19 @@ static void signal_handler(int signo)
             exit(0);
         stop_server(serverPtr);
     }
+    else if (signo == SIGTERM)
+    {
+        if (serverPtr == nullptr)
+            exit(0);
+        serverPtr->drain();
+    }
+    else if (signo == SIGHUP)
+    {
+        // the accept loop does the reload
+        reloadRequested = 1;
+        if (serverPtr)
+            serverPtr->wake();
+    }
 }
 
 int main()
@@ -41,6 +56,21 @@ int main()
         exit(1);
     }
 
+    if (signal(SIGTERM, signal_handler) == SIG_ERR)
+    {
+        std::cerr << "Unable to set SIGTERM handler\n";
+        exit(1);
+    }
+
+    if (signal(SIGHUP, signal_handler) == SIG_ERR)
+    {
+        std::cerr << "Unable to set SIGHUP handler\n";
+        exit(1);
+    }
+
+    // a peer closing the connection in the middle of sendfile must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
     Handler logHandler(root, DEBUG, std::clog, ec);
     if (ec.value())
     {
@@ -48,34 +78,93 @@ int main()
         exit(1);
     }
 
-    std::jthread handlerThread([&](){
-        while(true) {
-            logHandler.process();
-        }
-    });
-    handlerThread.detach();
-
     Logger logger(
         logHandler.get_queue_ptr(),
         logFileName,
         FLAGS_OUTPUT_TO_ALL
     );
 
+    // formats deferred log records and feeds the handler, sleeps between batches
+    std::jthread logThread([&](std::stop_token st){
+        AsyncLog::instance().run(logger, logHandler, st);
+    });
+
+#ifdef SHS_EMBEDDED_ASSETS
+    // the site is compiled in, see SHS_EMBED_DIR in CMakeLists.txt
+    EmbeddedSource embedded(EMBEDDED_ASSETS);
+    HttpServer server(
+                    embedded,
+                    8080,
+                    true,
+                    10,
+                    true,
+                    ec
+                );
+#else
     HttpServer server(
                     "/var/www/embedded.net.ua",
                     8080,
                     true,
                     10,
-                    logHandler,
-                    logFileName,
                     true,
                     ec
                 );
+#endif
     if (ec.value()) {
         logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, ec.message().c_str());
         exit(1);
     }
 
+    // clients may keep files but have to revalidate them with ETag/Last-Modified
+    server.options().cacheControl = "no-cache";
+    // metrics and traces tell about the requests of others, they are answered on the Unix
+    // socket below only, e.g. curl --unix-socket /run/simple-http-server.sock localhost/metrics
+    server.options().metricsPath = "/metrics";
+    // one request in a thousand and every request over 50 ms, load the JSON into chrome://tracing
+    server.options().tracePath = "/debug/trace";
+    server.options().trace.sampleEvery = 1000;
+    server.options().trace.slowNs = 50000000;
+
+    // per client address, bursts of page loads pass, crawlers are slowed down to the rates
+    RateLimitOptions limits;
+    limits.connectionsPerSecond = 20;
+    limits.connectionBurst = 50;
+    limits.requestsPerSecond = 100;
+    limits.requestBurst = 200;
+    server.rate_limiter().configure(limits);
+
+    // the proxy on this host connects here, without the loopback TCP stack
+    server.listen_unix("/run/simple-http-server.sock", 0660, ec);
+    if (ec.value()) {
+        logger.log(ERROR, "%s:%d unix socket: %s\n", __FILE__, __LINE__, ec.message().c_str());
+        ec.clear();
+    }
+
+    // the thread limit follows the load, within what the CPUs and memory of the container allow
+    server.autosize(SizingOptions());
+
+    server.access_log(root, ec);
+    if (ec.value()) {
+        logger.log(ERROR, "%s:%d access log: %s\n", __FILE__, __LINE__, ec.message().c_str());
+        ec.clear();
+    }
+
+    // a deploy starts the new binary while the old one runs, the new one takes the listening
+    // socket over once its cache is warm, and the old one drains and exits
+    server.warm_up(ec);
+    if (ec.value()) {
+        logger.log(ERROR, "%s:%d warm-up: %s\n", __FILE__, __LINE__, ec.message().c_str());
+        ec.clear();
+    }
+    if (server.taken_over()) {
+        server.confirm_take_over(ec);
+        if (ec.value()) {
+            logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, ec.message().c_str());
+            ec.clear();
+        }
+    }
+    server.offer_handoff();
+
     serverPtr = &server;
 
     // this is a thread to join all client threads with closed connections
@@ -94,10 +183,21 @@ int main()
 
     while (server.is_running())
     {
+        if (reloadRequested) {
+            reloadRequested = 0;
+            ec.clear();
+            server.reload(ec);
+            if (ec.value())
+                logger.log(ERROR, "%s:%d reload failed: %s\n", __FILE__, __LINE__, ec.message().c_str());
+            else
+                logger << "Site reloaded\n";
+        }
         Connection conn;
         logger << "Main thread, run accept()\n";
         ec.clear();
         server.accept(conn, ec);
+        if (ec == make_error_code(HttpStatus::HTTP_ERR_INTERRUPTED))
+            continue;
         if (ec.value()) {
             logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, ec.message().c_str());
             continue;
@@ -105,6 +205,16 @@ int main()
         server.new_thread(std::move(conn));
     }
 
+    if (server.is_draining()) {
+        logger << "Draining connections\n";
+        if (!server.wait_drained(DRAIN_TIMEOUT_MS))
+            logger << "Connections are still open after the drain timeout\n";
+    }
+
+    // exit() does not run the destructor of the server
+    server.stop_access_log();
     logger << "Program terminated\n";
+    logThread.request_stop();
+    logThread.join();
     exit(0);
 }
@@ -0,0 +1,233 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace http
+{
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} COUNTERS[METRIC_COUNTER_COUNT] = {
+    {"shs_connections_opened_total", "Accepted connections"},
+    {"shs_connections_closed_total", "Closed connections"},
+    {"shs_connections_rejected_total", "Connections answered with 503, the admission queue was full"},
+    {"shs_connections_shed_total", "Connections answered with 503 after queueing for too long"},
+    {"shs_connections_rate_limited_total", "Connections closed, the client was over its connection rate"},
+    {"shs_requests_rate_limited_total", "Requests answered with 429, the client was over its request rate"},
+    {"shs_requests_total", "Handled requests"},
+    {"shs_responses_2xx_total", "Responses with a 2xx status"},
+    {"shs_responses_3xx_total", "Responses with a 3xx status"},
+    {"shs_responses_4xx_total", "Responses with a 4xx status"},
+    {"shs_responses_5xx_total", "Responses with a 5xx status"},
+    {"shs_received_bytes_total", "Bytes received from clients"},
+    {"shs_sent_bytes_total", "Bytes sent to clients"},
+    {"shs_file_cache_hits_total", "File cache lookups answered from the cache"},
+    {"shs_file_cache_misses_total", "File cache lookups that loaded the file"},
+    {"shs_compressions_total", "Files deflated"},
+    {"shs_tcp_segments_sent_total", "TCP segments sent on closed connections"},
+    {"shs_tcp_retransmits_total", "TCP segments retransmitted on closed connections"},
+    {"shs_tcp_fastopen_total", "Connections opened with TCP Fast Open"},
+    {"shs_http2_connections_total", "Connections served with HTTP/2"},
+    {"shs_http2_streams_total", "HTTP/2 streams answered"},
+    {"shs_file_reads_total", "File ranges read into the page cache off the connection threads"},
+    {"shs_file_reads_done_total", "File ranges read off the connection threads and done"},
+    {"shs_file_reads_inline_total", "File ranges left to the connection thread, the read queue was full"},
+};
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} HISTOGRAMS[METRIC_HISTOGRAM_COUNT] = {
+    {"shs_request_duration_seconds", "Time from receiving a request to sending the response"},
+    {"shs_compression_duration_seconds", "Time spent deflating a file"},
+    {"shs_send_duration_seconds", "Time spent sending a response"},
+    {"shs_tcp_rtt_seconds", "Smoothed round trip time of closed connections"},
+    {"shs_file_read_duration_seconds", "Time from queueing a file read to having it in the page cache"},
+};
+
+static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+enum {
+    METRIC_FIRST_EXPORTED_BIT = 10, // buckets are exported from 1 us
+    METRIC_LAST_EXPORTED_BIT = 36,  // up to about a minute
+};
+
+// Blocks of all live threads, and the sum of the blocks of the threads that are gone
+class MetricsRegistry
+{
+public:
+    static MetricsRegistry &instance()
+    {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    void add(MetricsBlock *block)
+    {
+        std::lock_guard lg(m_mutex);
+        m_blocks.push_back(block);
+    }
+
+    void retire(MetricsBlock *block)
+    {
+        std::lock_guard lg(m_mutex);
+        std::erase(m_blocks, block);
+        merge(m_retired, *block);
+    }
+
+    void collect(MetricsBlock &out)
+    {
+        std::lock_guard lg(m_mutex);
+        merge(out, m_retired);
+        for (MetricsBlock *block : m_blocks)
+            merge(out, *block);
+    }
+
+private:
+    static void merge(MetricsBlock &to, const MetricsBlock &from)
+    {
+        for (size_t i = 0; i < METRIC_COUNTER_COUNT; ++i)
+            metric_bump(to.counters[i], from.counters[i].load(std::memory_order_relaxed));
+        for (size_t h = 0; h < METRIC_HISTOGRAM_COUNT; ++h)
+        {
+            for (size_t i = 0; i < METRIC_BUCKETS; ++i)
+                metric_bump(to.histograms[h].buckets[i], from.histograms[h].buckets[i].load(std::memory_order_relaxed));
+            metric_bump(to.histograms[h].sum, from.histograms[h].sum.load(std::memory_order_relaxed));
+        }
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<MetricsBlock *> m_blocks;
+    MetricsBlock m_retired;
+};
+
+MetricsBlock::MetricsBlock()
+{
+    for (std::atomic<uint64_t> &c : counters)
+        c = 0;
+    for (Histogram &h : histograms)
+    {
+        for (std::atomic<uint64_t> &b : h.buckets)
+            b = 0;
+        h.sum = 0;
+    }
+}
+
+// registers the block of a thread on first use and folds it into the retired sums on exit
+struct MetricsHolder
+{
+    std::unique_ptr<MetricsBlock> block;
+
+    MetricsHolder()
+    : block{std::make_unique<MetricsBlock>()}
+    {
+        MetricsRegistry::instance().add(block.get());
+    }
+
+    ~MetricsHolder()
+    {
+        MetricsRegistry::instance().retire(block.get());
+    }
+};
+
+MetricsBlock &thread_metrics()
+{
+    thread_local MetricsHolder holder;
+    return *holder.block;
+}
+
+// exclusive upper bound of a bucket
+static uint64_t bucket_limit(size_t i)
+{
+    if (i < METRIC_SUB_BUCKETS)
+        return i + 1;
+    size_t shift = i / METRIC_SUB_BUCKETS - 1;
+    return uint64_t(METRIC_SUB_BUCKETS + i % METRIC_SUB_BUCKETS + 1) << shift;
+}
+
+static void append(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string &out, const char *fmt, ...)
+{
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    out.append(line, len < static_cast<int>(sizeof(line)) ? len : sizeof(line) - 1);
+}
+
+uint64_t metric_total(MetricCounter counter)
+{
+    std::unique_ptr<MetricsBlock> total = std::make_unique<MetricsBlock>();
+    MetricsRegistry::instance().collect(*total);
+    return total->counters[counter];
+}
+
+void render_metrics(std::string &out)
+{
+    std::unique_ptr<MetricsBlock> total = std::make_unique<MetricsBlock>();
+    MetricsRegistry::instance().collect(*total);
+
+    for (size_t i = 0; i < METRIC_COUNTER_COUNT; ++i)
+    {
+        append(out, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", COUNTERS[i].name, COUNTERS[i].help,
+               COUNTERS[i].name, COUNTERS[i].name, (unsigned long)total->counters[i].load());
+    }
+    append(out, "# HELP shs_connections_active Open connections\n# TYPE shs_connections_active gauge\n"
+                "shs_connections_active %lu\n",
+           (unsigned long)(total->counters[METRIC_CONNECTIONS_OPENED] - total->counters[METRIC_CONNECTIONS_CLOSED]));
+    append(out, "# HELP shs_file_io_queue_depth File reads queued or in progress\n# TYPE shs_file_io_queue_depth gauge\n"
+                "shs_file_io_queue_depth %lu\n",
+           (unsigned long)(total->counters[METRIC_FILE_READS] - std::min(total->counters[METRIC_FILE_READS].load(),
+                                                                          total->counters[METRIC_FILE_READS_DONE].load())));
+
+    for (size_t h = 0; h < METRIC_HISTOGRAM_COUNT; ++h)
+    {
+        const MetricsBlock::Histogram &hist = total->histograms[h];
+        const char *name = HISTOGRAMS[h].name;
+        uint64_t count = 0;
+        for (const std::atomic<uint64_t> &b : hist.buckets)
+            count += b;
+
+        // the fine buckets are summed up to powers of two, which they never straddle
+        append(out, "# HELP %s %s\n# TYPE %s histogram\n", name, HISTOGRAMS[h].help, name);
+        uint64_t cumulative = 0;
+        size_t i = 0;
+        for (unsigned bit = METRIC_FIRST_EXPORTED_BIT; bit <= METRIC_LAST_EXPORTED_BIT; ++bit)
+        {
+            for (; i < METRIC_BUCKETS && bucket_limit(i) <= (uint64_t(1) << bit); ++i)
+                cumulative += hist.buckets[i];
+            append(out, "%s_bucket{le=\"%.9g\"} %lu\n", name, (uint64_t(1) << bit) / 1e9, (unsigned long)cumulative);
+        }
+        append(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, (unsigned long)count);
+        append(out, "%s_sum %.9f\n%s_count %lu\n", name, hist.sum / 1e9, name, (unsigned long)count);
+
+        // percentiles straight from the fine buckets, no query language needed
+        append(out, "# HELP %s_quantile Upper bound of the bucket holding the quantile\n"
+                    "# TYPE %s_quantile gauge\n", name, name);
+        for (double q : QUANTILES)
+        {
+            uint64_t rank = static_cast<uint64_t>(q * count);
+            uint64_t seen = 0;
+            size_t b = 0;
+            for (; b < METRIC_BUCKETS - 1; ++b)
+            {
+                seen += hist.buckets[b];
+                if (seen > rank)
+                    break;
+            }
+            append(out, "%s_quantile{quantile=\"%g\"} %.9f\n", name, q, count ? bucket_limit(b) / 1e9 : 0.0);
+        }
+    }
+}
+
+}// namespace http
@@ -0,0 +1,45 @@
+#include "mime.hpp"
+#include <cstring>
+
+namespace http
+{
+
+const char *content_type2str(ContentType t)
+{
+    switch(t)
+    {
+    case TEXT_HTML:
+        return "text/html";
+    case TEXT_CSS:
+        return "text/css";
+    case TEXT_JS:
+        return "text/javascript";
+    case IMAGE_PNG:
+        return "image/png";
+    case IMAGE_JPEG:
+        return "image/jpeg";
+    case IMAGE_ICON:
+        return "image/vnd.microsoft.icon";
+    default:
+        return "application/octet-stream";
+    }
+}
+
+ContentType file_extention2content_type(const char *extension)
+{
+    static const struct {
+        const char *ext;
+        ContentType type;
+    } ctm[] = {
+        {".html",TEXT_HTML}, {".css",TEXT_CSS}, {".js",TEXT_JS},
+        {".png",IMAGE_PNG}, {".jpeg",IMAGE_JPEG}, {".jpg",IMAGE_JPEG}, {".ico",IMAGE_ICON}
+    };
+    for (const auto &item : ctm)
+    {
+        if (strcmp(item.ext, extension) == 0)
+            return item.type;
+    }
+    return UNKNOWN;
+}
+
+}// namespace http
@@ -0,0 +1,272 @@
+#include "path_resolver.hpp"
+#include "http_error.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+namespace http
+{
+
+static int hex2int(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+void normalize_uri(std::string &uri, std::error_code &ec)
+{
+    size_t n = uri.find_first_of("?#");
+    if (n == std::string::npos)
+        n = uri.size();
+
+    // decode %XX escapes, the output never gets longer than the input
+    size_t w = 0;
+    for (size_t r = 0; r < n; ++r, ++w)
+    {
+        char c = uri[r];
+        if (c == '%') {
+            int hi = r + 2 < n ? hex2int(uri[r + 1]) : -1;
+            int lo = hi != -1 ? hex2int(uri[r + 2]) : -1;
+            if (lo == -1 || (hi == 0 && lo == 0)) {
+                ec = make_error_code(HttpStatus::HTTP_ERR_BAD_REQUEST);
+                return;
+            }
+            c = static_cast<char>(hi << 4 | lo);
+            r += 2;
+        }
+        uri[w] = c;
+    }
+    n = w;
+
+    // rebuild the path segment by segment
+    w = 0;
+    for (size_t r = 0; r < n;)
+    {
+        while (r < n && uri[r] == '/')
+            ++r;
+        size_t start = r;
+        while (r < n && uri[r] != '/')
+            ++r;
+        size_t len = r - start;
+        if (len == 0 || (len == 1 && uri[start] == '.'))
+            continue;
+        if (len == 2 && uri[start] == '.' && uri[start + 1] == '.') {
+            if (w == 0) {
+                ec = make_error_code(HttpStatus::HTTP_ERR_FORBIDDEN);
+                return;
+            }
+            size_t pos = uri.rfind('/', w - 1);
+            w = pos == std::string::npos ? 0 : pos;
+            continue;
+        }
+        if (w > 0)
+            uri[w++] = '/';
+        memmove(&uri[w], &uri[start], len);
+        w += len;
+    }
+    uri.resize(w);
+}
+
+size_t cached_descriptors_limit()
+{
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == RLIM_INFINITY)
+        return PATH_RESOLVER_CAPACITY * 2;
+    return limit.rlim_cur / 2;
+}
+
+PathResolver::PathResolver(const std::filesystem::path &root, size_t capacity)
+: m_root{root},
+  // FileCache keeps as many, see cached_descriptors_limit()
+  m_capacity{std::max<size_t>(1, std::min(capacity, cached_descriptors_limit() / 2))},
+  m_rootDir{},
+  m_openat2{false},
+  m_generation{0},
+  m_mutex{},
+  m_lru{},
+  m_files{}
+{}
+
+PathResolver::~PathResolver()
+{
+    stop();
+}
+
+void PathResolver::start(std::error_code &ec)
+{
+    reload(ec);
+    if (ec.value())
+        return;
+    // kernels older than 5.6 answer ENOSYS, container seccomp profiles often EPERM
+    int fd = openat2_beneath(m_rootDir.load()->fd, ".", O_PATH | O_DIRECTORY);
+    m_openat2 = fd != -1;
+    if (fd != -1)
+        ::close(fd);
+    else
+        LOG_W("openat2 is not available, symlinks below %s are not followed\n", m_root.c_str());
+}
+
+void PathResolver::stop()
+{
+    clear();
+    m_rootDir.store(nullptr);
+}
+
+void PathResolver::reload(std::error_code &ec)
+{
+    std::shared_ptr<OpenFile> dir = std::make_shared<OpenFile>();
+    dir->fd = ::open(m_root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dir->fd == -1) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_NOT_DIRECTORY);
+        return;
+    }
+    dir->path = m_root.string();
+    // lookups under way finish below the old root, which is closed with its last user
+    m_rootDir.store(dir);
+    clear();
+}
+
+int PathResolver::openat2_beneath(int rootFd, const char *path, int flags)
+{
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = flags | O_CLOEXEC | O_NOCTTY;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    return static_cast<int>(::syscall(SYS_openat2, rootFd, path, &how, sizeof(how)));
+}
+
+// normalize_uri() has already removed ".." segments, so only symlinks could lead out
+// of the root; the path is opened one directory at a time and none is followed
+int PathResolver::walk_beneath(int rootFd, const char *path, int flags)
+{
+    int dirFd = rootFd;
+    for (const char *slash; (slash = strchr(path, '/')) != nullptr; path = slash + 1)
+    {
+        std::string name(path, slash - path);
+        int fd = ::openat(dirFd, name.c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int error = errno;
+        if (dirFd != rootFd)
+            ::close(dirFd);
+        if (fd == -1) {
+            // a symlink opened with O_PATH | O_NOFOLLOW is not a directory
+            errno = error == ENOTDIR ? ELOOP : error;
+            return -1;
+        }
+        dirFd = fd;
+    }
+    int fd = ::openat(dirFd, path, flags | O_NOFOLLOW | O_CLOEXEC | O_NOCTTY);
+    int error = errno;
+    if (dirFd != rootFd)
+        ::close(dirFd);
+    errno = error;
+    return fd;
+}
+
+int PathResolver::open_beneath(const char *path)
+{
+    // O_NONBLOCK, opening a FIFO for reading would otherwise wait for a writer;
+    // it has no effect on the reads of regular files
+    OpenFilePtr root = m_rootDir.load();
+    if (!root) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (m_openat2)
+        return openat2_beneath(root->fd, path, O_RDONLY | O_NONBLOCK);
+    return walk_beneath(root->fd, path, O_RDONLY | O_NONBLOCK);
+}
+
+OpenFilePtr PathResolver::open(const std::string &path, bool keep, std::error_code &ec)
+{
+    unsigned long generation;
+    {
+        std::lock_guard lg(m_mutex);
+        generation = m_generation;
+        auto iter = m_files.find(path);
+        if (iter != m_files.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, iter->second);
+            return *iter->second;
+        }
+    }
+
+    std::shared_ptr<OpenFile> file = std::make_shared<OpenFile>();
+    file->fd = open_beneath(path.empty() ? "." : path.c_str());
+    if (file->fd == -1) {
+        switch (errno)
+        {
+        case EXDEV:
+        case ELOOP:
+        case EACCES:
+        case EPERM:
+            ec = make_error_code(HttpStatus::HTTP_ERR_FORBIDDEN);
+            break;
+        default:
+            ec = make_error_code(HttpStatus::HTTP_ERR_FILE_NOT_FOUND);
+            break;
+        }
+        return nullptr;
+    }
+    if (::statx(file->fd, "", AT_EMPTY_PATH, STATX_BASIC_STATS, &file->stx) == -1) {
+        ec = make_system_error(errno);
+        return nullptr;
+    }
+    file->path = path;
+    if (!keep)
+        return file;
+
+    std::lock_guard lg(m_mutex);
+    // the file changed while it was being opened, don't keep the descriptor
+    if (generation != m_generation)
+        return file;
+    auto iter = m_files.find(path);
+    if (iter != m_files.end())
+        return *iter->second;
+    m_lru.push_front(file);
+    m_files[path] = m_lru.begin();
+    if (m_files.size() > m_capacity) {
+        m_files.erase(m_lru.back()->path);
+        m_lru.pop_back();
+    }
+    return file;
+}
+
+void PathResolver::invalidate(const std::string &path, bool recursive)
+{
+    std::lock_guard lg(m_mutex);
+    ++m_generation;
+    if (!recursive) {
+        auto iter = m_files.find(path);
+        if (iter != m_files.end()) {
+            m_lru.erase(iter->second);
+            m_files.erase(iter);
+        }
+        return;
+    }
+    std::string prefix = path + "/";
+    for (auto iter = m_files.begin(); iter != m_files.end();)
+    {
+        if (path.empty() || iter->first == path || iter->first.starts_with(prefix)) {
+            m_lru.erase(iter->second);
+            iter = m_files.erase(iter);
+        }
+        else {
+            ++iter;
+        }
+    }
+}
+
+void PathResolver::clear()
+{
+    invalidate("", true);
+}
+
+}// namespace http
@@ -0,0 +1,146 @@
+#include "rate_limit.hpp"
+#include <algorithm>
+#include <netinet/in.h>
+#include "metrics.hpp"
+
+namespace http
+{
+
+static const uint64_t IPV4_MAPPED = 0x0000ffff00000000ULL; // ::ffff:0:0/96
+
+static uint64_t interval_ns(unsigned perSecond)
+{
+    return perSecond ? 1000000000ULL / perSecond : 0;
+}
+
+// clears the bits past prefix in the 64-bit half of an IPv6 address starting at bit offset
+static uint64_t prefix_mask(unsigned prefix, unsigned offset)
+{
+    if (prefix <= offset)
+        return 0;
+    if (prefix >= offset + 64)
+        return ~0ULL;
+    return ~0ULL << (64 - (prefix - offset));
+}
+
+static uint32_t ipv4_mask(unsigned prefix)
+{
+    return prefix ? ~0U << (32 - prefix) : 0;
+}
+
+static uint64_t load_be64(const unsigned char *p)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+// splitmix64 finalizer, the top bits pick the shard and the low ones the slot
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+RateLimiter::RateLimiter()
+: m_shards{},
+  m_connectionInterval{0},
+  m_connectionTolerance{0},
+  m_requestInterval{0},
+  m_requestTolerance{0},
+  m_ipv4Prefix{32},
+  m_ipv6Prefix{64}
+{}
+
+void RateLimiter::configure(const RateLimitOptions &options)
+{
+    m_connectionInterval = interval_ns(options.connectionsPerSecond);
+    m_connectionTolerance = m_connectionInterval * (options.connectionBurst ? options.connectionBurst - 1 : 0);
+    m_requestInterval = interval_ns(options.requestsPerSecond);
+    m_requestTolerance = m_requestInterval * (options.requestBurst ? options.requestBurst - 1 : 0);
+    m_ipv4Prefix = options.ipv4Prefix > 32 ? 32 : options.ipv4Prefix;
+    m_ipv6Prefix = options.ipv6Prefix > 128 ? 128 : options.ipv6Prefix;
+    if (enabled() && !m_shards)
+        m_shards = std::make_unique<Shard[]>(RATE_LIMIT_SHARDS);
+}
+
+RateLimiter::Key RateLimiter::key(const Connection &conn) const
+{
+    if (conn.ipv4) {
+        uint32_t addr = ntohl(conn.client.addr.sin_addr.s_addr);
+        return {0, IPV4_MAPPED | (addr & ipv4_mask(m_ipv4Prefix))};
+    }
+    const unsigned char *bytes = conn.client.addr6.sin6_addr.s6_addr;
+    Key k{load_be64(bytes), load_be64(bytes + 8)};
+    if (k.hi == 0 && (k.lo >> 32) == 0xffff) {
+        uint32_t addr = static_cast<uint32_t>(k.lo);
+        k.lo = IPV4_MAPPED | (addr & ipv4_mask(m_ipv4Prefix));
+        return k;
+    }
+    k.hi &= prefix_mask(m_ipv6Prefix, 0);
+    k.lo &= prefix_mask(m_ipv6Prefix, 64);
+    return k;
+}
+
+bool RateLimiter::allow_connection(const Connection &conn)
+{
+    return m_connectionInterval == 0 || conn.local() || allow(conn, false);
+}
+
+bool RateLimiter::allow_request(const Connection &conn)
+{
+    return m_requestInterval == 0 || conn.local() || allow(conn, true);
+}
+
+bool RateLimiter::allow(const Connection &conn, bool request)
+{
+    Key k = key(conn);
+    uint64_t hash = mix(k.hi * 0x9e3779b97f4a7c15ULL ^ k.lo);
+    Shard &shard = m_shards[hash >> 58];
+    size_t home = hash & (RATE_LIMIT_SLOTS - 1);
+    uint64_t now = metric_now();
+
+    std::lock_guard lg(shard.mutex);
+    Slot *found = nullptr;
+    Slot *free = nullptr;
+    Slot *oldest = nullptr;
+    for (size_t i = 0; i < RATE_LIMIT_PROBES; ++i)
+    {
+        Slot &slot = shard.slots[(home + i) & (RATE_LIMIT_SLOTS - 1)];
+        if (slot.key.hi == k.hi && slot.key.lo == k.lo) {
+            found = &slot;
+            break;
+        }
+        uint64_t full = slot.connectionsFull > slot.requestsFull ? slot.connectionsFull : slot.requestsFull;
+        if (full <= now) {
+            if (free == nullptr)
+                free = &slot;
+        }
+        else if (oldest == nullptr || full < std::max(oldest->connectionsFull, oldest->requestsFull)) {
+            oldest = &slot;
+        }
+    }
+    if (found == nullptr) {
+        // a slot with full buckets holds no state, one of an active client loses it
+        found = free ? free : oldest;
+        found->key = k;
+        found->connectionsFull = 0;
+        found->requestsFull = 0;
+    }
+
+    uint64_t &full = request ? found->requestsFull : found->connectionsFull;
+    uint64_t interval = request ? m_requestInterval : m_connectionInterval;
+    uint64_t tolerance = request ? m_requestTolerance : m_connectionTolerance;
+    uint64_t start = full > now ? full : now;
+    if (start - now > tolerance)
+        return false;
+    full = start + interval;
+    return true;
+}
+
+}// namespace http
@@ -0,0 +1,215 @@
+#include "sizing.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sched.h>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "metrics.hpp"
+
+namespace http
+{
+
+static const char *CGROUP_ROOT = "/sys/fs/cgroup";
+static const double SIZING_CPU_HIGH = 0.9;     // the CPUs are saturated above it
+static const double SIZING_BLOCKED_HIGH = 0.5; // busy threads mostly wait above it
+
+// the cgroup paths of the process from /proc/self/cgroup, empty where there is none
+struct CgroupPaths
+{
+    std::string unified; // cgroup v2
+    std::string cpu;     // cgroup v1 controllers
+    std::string memory;
+};
+
+static bool has_controller(const std::string &controllers, const char *name)
+{
+    size_t begin = 0;
+    while (begin <= controllers.size())
+    {
+        size_t end = controllers.find(',', begin);
+        if (end == std::string::npos)
+            end = controllers.size();
+        if (controllers.compare(begin, end - begin, name) == 0)
+            return true;
+        begin = end + 1;
+    }
+    return false;
+}
+
+static CgroupPaths own_cgroups()
+{
+    CgroupPaths paths;
+    std::ifstream in("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(in, line))
+    {
+        // hierarchy-ID:controller-list:cgroup-path
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos)
+            continue;
+        std::string controllers = line.substr(first + 1, second - first - 1);
+        std::string path = line.substr(second + 1);
+        if (line.compare(0, first, "0") == 0 && controllers.empty())
+            paths.unified = path;
+        else if (has_controller(controllers, "cpu"))
+            paths.cpu = path;
+        else if (has_controller(controllers, "memory"))
+            paths.memory = path;
+    }
+    return paths;
+}
+
+// calls read with the directories of the cgroup and its parents up to the root of the mount,
+// which is the cgroup itself in a container with a cgroup namespace
+template <typename Read>
+static void walk_cgroups(const std::string &mount, std::string path, Read read)
+{
+    while (true)
+    {
+        read(mount + path);
+        if (path.empty() || path == "/")
+            break;
+        path = path.substr(0, path.rfind('/'));
+    }
+}
+
+static bool read_value(const std::string &file, std::string &value)
+{
+    std::ifstream in(file);
+    return bool(in >> value);
+}
+
+// v2 "max" or "<quota> <period>", v1 cfs_quota_us -1 or quota, 0 without a quota
+static double read_cpu_quota(const std::string &dir, bool unified)
+{
+    std::string quota, period;
+    if (unified) {
+        std::ifstream in(dir + "/cpu.max");
+        if (!(in >> quota >> period))
+            return 0;
+    }
+    else if (!read_value(dir + "/cpu.cfs_quota_us", quota) || !read_value(dir + "/cpu.cfs_period_us", period)) {
+        return 0;
+    }
+    if (quota == "max" || quota[0] == '-' || std::stod(period) <= 0)
+        return 0;
+    return std::stod(quota) / std::stod(period);
+}
+
+// v2 "max" or bytes, v1 bytes with a huge value for no limit, 0 without a limit
+static unsigned long long read_memory_limit(const std::string &dir, bool unified)
+{
+    std::string value;
+    if (!read_value(dir + (unified ? "/memory.max" : "/memory.limit_in_bytes"), value) || value == "max")
+        return 0;
+    return std::stoull(value);
+}
+
+static uint64_t process_cpu_ns()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t(ru.ru_utime.tv_sec) + ru.ru_stime.tv_sec) * 1000000000
+        + (uint64_t(ru.ru_utime.tv_usec) + ru.ru_stime.tv_usec) * 1000;
+}
+
+ResourceLimits read_resource_limits()
+{
+    ResourceLimits limits;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    limits.cpus = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : (online > 0 ? online : 1);
+    limits.memory = static_cast<unsigned long long>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE);
+
+    // a parent may limit harder than the cgroup itself
+    auto cpu = [&limits](double quota) {
+        if (quota > 0 && quota < limits.cpus)
+            limits.cpus = quota;
+    };
+    auto memory = [&limits](unsigned long long bytes) {
+        if (bytes > 0 && bytes < limits.memory)
+            limits.memory = bytes;
+    };
+    CgroupPaths paths = own_cgroups();
+    if (!paths.unified.empty()) {
+        walk_cgroups(CGROUP_ROOT, paths.unified, [&](const std::string &dir) {
+            cpu(read_cpu_quota(dir, true));
+            memory(read_memory_limit(dir, true));
+        });
+    }
+    // v1 controllers, on hybrid hosts they are there next to an empty v2 hierarchy
+    if (!paths.cpu.empty()) {
+        walk_cgroups(std::string(CGROUP_ROOT) + "/cpu", paths.cpu, [&](const std::string &dir) {
+            cpu(read_cpu_quota(dir, false));
+        });
+    }
+    if (!paths.memory.empty()) {
+        walk_cgroups(std::string(CGROUP_ROOT) + "/memory", paths.memory, [&](const std::string &dir) {
+            memory(read_memory_limit(dir, false));
+        });
+    }
+    return limits;
+}
+
+ThreadSizer::ThreadSizer(const ResourceLimits &limits, const SizingOptions &options, unsigned long threadMemory)
+: m_cpus{limits.cpus > 0 ? limits.cpus : 1},
+  m_minThreads{0},
+  m_maxThreads{0},
+  m_lastWall{metric_now()},
+  m_lastCpu{process_cpu_ns()},
+  m_lastSample{m_lastWall},
+  m_busyThreadNs{0},
+  m_samples{0},
+  m_activeSum{0},
+  m_cpuUtilization{0},
+  m_blockedRatio{0}
+{
+    unsigned cpus = static_cast<unsigned>(std::ceil(m_cpus));
+    unsigned byMemory = static_cast<unsigned>(std::max<unsigned long long>(limits.memory / threadMemory, 1));
+    m_maxThreads = options.maxThreads ? options.maxThreads : std::min(cpus * SIZING_MAX_THREADS_PER_CPU, byMemory);
+    m_minThreads = std::min(options.minThreads ? options.minThreads : cpus, m_maxThreads);
+}
+
+void ThreadSizer::sample(unsigned active)
+{
+    uint64_t now = metric_now();
+    m_busyThreadNs += double(active) * (now - m_lastSample);
+    m_lastSample = now;
+    m_activeSum += active;
+    ++m_samples;
+}
+
+unsigned ThreadSizer::adjust(unsigned current, uint64_t queueDelayNs)
+{
+    uint64_t wall = metric_now();
+    uint64_t cpu = process_cpu_ns();
+    double wallNs = double(wall - m_lastWall);
+    double cpuNs = double(cpu - m_lastCpu);
+    m_cpuUtilization = wallNs > 0 ? std::min(cpuNs / (wallNs * m_cpus), 1.0) : 0;
+    // busy threads not on a CPU wait for disks or peers
+    m_blockedRatio = m_busyThreadNs > 0 ? std::clamp(1 - cpuNs / m_busyThreadNs, 0.0, 1.0) : 0;
+    double averageActive = m_samples ? double(m_activeSum) / m_samples : 0;
+    m_lastWall = wall;
+    m_lastCpu = cpu;
+    m_busyThreadNs = 0;
+    m_samples = 0;
+    m_activeSum = 0;
+
+    long next = current;
+    if (queueDelayNs > uint64_t(SIZING_QUEUE_DELAY_MS) * 1000000) {
+        if (m_cpuUtilization < SIZING_CPU_HIGH && m_blockedRatio > SIZING_BLOCKED_HIGH)
+            next = current + std::max(1U, current / 2);
+        else if (m_cpuUtilization >= SIZING_CPU_HIGH && m_blockedRatio <= SIZING_BLOCKED_HIGH)
+            next = current - std::max(1U, current / 8);
+    }
+    else if (averageActive < current / 2.0) {
+        next = current - 1;
+    }
+    return static_cast<unsigned>(std::clamp<long>(next, m_minThreads, m_maxThreads));
+}
+
+}// namespace http
@@ -0,0 +1,92 @@
+#include "socket_options.hpp"
+#include <cstddef>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h> // the tcp_info of glibc lacks tcpi_segs_out
+#include "http_error.hpp"
+#include "metrics.hpp"
+
+namespace http
+{
+
+enum {
+    SOCKET_DEFER_ACCEPT_S = 1,       // a client silent after the handshake is accepted after that anyway
+    SOCKET_FASTOPEN_QUEUE = 256,
+    SOCKET_NOTSENT_LOWAT = 16384,
+    SOCKET_COMPACT_SNDBUF = 65536,
+    SOCKET_COMPACT_RCVBUF = 16384,   // a request fits in it
+};
+
+SocketOptions socket_profile(const std::string &name, std::error_code &ec)
+{
+    SocketOptions options;
+    if (name == "default")
+        return options;
+    if (name == "kernel") {
+        options.noDelay = false;
+        options.cork = false;
+        return options;
+    }
+    if (name == "latency" || name == "compact") {
+        options.deferAccept = SOCKET_DEFER_ACCEPT_S;
+        options.fastOpen = SOCKET_FASTOPEN_QUEUE;
+        options.notSentLowat = SOCKET_NOTSENT_LOWAT;
+        if (name == "compact") {
+            options.sendBuffer = SOCKET_COMPACT_SNDBUF;
+            options.receiveBuffer = SOCKET_COMPACT_RCVBUF;
+        }
+        return options;
+    }
+    ec = make_system_error(EINVAL);
+    return options;
+}
+
+static void set_option(int sockfd, int level, int name, int value, std::error_code &ec)
+{
+    if (::setsockopt(sockfd, level, name, &value, sizeof(value)) == -1 && !ec.value())
+        ec = make_system_error(errno);
+}
+
+void apply_listener_options(int sockfd, const SocketOptions &options, std::error_code &ec)
+{
+    // set even when zero, a profile applied before may have turned them on
+    set_option(sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, options.deferAccept, ec);
+    set_option(sockfd, IPPROTO_TCP, TCP_FASTOPEN, options.fastOpen, ec);
+    if (options.receiveBuffer)
+        set_option(sockfd, SOL_SOCKET, SO_RCVBUF, options.receiveBuffer, ec);
+}
+
+void apply_connection_options(int sockfd, const SocketOptions &options, std::error_code &ec)
+{
+    if (options.noDelay)
+        set_option(sockfd, IPPROTO_TCP, TCP_NODELAY, 1, ec);
+    if (options.sendBuffer)
+        set_option(sockfd, SOL_SOCKET, SO_SNDBUF, options.sendBuffer, ec);
+    if (options.receiveBuffer)
+        set_option(sockfd, SOL_SOCKET, SO_RCVBUF, options.receiveBuffer, ec);
+    if (options.notSentLowat)
+        set_option(sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, options.notSentLowat, ec);
+}
+
+void cork_socket(int sockfd, bool on)
+{
+    int value = on;
+    ::setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+}
+
+void observe_tcp_info(int sockfd)
+{
+    // an older kernel fills in less of it
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (::getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1
+        || len < offsetof(struct tcp_info, tcpi_segs_out) + sizeof(info.tcpi_segs_out))
+        return;
+    metric_add(METRIC_TCP_SEGMENTS_SENT, info.tcpi_segs_out);
+    metric_add(METRIC_TCP_RETRANSMITS, info.tcpi_total_retrans);
+    if (info.tcpi_options & TCPI_OPT_SYN_DATA)
+        metric_add(METRIC_TCP_FASTOPEN);
+    metric_observe(METRIC_TCP_RTT, uint64_t(info.tcpi_rtt) * 1000);
+}
+
+}// namespace http
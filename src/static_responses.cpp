@@ -0,0 +1,114 @@
+#include "static_responses.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace http
+{
+
+static const char *ERROR_PAGE_TEMPLATE = "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">"\
+"<html>"\
+"<head>"\
+"\t<title>%s</title>"\
+"</head>"\
+"<body>"\
+"\t<h1>%s</h1>"\
+"\t<p>%s</p>"\
+"</body>"\
+"</html>";
+
+static const char *ERROR_HEADER_TEMPLATE = "HTTP/1.1 %s\r\n"\
+"Server: simple-http-server\r\n"\
+"Content-Length: %zu\r\n"\
+"Content-Type: text/html\r\n"\
+"%s"\
+"\r\n";
+
+static const struct {
+    HttpStatus status;
+    int code;
+} STATUSES[STATIC_RESPONSE_COUNT] = {
+    { HttpStatus::HTTP_ERR_BAD_REQUEST, 400 },
+    { HttpStatus::HTTP_ERR_FORBIDDEN, 403 },
+    { HttpStatus::HTTP_ERR_FILE_NOT_FOUND, 404 },
+    { HttpStatus::HTTP_ERR_REQUEST_TIMEOUT, 408 },
+    { HttpStatus::HTTP_ERR_PAYLOAD_TOO_LARGE, 413 },
+    { HttpStatus::HTTP_ERR_TOO_MANY_REQUESTS, 429 },
+    { HttpStatus::HTTP_ERR_HEADER_FIELDS_TOO_LARGE, 431 },
+    { HttpStatus::HTTP_ERR_INTERNAL_SERVER_ERROR, 500 },
+    { HttpStatus::HTTP_ERR_NOT_IMPLEMENTED, 501 },
+    { HttpStatus::HTTP_ERR_SERVICE_UNAVAILABLE, 503 },
+};
+
+static const size_t INTERNAL_SERVER_ERROR_INDEX = 7;
+
+StaticResponses::StaticResponses()
+: m_responses{}
+{
+    for (size_t i = 0; i < STATIC_RESPONSE_COUNT; ++i)
+    {
+        std::string message = make_error_code(STATUSES[i].status).message();
+        int len = snprintf(nullptr, 0, ERROR_PAGE_TEMPLATE, message.c_str(), message.c_str(), message.c_str());
+        std::string page(len, '\0');
+        snprintf(page.data(), len + 1, ERROR_PAGE_TEMPLATE, message.c_str(), message.c_str(), message.c_str());
+        render(i, page);
+    }
+}
+
+void StaticResponses::render(size_t index, std::string_view page)
+{
+    std::string message = make_error_code(STATUSES[index].status).message();
+    char extra[64] = "";
+    if (STATUSES[index].status == HttpStatus::HTTP_ERR_SERVICE_UNAVAILABLE
+        || STATUSES[index].status == HttpStatus::HTTP_ERR_TOO_MANY_REQUESTS)
+        snprintf(extra, sizeof(extra), "Retry-After: %d\r\nConnection: close\r\n", RETRY_AFTER_SECONDS);
+
+    char header[256];
+    int len = snprintf(header, sizeof(header), ERROR_HEADER_TEMPLATE, message.c_str(), page.size(), extra);
+
+    Response &response = m_responses[index];
+    response.data.reserve(len + page.size());
+    response.data.assign(header, len);
+    response.data.append(page);
+    response.headerSize = len;
+}
+
+void StaticResponses::load(const std::filesystem::path &dir, std::error_code &ec)
+{
+    if (!std::filesystem::is_directory(dir)) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_NOT_DIRECTORY);
+        return;
+    }
+    for (size_t i = 0; i < STATIC_RESPONSE_COUNT; ++i)
+    {
+        std::ifstream ifs(dir / (std::to_string(STATUSES[i].code) + ".html"), std::ios::binary);
+        if (!ifs.is_open())
+            continue;
+        std::ostringstream page;
+        page << ifs.rdbuf();
+        render(i, page.str());
+    }
+}
+
+size_t StaticResponses::index(const std::error_code &ec) const
+{
+    for (size_t i = 0; i < STATIC_RESPONSE_COUNT; ++i)
+    {
+        if (ec == make_error_code(STATUSES[i].status))
+            return i;
+    }
+    return INTERNAL_SERVER_ERROR_INDEX;
+}
+
+std::string_view StaticResponses::get(const std::error_code &ec, bool headOnly) const
+{
+    const Response &response = m_responses[index(ec)];
+    return std::string_view(response.data.data(), headOnly ? response.headerSize : response.data.size());
+}
+
+int StaticResponses::code(const std::error_code &ec) const
+{
+    return STATUSES[index(ec)].code;
+}
+
+}// namespace http
@@ -1,22 +1,39 @@
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <thread>
 #include "tcp_server.hpp"
 #include "http_error.hpp"
 #include "utils.hpp"
-
-using namespace tslogger;
+#include "metrics.hpp"
+#include "handoff.hpp"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 namespace http
 {
 
+// what a connection thread of HttpServer takes: the stack glibc gives it and
+// the buffer of its request; the 10 Mb CharBuffer is the echo handler's only
+static unsigned long connection_thread_memory()
+{
+    size_t stack = 0;
+    pthread_attr_t attr;
+    if (pthread_getattr_default_np(&attr) == 0) {
+        pthread_attr_getstacksize(&attr, &stack);
+        pthread_attr_destroy(&attr);
+    }
+    return stack + REQUEST_BUFFER_SIZE;
+}
+
 TcpServer::TcpServer(
         int port,
         bool ipv4,
         const unsigned int maxClients,
-        tslogger::Handler &handler,
-        const char *logFileName,
-        bool logToStdout,
+        bool takeOver,
         std::error_code &ec
         ):
     m_running{false},
@@ -26,15 +43,90 @@ TcpServer::TcpServer(
     m_threads{},
     m_remove{},
     m_mutex{},
-    m_logger{handler.get_queue_ptr(), logFileName, logToStdout ? FLAGS_OUTPUT_TO_ALL : FLAGS_OUTPUT_TO_FILE_ONLY}
+    m_admission{},
+    m_rateLimiter{},
+    m_draining{false},
+    m_wake{-1, -1},
+    m_handoffPeer{-1},
+    m_unixListeners{},
+    m_takenOver{},
+    m_handoffThread{},
+    m_sizingThread{},
+    m_pinWorkers{false},
+    m_topology{},
+    m_socketOptions{}
 {
     ENTER();
+    if (::pipe2(m_wake, O_NONBLOCK | O_CLOEXEC) == -1) {
+        ec = make_system_error(errno);
+        LOG_E("%s\n", ec.message().c_str());
+        EXIT();
+        return;
+    }
+    // a server running on the port hands its socket over, so no connection is refused meanwhile,
+    // only when asked to, others fail to bind rather than drain it
+    int sockfd = -1;
+    if (takeOver) {
+        sockfd = take_over(port, ec);
+        if (ec.value()) {
+            LOG_E("%s\n", ec.message().c_str());
+            EXIT();
+            return;
+        }
+    }
+    if (sockfd == -1) {
+        sockfd = open_listener(port, ipv4, maxClients, ec);
+        if (ec.value()) {
+            EXIT();
+            return;
+        }
+    }
+    else {
+        ipv4 = m_conn.serv.addr.sin_family == AF_INET;
+        LOG_I("Listening socket has been taken over from the running server\n");
+    }
+    m_conn.ipv4 = ipv4;
+    m_conn.sockfd = sockfd;
+    unsigned int maxThreads = get_max_threads(connection_thread_memory());
+    if (maxClients > maxThreads) {
+        m_maxClients = maxThreads;
+    }
+    m_admission.limits(m_maxClients, m_maxClients * ADMISSION_PENDING_PER_SLOT);
+    start();
+    EXIT();
+}
+
+TcpServer::~TcpServer()
+{
+    if (m_handoffThread.joinable()) {
+        m_handoffThread.request_stop();
+        m_handoffThread.join();
+    }
+    if (m_sizingThread.joinable()) {
+        m_sizingThread.request_stop();
+        m_sizingThread.join();
+    }
+    if (m_handoffPeer != -1)
+        ::close(m_handoffPeer);
+    close(m_conn.sockfd);
+    for (int fd : m_unixListeners)
+        ::close(fd);
+    for (int fd : m_takenOver)
+        ::close(fd);
+    for (int fd : m_wake)
+    {
+        if (fd != -1)
+            ::close(fd);
+    }
+}
+
+int TcpServer::open_listener(int port, bool ipv4, unsigned int maxClients, std::error_code &ec)
+{
     int sockfd = ::socket(ipv4 ? AF_INET : AF_INET6, SOCK_STREAM, 0);
     if (sockfd == -1) {
         ec = make_error_code(HttpStatus::HTTP_ERR_CREATE_SOCKET);
-        LOG_E(ec.message().c_str());
-        EXIT();
-        return;
+        LOG_E("%s\n", ec.message().c_str());
+        return -1;
     }
     uint16_t _port = htons((uint16_t)port);
     if (ipv4)
@@ -52,6 +144,14 @@ TcpServer::TcpServer(
         m_conn.serv.addr6.sin6_addr = in6addr_any;
         m_conn.serv.addr6.sin6_port = _port;
     }
+    // connections of the last run may still be in TIME_WAIT on the port
+    int reuse = 1;
+    if (::setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1) {
+        ec = make_system_error(errno);
+        close(sockfd);
+        LOG_E("%s\n", ec.message().c_str());
+        return -1;
+    }
     // bind an empty socket to serv.addr(6) structure
     if (::bind(sockfd, ipv4 ? (struct sockaddr *)&m_conn.serv.addr : (struct sockaddr *)&m_conn.serv.addr6,
                  ipv4 ? sizeof(m_conn.serv.addr) : sizeof(m_conn.serv.addr6))==-1) {
@@ -59,9 +159,8 @@ TcpServer::TcpServer(
         LOG_D("errno = %d\n", errno);
         ec = make_error_code(HttpStatus::HTTP_ERR_SOCKET_NOT_BOUND);
         close(sockfd);
-        LOG_E(ec.message().c_str());
-        EXIT();
-        return;
+        LOG_E("%s\n", ec.message().c_str());
+        return -1;
     }
     // listen to an incomming connection
     if (::listen(sockfd, maxClients) == -1) {
@@ -71,89 +170,181 @@ TcpServer::TcpServer(
         close(sockfd);
         LOG_D("errno = %d\n", errno);
         LOG_E("%s\n",ec.message().c_str());
-        EXIT();
-        return;
+        return -1;
     }
-    m_conn.ipv4 = ipv4;
-    m_conn.sockfd = sockfd;
-    unsigned int maxThreads = get_max_threads(MAX_BUFFER_SIZE);
-    if (maxClients > maxThreads) {
-        m_maxClients = maxThreads;
-    }
-    start();
-    EXIT();
+    return sockfd;
 }
 
-TcpServer::~TcpServer()
+int TcpServer::take_over(int port, std::error_code &ec)
 {
-    close(m_conn.sockfd);
+    std::vector<int> fds;
+    m_handoffPeer = handoff_receive(port, fds, ec);
+    if (m_handoffPeer == -1)
+        return -1;
+    int sockfd = fds[0];
+    m_takenOver.assign(fds.begin() + 1, fds.end());
+    socklen_t len = sizeof(m_conn.serv);
+    if (::getsockname(sockfd, (struct sockaddr *)&m_conn.serv, &len) == -1
+        || (m_conn.serv.addr.sin_family != AF_INET && m_conn.serv.addr.sin_family != AF_INET6)) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_HANDOFF);
+        ::close(sockfd);
+        ::close(m_handoffPeer);
+        m_handoffPeer = -1;
+        return -1;
+    }
+    return sockfd;
 }
 
-void TcpServer::operator()()
+void TcpServer::confirm_take_over(std::error_code &ec)
 {
-    tslogger::Logger logger(m_logger.queue_ptr(), m_logger.filename(), m_logger.flags());
-    logger.log(DEBUG, "%s:%d <<< Entering\n", __FILE__, __LINE__);
-    std::error_code ec;
-    //TcpThread current = get_thread(std::this_thread::get_id(), ec);
-    Connection conn;
-    get_connection(conn, std::this_thread::get_id(), ec);
-    if (ec.value()) {
-        logger.log(ERROR, "%s\n", ec.message().c_str());
-        logger.log(DEBUG, "%s:%d >>> Exiting\n", __FILE__, __LINE__);
+    if (m_handoffPeer == -1)
         return;
+    handoff_confirm(m_handoffPeer, ec);
+    m_handoffPeer = -1;
+    // Unix sockets no listen_unix() has asked for, the old server stops accepting on them
+    for (int fd : m_takenOver)
+        ::close(fd);
+    m_takenOver.clear();
+}
+
+void TcpServer::offer_handoff()
+{
+    m_handoffThread = std::jthread([this](std::stop_token st){ handoff_server(st); });
+}
+
+void TcpServer::handoff_server(std::stop_token st)
+{
+    int fd = -1;
+    while (!st.stop_requested())
+    {
+        if (fd == -1) {
+            // the name is busy until the server this one took over from has let it go
+            std::error_code ec;
+            fd = handoff_listen(m_port, ec);
+            if (fd == -1) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
+            }
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (::poll(&pfd, 1, 1000) != 1)
+            continue;
+        int peer = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (peer == -1)
+            continue;
+        std::error_code ec;
+        std::vector<int> fds = {m_conn.sockfd};
+        fds.insert(fds.end(), m_unixListeners.begin(), m_unixListeners.end());
+        handoff_send(peer, fds, ec);
+        if (!ec.value() && handoff_confirmed(peer, HANDOFF_CONFIRM_TIMEOUT_MS)) {
+            ::close(peer);
+            ::close(fd);
+            LOG_I("Listening socket has been handed over, draining\n");
+            drain();
+            return;
+        }
+        LOG_W("Listening socket handoff has not been confirmed\n");
+        ::close(peer);
     }
+    if (fd != -1)
+        ::close(fd);
+}
 
-    int status;
-    fd_set rd;
-    struct timeval tv;
-    time_t timeout = 1;// wait 1 second
+bool TcpServer::wait_drained(unsigned int timeoutMs)
+{
+    std::error_code ec;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (m_admission.active() != 0)
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_POLL_MS));
+    }
+    thread_remover(ec);
+    return true;
+}
 
-    logger.log(INFO, "New client thread has been started\n");
+void TcpServer::operator()(Connection conn)
+{
+    LOG_D("%s:%d <<< Entering\n", __FILE__, __LINE__);
+    LOG_I("New client thread has been started\n");
 
-    while(is_running())
+    int node = -1;
+    AdmissionNext next = ADMISSION_SERVE;
+    while (next != ADMISSION_NONE)
     {
-        //std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        //std::cout << "conn.sockfd: " << conn.sockfd << "\n";
-        FD_ZERO(&rd);
-        FD_SET(conn.sockfd, &rd);
+        if (next == ADMISSION_SERVE) {
+            // a thread taking over a queued connection may have to move to another node
+            int connNode = m_pinWorkers ? m_topology.node_of(incoming_cpu(conn.sockfd)) : -1;
+            if (connNode != -1 && connNode != node) {
+                std::error_code ec;
+                pin_to_node(m_topology, connNode, ec);
+                if (ec.value())
+                    LOG_E("%s:%d %s\n",  __FILE__, __LINE__, ec.message().c_str());
+                else
+                    node = connNode;
+            }
+            serve(conn);
+        }
+        else {
+            reject(conn);
+            metric_add(METRIC_CONNECTIONS_SHED);
+        }
+        next = m_admission.next(conn);
+    }
+    add_thread_to_remove(std::this_thread::get_id());
+    LOG_D("%s:%d >>> Exiting\n", __FILE__, __LINE__);
+}
+
+void TcpServer::serve(const Connection &conn)
+{
+    std::error_code ec;
+    int status;
+    // poll, descriptors above FD_SETSIZE are fine once RLIMIT_NOFILE is raised
+    struct pollfd pfd = { conn.sockfd, POLLIN, 0 };
 
-        tv.tv_sec = timeout;
-        tv.tv_usec = 0;
+    metric_add(METRIC_CONNECTIONS_OPENED);
 
-        status = select(FD_SETSIZE, &rd, NULL, NULL, &tv);
-        //std::cout << "status: " << status << "\n";
+    // the options are TCP ones
+    if (!conn.local())
+        apply_connection_options(conn.sockfd, m_socketOptions, ec);
+    if (ec.value()) {
+        LOG_E("%s:%d %s\n",  __FILE__, __LINE__, ec.message().c_str());
+        ec.clear();
+    }
+
+    // a drain ends the connections once they are idle, a stop right away
+    while(is_running() || m_draining)
+    {
+        // short waits, so an idle keep-alive connection can give up its thread to a queued one
+        status = ::poll(&pfd, 1, m_draining ? 0 : int(IDLE_POLL_MS));
         if (status == -1)
         {
             ec = make_system_error(errno);
-            logger.log(ERROR, "%s:%d %s\n",  __FILE__, __LINE__, ec.message().c_str());
+            LOG_E("%s:%d %s\n",  __FILE__, __LINE__, ec.message().c_str());
             break;            
         }
         else if (status)
         {
-            ssize_t received, sent;
-            if (FD_ISSET(conn.sockfd, &rd))
-            {
-                //log_connection(logger, conn);
-                incoming_handler(conn, logger, ec);
-                if (ec.value()) {
-                    logger.log(ERROR, "%s:%d %s\n",  __FILE__, __LINE__, ec.message().c_str());
-                    break;
-                }
+            // POLLHUP and POLLERR as well, the handler reads the end or the error
+            incoming_handler(conn, ec);
+            if (ec.value()) {
+                LOG_E("%s:%d %s\n",  __FILE__, __LINE__, ec.message().c_str());
+                break;
             }
         }
-        else {
-            //logger.flags(FLAGS_OUTPUT_TO_STREAM_ONLY);
-            //logger.log(INFO, "No data within %d seconds\n", timeout);
-            //logger.flags(FLAGS_OUTPUT_TO_ALL);
+        else if (m_draining) {
+            break;
+        }
+        else if (m_admission.waiting()) {
+            LOG_D("Idle connection is closed for a queued one\n");
+            break;
         }
     }
+    if (!conn.local())
+        observe_tcp_info(conn.sockfd);
     ::close(conn.sockfd);
-    ec.clear();
-    add_thread_to_remove(std::this_thread::get_id());
-    if (ec.value()) {
-        logger.log(ERROR, "%s:%d %s\n",  __FILE__, __LINE__, ec.message());
-    }
-    logger.log(DEBUG, "%s:%d >>> Exiting\n", __FILE__, __LINE__);
+    metric_add(METRIC_CONNECTIONS_CLOSED);
 }
 
 void TcpServer::accept(Connection &conn, std::error_code &ec)
@@ -162,30 +353,29 @@ void TcpServer::accept(Connection &conn, std::error_code &ec)
     int accept_fd;
     socklen_t addr_len;
     struct sockaddr *client_addr;
-    //std::cout << "m_conn.ipv4 : " << m_conn.ipv4 << "\n";
-    if (m_conn.ipv4) {
-        addr_len = sizeof(conn.client.addr);
-        client_addr = reinterpret_cast<struct sockaddr *>(&conn.client.addr);
-    }
-    else {
-        addr_len = sizeof(conn.client.addr6);
-        client_addr = reinterpret_cast<struct sockaddr *>(&conn.client.addr6);
-    }
-    memset(client_addr, 0, addr_len);
+    int listen_fd = m_conn.sockfd;
+    memset(&conn.client, 0, sizeof(conn.client));
     //std::cout << "m_conn.sockfd : " << m_conn.sockfd << "\n";
 
-    // accept shouldn't block the thread, select is used to achieve this purpose
+    // accept shouldn't block the thread, poll is used to achieve this purpose
     int status;
-    fd_set rd;
-    struct timeval tv;
-    time_t timeout = 60;// wait for 60 seconds
-    tv.tv_sec = timeout;
-    tv.tv_usec = 0;
-    FD_ZERO(&rd);
-    FD_SET(m_conn.sockfd, &rd);
-
-    status = select(FD_SETSIZE, &rd, NULL, NULL, &tv);
-    //std::cout << "select status = " << status << "\n";
+    int timeout = 60;// wait for 60 seconds
+    std::vector<struct pollfd> fds;
+    fds.reserve(2 + m_unixListeners.size());
+    fds.push_back({m_wake[0], POLLIN, 0});
+    fds.push_back({m_conn.sockfd, POLLIN, 0});
+    for (int fd : m_unixListeners)
+        fds.push_back({fd, POLLIN, 0});
+
+    status = ::poll(fds.data(), fds.size(), timeout * 1000);
+    if ((status == -1 && errno == EINTR) || (status > 0 && fds[0].revents != 0)) {
+        char wakes[16];
+        while (::read(m_wake[0], wakes, sizeof(wakes)) > 0)
+            ;
+        ec = make_error_code(HttpStatus::HTTP_ERR_INTERRUPTED);
+        EXIT();
+        return;
+    }
     if (status == -1) {
         ec = make_system_error(errno);
         LOG_E("%s:%d %s\n", __FILE__, __LINE__, ec.message().c_str());
@@ -193,17 +383,37 @@ void TcpServer::accept(Connection &conn, std::error_code &ec)
         return;
     }
     else if (status == 0) {
-        //m_logger.flags(FLAGS_OUTPUT_TO_STREAM_ONLY);
         //LOG_I("No incoming connection within %d seconds\n", timeout);
         ec = make_error_code(HttpStatus::HTTP_ERR_TIMEOUT);
         EXIT();
-        //m_logger.flags(FLAGS_OUTPUT_TO_ALL);
         return;
     }
     //std::cout << "status = " << status << "\n";
     //std::cout << "enter accept()\n";
 
-    accept_fd = ::accept(m_conn.sockfd, client_addr, &addr_len);
+    // the TCP listener first, the next accept() takes a Unix one ready as well
+    if (fds[1].revents == 0) {
+        for (size_t i = 2; i < fds.size(); ++i)
+        {
+            if (fds[i].revents != 0) {
+                listen_fd = fds[i].fd;
+                break;
+            }
+        }
+    }
+    if (listen_fd != m_conn.sockfd) {
+        addr_len = sizeof(conn.client.local);
+        client_addr = reinterpret_cast<struct sockaddr *>(&conn.client.local);
+    }
+    else if (m_conn.ipv4) {
+        addr_len = sizeof(conn.client.addr);
+        client_addr = reinterpret_cast<struct sockaddr *>(&conn.client.addr);
+    }
+    else {
+        addr_len = sizeof(conn.client.addr6);
+        client_addr = reinterpret_cast<struct sockaddr *>(&conn.client.addr6);
+    }
+    accept_fd = ::accept(listen_fd, client_addr, &addr_len);
     if (accept_fd == -1) {
         ec = make_system_error(errno);
         LOG_E("%s:%d %s\n", __FILE__, __LINE__, ec.message().c_str());
@@ -213,29 +423,200 @@ void TcpServer::accept(Connection &conn, std::error_code &ec)
     //std::cout << "exit accept()\n";
 
     conn.sockfd = accept_fd;
-    conn.ipv4 = m_conn.ipv4;
+    conn.ipv4 = m_conn.ipv4 && listen_fd == m_conn.sockfd;
     EXIT();
 }
 
 void TcpServer::new_thread(Connection &&conn)
 {
     ENTER();
-    LOG_I("Creating of a new client thread...\n");
-    log_connection(m_logger, static_cast<const Connection&>(conn));
+    log_connection(static_cast<const Connection&>(conn));
+
+    // not answered, a client over its connection rate gets nothing it could use
+    if (!m_rateLimiter.allow_connection(conn)) {
+        LOG_W("Connection is closed, the client is over its connection rate\n");
+        ::close(conn.sockfd);
+        metric_add(METRIC_CONNECTIONS_RATE_LIMITED);
+        EXIT();
+        return;
+    }
 
+    switch (m_admission.admit(conn))
+    {
+    case ADMISSION_RUN:
+        spawn(std::move(conn));
+        break;
+    case ADMISSION_QUEUED:
+        LOG_I("Connection is queued, %u threads are busy\n", m_admission.active());
+        break;
+    case ADMISSION_REJECT:
+        LOG_W("Connection is rejected, the queue is full\n");
+        reject(conn);
+        metric_add(METRIC_CONNECTIONS_REJECTED);
+        break;
+    }
+    EXIT();
+}
+
+void TcpServer::spawn(Connection &&conn)
+{
+    LOG_I("Creating of a new client thread...\n");
+    // the thread is registered before it may look itself up in add_thread_to_remove
+    std::lock_guard lg(m_mutex);
+    Connection threadConn = conn;
     std::shared_ptr<TcpThread> newThreadPtr = std::make_shared<TcpThread>(
-        [this](){this->operator()();},
+        [this, threadConn](){this->operator()(threadConn);},
         std::move(conn)
         );
-    set_thread(newThreadPtr);
-
+    m_threads.insert(std::pair<std::thread::id, std::shared_ptr<TcpThread>>(newThreadPtr.get()->get_id(), newThreadPtr));
     LOG_I("A new thread has been created\n");
-    EXIT();
+}
+
+void TcpServer::autosize(const SizingOptions &options)
+{
+    ThreadSizer sizer(read_resource_limits(), options, connection_thread_memory());
+    unsigned limit = std::clamp(m_maxClients, sizer.min_threads(), sizer.max_threads());
+    m_admission.limits(limit, limit * ADMISSION_PENDING_PER_SLOT);
+    LOG_I("Connection threads are sized between %u and %u\n", sizer.min_threads(), sizer.max_threads());
+    m_sizingThread = std::jthread([this, sizer](std::stop_token st){ sizing_loop(st, sizer); });
+}
+
+void TcpServer::sizing_loop(std::stop_token st, ThreadSizer sizer)
+{
+    unsigned samples = 0;
+    while (!st.stop_requested())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SIZING_SAMPLE_MS));
+        sizer.sample(m_admission.active());
+        if (++samples < SIZING_INTERVAL_MS / SIZING_SAMPLE_MS)
+            continue;
+        samples = 0;
+
+        unsigned limit = m_admission.limit();
+        unsigned next = sizer.adjust(limit, m_admission.queue_delay());
+        if (next != limit) {
+            LOG_I("Connection threads %u -> %u, CPU %.2f, blocked %.2f\n", limit, next,
+                  sizer.cpu_utilization(), sizer.blocked_ratio());
+            m_admission.limits(next, next * ADMISSION_PENDING_PER_SLOT);
+        }
+        // a raised limit takes queued connections at once, not when a thread frees up
+        Connection conn;
+        while (is_running() && m_admission.promote(conn))
+            spawn(std::move(conn));
+    }
+}
+
+void TcpServer::pin_workers(bool enable)
+{
+    m_topology = enable ? read_cpu_topology() : CpuTopology();
+    m_pinWorkers = enable && !m_topology.nodes.empty();
+    if (m_pinWorkers)
+        LOG_I("Connection threads are pinned to %u NUMA nodes\n", (unsigned)m_topology.nodes.size());
+}
+
+void TcpServer::socket_options(const SocketOptions &options, std::error_code &ec)
+{
+    m_socketOptions = options;
+    apply_listener_options(m_conn.sockfd, options, ec);
+    if (ec.value())
+        LOG_E("%s\n", ec.message().c_str());
+}
+
+// the address of a listen_unix() path, 0 if it does not fit into sun_path
+static socklen_t unix_address(const std::string &path, struct sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return 0;
+    memcpy(addr.sun_path, path.data(), path.size());
+    if (path[0] == '@') {
+        // no terminating 0, all of the length is the name
+        addr.sun_path[0] = 0;
+        return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path.size());
+    }
+    return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path.size() + 1);
+}
+
+// removes a socket file nobody accepts on any more, bind() fails on a file in use
+static void remove_stale_socket(const struct sockaddr_un &addr, socklen_t len)
+{
+    struct stat st;
+    if (::lstat(addr.sun_path, &st) == -1 || !S_ISSOCK(st.st_mode))
+        return;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return;
+    if (::connect(fd, (const struct sockaddr *)&addr, len) == -1 && errno == ECONNREFUSED)
+        ::unlink(addr.sun_path);
+    ::close(fd);
+}
+
+void TcpServer::listen_unix(const std::string &path, mode_t mode, std::error_code &ec)
+{
+    struct sockaddr_un addr;
+    socklen_t len = unix_address(path, addr);
+    if (len == 0) {
+        ec = make_system_error(ENAMETOOLONG);
+        LOG_E("%s: %s\n", path.c_str(), ec.message().c_str());
+        return;
+    }
+    // the socket of the server taken over from, its queued connections are not lost
+    for (auto it = m_takenOver.begin(); it != m_takenOver.end(); ++it)
+    {
+        struct sockaddr_un bound;
+        socklen_t boundLen = sizeof(bound);
+        if (::getsockname(*it, (struct sockaddr *)&bound, &boundLen) == 0
+            && boundLen == len && memcmp(&bound, &addr, len) == 0) {
+            m_unixListeners.push_back(*it);
+            m_takenOver.erase(it);
+            return;
+        }
+    }
+
+    int sockfd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd == -1) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_CREATE_SOCKET);
+        LOG_E("%s\n", ec.message().c_str());
+        return;
+    }
+    bool file = path[0] != '@';
+    if (file)
+        remove_stale_socket(addr, len);
+    if (::bind(sockfd, (struct sockaddr *)&addr, len) == -1) {
+        ec = make_system_error(errno);
+        ::close(sockfd);
+        LOG_E("%s: %s\n", path.c_str(), ec.message().c_str());
+        return;
+    }
+    // before listen(), no client gets in with the permissions the umask left
+    if (file && ::chmod(path.c_str(), mode) == -1) {
+        ec = make_system_error(errno);
+        ::close(sockfd);
+        ::unlink(path.c_str());
+        LOG_E("%s: %s\n", path.c_str(), ec.message().c_str());
+        return;
+    }
+    // a full backlog fails connect() with EAGAIN instead of a SYN sent again later,
+    // the admission control queues what the threads cannot take
+    if (::listen(sockfd, SOMAXCONN) == -1) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_LISTEN_TO_SOCKET);
+        ::close(sockfd);
+        if (file)
+            ::unlink(path.c_str());
+        LOG_E("%s\n", ec.message().c_str());
+        return;
+    }
+    m_unixListeners.push_back(sockfd);
+}
+
+void TcpServer::reject(const Connection &conn)
+{
+    ::close(conn.sockfd);
 }
 
 void TcpServer::incoming_handler(
                         const Connection &conn,
-                        tslogger::Logger &logger,
                         std::error_code &ec
                     )
 {
@@ -244,14 +625,14 @@ void TcpServer::incoming_handler(
     memset(buffer.data(), 0, buffer.size());
     received = ::recv(conn.sockfd, buffer.data(), buffer.size(), MSG_DONTWAIT);
     if (received > 0) {
-        logger.log(INFO, "<-- %d bytes received\n", received);
+        LOG_I("<-- %zd bytes received\n", received);
         if (sent = ::send(conn.sockfd, buffer.data(), received, MSG_DONTWAIT) == -1) {
             ec = make_system_error(errno);
-            logger.log(ERROR, "%s\n", ec.message().c_str());
+            LOG_E("%s\n", ec.message().c_str());
             ec.clear();
         }
         else {
-            logger.log(INFO, "--> %d bytes sent\n", received);
+            LOG_I("--> %zd bytes sent\n", received);
         }
     }
     else {
@@ -259,19 +640,19 @@ void TcpServer::incoming_handler(
     }
 }
 
-void log_connection(tslogger::Logger &logger, const Connection &conn)
+void log_connection(const Connection &conn)
 {
-    logger.log(DEBUG, "-----------------------\n");
-    logger.log(DEBUG, "ipv4: %d\n", conn.ipv4);
+    LOG_D("-----------------------\n");
+    LOG_D("ipv4: %d\n", conn.ipv4);
     if (conn.ipv4) {
-        logger.log(DEBUG, "client.addr.sin_port: %d\n", conn.client.addr.sin_port);
-        logger.log(DEBUG, "client.addr.sin_addr: %d\n", conn.client.addr.sin_addr);
+        LOG_D("client.addr.sin_port: %d\n", conn.client.addr.sin_port);
+        LOG_D("client.addr.sin_addr: %d\n", conn.client.addr.sin_addr.s_addr);
     }
     else {
         //TODO
     }
-    logger.log(DEBUG, "sockfd: %d\n", conn.sockfd);
-    logger.log(DEBUG, "-----------------------\n");
+    LOG_D("sockfd: %d\n", conn.sockfd);
+    LOG_D("-----------------------\n");
 }
 
 }// namespace http
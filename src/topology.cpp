@@ -0,0 +1,116 @@
+#include "topology.hpp"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include "http_error.hpp"
+
+namespace http
+{
+
+static const char *NODE_DIR = "/sys/devices/system/node";
+
+std::vector<int> parse_cpu_list(const std::string &list)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range);
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        catch (const std::exception &) {
+            // a trailing newline or an empty list
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+CpuTopology read_cpu_topology()
+{
+    CpuTopology topology;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0)
+        return topology;
+    topology.cpuNode.assign(CPU_SETSIZE, -1);
+
+    std::error_code ec;
+    std::vector<std::filesystem::path> nodeDirs;
+    for (const auto &entry : std::filesystem::directory_iterator(NODE_DIR, ec))
+    {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("node", 0) == 0 && name.size() > 4 && isdigit(static_cast<unsigned char>(name[4])))
+            nodeDirs.push_back(entry.path());
+    }
+    std::sort(nodeDirs.begin(), nodeDirs.end());
+
+    for (const std::filesystem::path &dir : nodeDirs)
+    {
+        std::ifstream in(dir / "cpulist");
+        std::string list;
+        std::getline(in, list);
+        std::vector<int> cpus;
+        for (int cpu : parse_cpu_list(list))
+        {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &mask))
+                cpus.push_back(cpu);
+        }
+        if (cpus.empty())
+            continue;
+        for (int cpu : cpus)
+            topology.cpuNode[cpu] = static_cast<int>(topology.nodes.size());
+        topology.nodes.push_back(std::move(cpus));
+    }
+
+    if (topology.nodes.empty()) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &mask)) {
+                cpus.push_back(cpu);
+                topology.cpuNode[cpu] = 0;
+            }
+        }
+        topology.nodes.push_back(std::move(cpus));
+    }
+    return topology;
+}
+
+int incoming_cpu(int sockfd)
+{
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if (::getsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == -1)
+        return -1;
+    return cpu;
+}
+
+void pin_to_node(const CpuTopology &topology, int node, std::error_code &ec)
+{
+    if (node < 0 || static_cast<size_t>(node) >= topology.nodes.size()) {
+        ec = make_system_error(EINVAL);
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : topology.nodes[node])
+        CPU_SET(cpu, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error != 0)
+        ec = make_system_error(error);
+}
+
+}// namespace http
@@ -0,0 +1,211 @@
+#include "trace.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+
+namespace http
+{
+
+static const char *PHASE_NAMES[TRACE_PHASE_COUNT] = {
+    "receive",
+    "parse",
+    "handle",
+    "lookup",
+    "compress",
+    "compress wait",
+    "done",
+    "send",
+    "sendfile",
+    "file wait",
+};
+
+struct TraceSample
+{
+    uint64_t begin;
+    uint64_t end;
+    uint32_t tid;
+    uint16_t status;
+    uint8_t spanCount;
+    uint8_t uriSize;
+    char uri[TRACE_MAX_URI];
+    struct Span
+    {
+        uint64_t begin;
+        uint64_t end;
+        TracePhase phase;
+    } spans[TRACE_MAX_SPANS];
+};
+
+// the request being handled by this thread
+struct ActiveTrace
+{
+    bool active = false;
+    uint64_t begin = 0;
+    unsigned spanCount = 0;
+    TraceSample::Span spans[TRACE_MAX_SPANS];
+    uint64_t random = 0;
+};
+
+static thread_local ActiveTrace activeTrace;
+
+// Only sampled requests get here, a lock is cheap enough for them
+class TraceRing
+{
+public:
+    static TraceRing &instance()
+    {
+        static TraceRing ring;
+        return ring;
+    }
+
+    void push(const TraceSample &sample)
+    {
+        std::lock_guard lg(m_mutex);
+        if (!m_samples)
+            m_samples = std::make_unique<TraceSample[]>(TRACE_RING_SIZE);
+        m_samples[m_next % TRACE_RING_SIZE] = sample;
+        ++m_next;
+    }
+
+    template <typename F>
+    void for_each(F f)
+    {
+        std::lock_guard lg(m_mutex);
+        size_t first = m_next > TRACE_RING_SIZE ? m_next - TRACE_RING_SIZE : 0;
+        for (size_t i = first; i < m_next; ++i)
+            f(m_samples[i % TRACE_RING_SIZE]);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::unique_ptr<TraceSample[]> m_samples;
+    size_t m_next = 0;
+};
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// ticks and ns at startup, the ratio to the ticks and ns at export scales ticks to ns
+static const struct TraceEpoch
+{
+    uint64_t ticks = trace_ticks();
+    uint64_t ns = monotonic_ns();
+} traceEpoch;
+
+// xorshift64, good enough to pick requests
+static uint64_t next_random(uint64_t &state)
+{
+    if (state == 0)
+        state = (trace_ticks() ^ (uint64_t(::gettid()) << 32)) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+void trace_begin()
+{
+    ActiveTrace &t = activeTrace;
+    t.active = true;
+    t.begin = trace_ticks();
+    t.spanCount = 0;
+}
+
+void trace_span(TracePhase phase, uint64_t begin, uint64_t end)
+{
+    ActiveTrace &t = activeTrace;
+    if (t.active && t.spanCount < TRACE_MAX_SPANS)
+        t.spans[t.spanCount++] = {begin, end, phase};
+}
+
+void trace_end(const TraceOptions &options, std::string_view uri, int status, uint64_t durationNs)
+{
+    ActiveTrace &t = activeTrace;
+    if (!t.active)
+        return;
+    t.active = false;
+    bool slow = options.slowNs != 0 && durationNs >= options.slowNs;
+    bool sampled = options.sampleEvery != 0 && next_random(t.random) % options.sampleEvery == 0;
+    if (!slow && !sampled)
+        return;
+
+    TraceSample sample;
+    sample.begin = t.begin;
+    sample.end = trace_ticks();
+    sample.tid = ::gettid();
+    sample.status = status;
+    sample.spanCount = t.spanCount;
+    sample.uriSize = uri.size() < TRACE_MAX_URI ? uri.size() : TRACE_MAX_URI;
+    memcpy(sample.uri, uri.data(), sample.uriSize);
+    memcpy(sample.spans, t.spans, t.spanCount * sizeof(t.spans[0]));
+    TraceRing::instance().push(sample);
+}
+
+static void append(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string &out, const char *fmt, ...)
+{
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    out.append(line, len < static_cast<int>(sizeof(line)) ? len : sizeof(line) - 1);
+}
+
+static void append_json_string(std::string &out, const char *data, size_t size)
+{
+    out += '"';
+    for (size_t i = 0; i < size; ++i)
+    {
+        unsigned char c = data[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (c < 0x20) {
+            append(out, "\\u%04x", c);
+        }
+        else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+void render_trace(std::string &out)
+{
+    uint64_t ticks = trace_ticks();
+    uint64_t ns = monotonic_ns();
+    double usPerTick = ticks > traceEpoch.ticks
+                     ? double(ns - traceEpoch.ns) / double(ticks - traceEpoch.ticks) / 1000 : 0.001;
+    auto us = [&](uint64_t t) { return t > traceEpoch.ticks ? (t - traceEpoch.ticks) * usPerTick : 0.0; };
+
+    out += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    TraceRing::instance().for_each([&](const TraceSample &s)
+    {
+        // the request encloses its spans, the viewer nests them by time on the thread
+        append(out, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"cat\":\"request\",\"name\":",
+               first ? "" : ",", s.tid, us(s.begin), us(s.end) - us(s.begin));
+        append_json_string(out, s.uri, s.uriSize);
+        append(out, ",\"args\":{\"status\":%u}}", s.status);
+        first = false;
+        for (unsigned i = 0; i < s.spanCount; ++i)
+        {
+            const TraceSample::Span &span = s.spans[i];
+            append(out, ",{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"cat\":\"phase\",\"name\":\"%s\"}",
+                   s.tid, us(span.begin), us(span.end) - us(span.begin), PHASE_NAMES[span.phase]);
+        }
+    });
+    out += "]}\n";
+}
+
+}// namespace http
@@ -1,8 +1,12 @@
 #include "utils.hpp"
 #include "http_error.hpp"
 #include "tcp_server.hpp"
+#include "sizing.hpp"
+#include <cmath>
 #include <thread>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <filesystem>
 #include <fstream>
 #include <zlib.h>
@@ -23,21 +27,23 @@ unsigned int get_total_cpu_cores()
 }
 
 
-static unsigned int get_max_threads_by_cpu_cores()
+// the affinity mask and cgroup quotas of a container count, not the cores of the host
+static unsigned int get_max_threads_by_cpu_cores(const ResourceLimits &limits)
 {
-    unsigned int cores = get_total_cpu_cores();
+    unsigned int cores = static_cast<unsigned int>(std::ceil(limits.cpus));
     return cores ? 2 * cores : 10;
 }
 
-static unsigned int get_max_threads_by_memory_limit(unsigned long maxBufLen)
+static unsigned int get_max_threads_by_memory_limit(const ResourceLimits &limits, unsigned long maxBufLen)
 {
-    return static_cast<unsigned int>(get_total_system_memory() / static_cast<unsigned long long>(maxBufLen));
+    return static_cast<unsigned int>(limits.memory / static_cast<unsigned long long>(maxBufLen));
 }
 
 unsigned int get_max_threads(unsigned long maxBufLenPerThread)
 {
-    unsigned int maxThreadsByCpuCores = get_max_threads_by_cpu_cores();
-    unsigned int maxThreadsByMemoryLimit = get_max_threads_by_memory_limit(maxBufLenPerThread);
+    ResourceLimits limits = read_resource_limits();
+    unsigned int maxThreadsByCpuCores = get_max_threads_by_cpu_cores(limits);
+    unsigned int maxThreadsByMemoryLimit = get_max_threads_by_memory_limit(limits, maxBufLenPerThread);
     return maxThreadsByCpuCores < maxThreadsByMemoryLimit ? maxThreadsByCpuCores : maxThreadsByMemoryLimit;
 }
 
@@ -56,77 +62,78 @@ size_t get_file_size(std::filesystem::path &filename, std::error_code &ec)
     return contentSize;
 }
 
-size_t compress_file(
-            std::filesystem::path &filename,
-            tslogger::Logger &logger,
-            http::Buffer<char, http::MAX_BUFFER_SIZE> &out,
-            std::error_code &ec
-        )
+size_t compress_bound(size_t size)
 {
-    size_t chunkSize = 4096;
-    const int compressionLevel = 9;
-    size_t total = 0;
-    z_stream stream = {0};
-    if (deflateInit(&stream, compressionLevel) != Z_OK)
-    {
-        ec = make_error_code(HttpStatus::HTTP_ERR_INTERNAL_SERVER_ERROR);
-        logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, ec.message().c_str());
-        return total;
-    }
+    return compressBound(size);
+}
 
-    std::ifstream ifs(filename);
-    if (!ifs.is_open()) {
-        ec = make_error_code(HttpStatus::HTTP_ERR_FILE_NOT_FOUND);
-        deflateEnd(&stream);
-        logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, ec.message().c_str());
-        return total;
+size_t compress_to_string(const char *data, size_t size, std::string &out, std::error_code &ec, int level)
+{
+    uLongf total = compressBound(size);
+    out.resize(total);
+    if (compress2(reinterpret_cast<Bytef *>(out.data()), &total,
+                  reinterpret_cast<const Bytef *>(data), size, level) != Z_OK) {
+        ec = make_error_code(HttpStatus::HTTP_ERR_INTERNAL_SERVER_ERROR);
+        out.clear();
+        return 0;
     }
-    ifs.seekg(0, std::ios::end);
-    size_t contentSize = ifs.tellg();
-    ifs.seekg(0);
+    out.resize(total);
+    out.shrink_to_fit();
+    return total;
+}
 
-    if (contentSize < chunkSize) {
-        chunkSize = contentSize;
+size_t send_all(int sockfd, const char *data, size_t size, std::error_code &ec)
+{
+    size_t total = 0;
+    while (total < size)
+    {
+        ssize_t sent = ::send(sockfd, data + total, size - total, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+            ec = make_system_error(errno);
+            break;
+        }
+        total += sent;
     }
+    return total;
+}
 
-    char *inbuff = new char [chunkSize];
-    char *outbuff = new char [chunkSize];
-
-    if (out.offset() + contentSize > out.size()) {
-        ec = make_error_code(HttpStatus::HTTP_ERR_INTERNAL_SERVER_ERROR);
-        logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, ec.message().c_str());
-        goto error_exit;
+bool read_range(int fd, char *out, size_t length, off_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t n = ::pread(fd, out, length, offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        out += n;
+        offset += n;
+        length -= n;
     }
+    return true;
+}
 
-    int flush;
-    do {
-        if (!ifs.read(inbuff, chunkSize) && !ifs.eof()) {
+size_t send_file(int sockfd, int fd, off_t offset, size_t size, std::error_code &ec)
+{
+    size_t total = 0;
+    while (total < size)
+    {
+        // the offset is passed explicitly, so the descriptor can be shared between threads
+        ssize_t sent = ::sendfile(sockfd, fd, &offset, size - total);
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+            ec = make_system_error(errno);
+            break;
+        }
+        if (sent == 0) {
+            // the file was truncated after its size had been taken
             ec = make_error_code(HttpStatus::HTTP_ERR_INTERNAL_SERVER_ERROR);
-            logger.log(ERROR, "%s:%d %s\n", __FILE__, __LINE__, ec.message().c_str());
-            goto error_exit;
+            break;
         }
-        stream.avail_in = chunkSize;
-        flush = ifs.eof() ? Z_FINISH : Z_NO_FLUSH;
-        stream.next_in = reinterpret_cast<uint8_t *>(inbuff);
-
-        do {
-            stream.avail_out = chunkSize;
-            stream.next_out = reinterpret_cast<uint8_t *>(outbuff);
-            deflate(&stream, flush);
-
-            size_t compressed = chunkSize - stream.avail_out;
-            total += compressed;
-
-            memcpy(out.data() + out.offset(), outbuff, compressed);
-            out.offset(out.offset() + compressed);
-        } while (stream.avail_out == 0);
-
-    } while (flush != Z_FINISH);
-
-error_exit:
-    deflateEnd(&stream);
-    ifs.close();
-    delete [] inbuff;
-    delete [] outbuff;
+        total += sent;
+    }
     return total;
 }
@@ -0,0 +1,109 @@
+// shs-access-log [--json] <segment>...
+// Prints binary access log segments as text lines or JSON lines.
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "access_log.hpp"
+
+using namespace http;
+
+// in the order of the Command enum in http_server.hpp
+static const char *METHODS[] = {"OPTIONS", "GET", "HEAD", "POST", "PUT", "DELETE", "TRACE", "CONNECT"};
+
+static const char *method2str(uint8_t method)
+{
+    return method < sizeof(METHODS) / sizeof(METHODS[0]) ? METHODS[method] : "-";
+}
+
+static std::string json_escape(const std::string &s)
+{
+    std::string out;
+    for (unsigned char c : s)
+    {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        }
+        else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+static bool decode(const char *path, bool json)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    AccessLogHeader header;
+    if (data.size() < sizeof(header)) {
+        std::cerr << path << ": not an access log\n";
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic)) != 0
+        || header.version != ACCESS_LOG_VERSION || header.recordSize != sizeof(AccessRecord)) {
+        std::cerr << path << ": not an access log of this version\n";
+        return false;
+    }
+
+    for (size_t pos = sizeof(header); pos + sizeof(AccessRecord) <= data.size();)
+    {
+        AccessRecord r;
+        memcpy(&r, data.data() + pos, sizeof(r));
+        if (pos + sizeof(r) + r.uriSize > data.size()) {
+            std::cerr << path << ": truncated record at " << pos << "\n";
+            return false;
+        }
+        std::string uri(data.data() + pos + sizeof(r), r.uriSize);
+        pos += (sizeof(r) + r.uriSize + ACCESS_RECORD_ALIGNMENT - 1) & ~size_t(ACCESS_RECORD_ALIGNMENT - 1);
+
+        char addr[INET6_ADDRSTRLEN] = "unix";
+        if (r.family != AF_UNIX)
+            inet_ntop(r.family == AF_INET6 ? AF_INET6 : AF_INET, r.addr, addr, sizeof(addr));
+        time_t sec = r.timestamp / 1000000000;
+        struct tm tm;
+        char date[32];
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", gmtime_r(&sec, &tm));
+        unsigned ms = (r.timestamp / 1000000) % 1000;
+
+        if (json)
+            printf("{\"time\":\"%s.%03uZ\",\"client\":\"%s\",\"port\":%u,\"method\":\"%s\",\"uri\":\"%s\","
+                   "\"status\":%u,\"bytes\":%lu,\"latency_us\":%u}\n",
+                   date, ms, addr, r.port, method2str(r.method), json_escape(uri).c_str(),
+                   r.status, (unsigned long)r.bytes, r.latency);
+        else
+            printf("%s [%s.%03uZ] \"%s %s\" %u %lu %uus\n",
+                   addr, date, ms, method2str(r.method), uri.c_str(), r.status, (unsigned long)r.bytes, r.latency);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "--json") == 0) {
+        json = true;
+        first = 2;
+    }
+    if (first >= argc) {
+        std::cerr << "Usage: " << argv[0] << " [--json] <segment>...\n";
+        return 1;
+    }
+    bool ok = true;
+    for (int i = first; i < argc; ++i)
+        ok = decode(argv[i], json) && ok;
+    return ok ? 0 : 1;
+}
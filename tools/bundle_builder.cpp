@@ -0,0 +1,130 @@
+// shs-bundle <doc-root> <bundle>
+// Packs a document root into a site bundle served by simple-http-server.
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+#include "bundle.hpp"
+#include "site_files.hpp"
+
+using namespace http;
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static void build(const std::vector<SiteFile> &items, std::string &out)
+{
+    BundleHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.version = BUNDLE_VERSION;
+    header.count = items.size();
+    header.slots = 1;
+    while (header.slots < 2 * header.count)
+        header.slots <<= 1;
+
+    std::vector<BundleRecord> records(items.size());
+    std::vector<uint32_t> table(header.slots, 0);
+    std::string strings;
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const SiteFile &item = items[i];
+        BundleRecord &r = records[i];
+        memset(&r, 0, sizeof(r));
+        r.hash = bundle_hash(item.path);
+        r.pathOffset = strings.size();
+        r.pathSize = item.path.size();
+        strings += item.path;
+        r.etagOffset = strings.size();
+        r.etagSize = item.etag.size();
+        strings += item.etag;
+        r.deflateEtagOffset = strings.size();
+        r.deflateEtagSize = item.deflatedEtag.size();
+        strings += item.deflatedEtag;
+        r.lastModifiedOffset = strings.size();
+        r.lastModifiedSize = item.lastModified.size();
+        strings += item.lastModified;
+        r.type = item.type;
+        r.mtime = item.mtime;
+
+        uint32_t mask = header.slots - 1;
+        uint32_t slot = r.hash & mask;
+        while (table[slot] != 0)
+            slot = (slot + 1) & mask;
+        table[slot] = i + 1;
+    }
+
+    header.recordsOffset = align_up(sizeof(header), alignof(BundleRecord));
+    header.tableOffset = header.recordsOffset + records.size() * sizeof(BundleRecord);
+    header.stringsOffset = header.tableOffset + table.size() * sizeof(uint32_t);
+
+    // blobs follow the strings, big ones page aligned so sendfile reads whole pages
+    uint64_t offset = header.stringsOffset + strings.size();
+    auto place = [&offset](uint64_t size) {
+        offset = align_up(offset, size >= BUNDLE_BLOB_ALIGNMENT ? BUNDLE_BLOB_ALIGNMENT : BUNDLE_SMALL_BLOB_ALIGNMENT);
+        uint64_t start = offset;
+        offset += size;
+        return start;
+    };
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        records[i].rawOffset = place(items[i].raw.size());
+        records[i].rawSize = items[i].raw.size();
+        if (!items[i].deflated.empty()) {
+            records[i].deflateOffset = place(items[i].deflated.size());
+            records[i].deflateSize = items[i].deflated.size();
+        }
+    }
+    header.size = offset;
+
+    out.assign(header.size, '\0');
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + header.recordsOffset, records.data(), records.size() * sizeof(BundleRecord));
+    memcpy(out.data() + header.tableOffset, table.data(), table.size() * sizeof(uint32_t));
+    memcpy(out.data() + header.stringsOffset, strings.data(), strings.size());
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        memcpy(out.data() + records[i].rawOffset, items[i].raw.data(), items[i].raw.size());
+        memcpy(out.data() + records[i].deflateOffset, items[i].deflated.data(), items[i].deflated.size());
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <doc-root> <bundle>\n";
+        return 1;
+    }
+    std::error_code ec;
+    std::vector<SiteFile> items;
+    collect_site_files(argv[1], items, ec);
+    if (ec) {
+        std::cerr << argv[1] << ": " << ec.message() << "\n";
+        return 1;
+    }
+    std::string out;
+    build(items, out);
+
+    // written aside and renamed, a server reloading on SIGHUP never sees a half written bundle
+    std::string tmp = std::string(argv[2]) + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(out.data(), out.size());
+        if (!file.flush()) {
+            std::cerr << tmp << ": write failed\n";
+            return 1;
+        }
+    }
+    std::filesystem::rename(tmp, argv[2], ec);
+    if (ec) {
+        std::cerr << argv[2] << ": " << ec.message() << "\n";
+        return 1;
+    }
+    std::cout << items.size() << " files, " << out.size() << " bytes\n";
+    return 0;
+}
@@ -0,0 +1,188 @@
+// shs-embed <doc-root> <output.cpp>
+// Generates the translation unit with the EMBEDDED_ASSETS table, run by shs_embed_assets() in CMakeLists.txt.
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+#include "embedded_assets.hpp"
+#include "site_files.hpp"
+
+using namespace http;
+
+enum {
+    BYTES_PER_LINE = 32,
+    MAX_SEED = 1000000,
+};
+
+// octal escapes always take three digits, so a following digit can't join them
+static void write_bytes(std::ostream &out, const char *name, const std::string &bytes)
+{
+    out << "alignas(16) constexpr char " << name << "[] =";
+    if (bytes.empty())
+        out << " \"\"";
+    for (size_t i = 0; i < bytes.size(); ++i)
+    {
+        if (i % BYTES_PER_LINE == 0)
+            out << (i == 0 ? "\n    \"" : "\"\n    \"");
+        char esc[8];
+        snprintf(esc, sizeof(esc), "\\%03o", static_cast<unsigned char>(bytes[i]));
+        out << esc;
+    }
+    if (!bytes.empty())
+        out << "\"";
+    out << ";\n";
+}
+
+static void write_string(std::ostream &out, const std::string &s)
+{
+    out << '"';
+    for (unsigned char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (c < 0x20 || c >= 0x7f) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\%03o", c);
+            out << esc;
+        }
+        else
+            out << c;
+    }
+    out << "\"";
+}
+
+// hash and displace: the biggest buckets are placed first while most slots are still free
+static bool build_index(const std::vector<SiteFile> &files, std::vector<uint32_t> &seeds, std::vector<uint32_t> &slots)
+{
+    size_t n = files.size();
+    seeds.assign(n / 2 + 1, 0);
+    slots.assign(n + n / 4 + 1, 0);
+
+    std::vector<std::vector<size_t>> buckets(seeds.size());
+    for (size_t i = 0; i < n; ++i)
+        buckets[embedded_hash(files[i].path, 0) % seeds.size()].push_back(i);
+    std::vector<size_t> order(buckets.size());
+    for (size_t b = 0; b < order.size(); ++b)
+        order[b] = b;
+    std::stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b){ return buckets[a].size() > buckets[b].size(); });
+
+    for (size_t b : order)
+    {
+        if (buckets[b].empty())
+            break;
+        bool placed = false;
+        for (uint32_t seed = 1; seed < MAX_SEED && !placed; ++seed)
+        {
+            std::vector<size_t> taken;
+            for (size_t i : buckets[b])
+            {
+                size_t slot = embedded_hash(files[i].path, seed) % slots.size();
+                if (slots[slot] != 0 || std::find(taken.begin(), taken.end(), slot) != taken.end())
+                    break;
+                taken.push_back(slot);
+            }
+            if (taken.size() != buckets[b].size())
+                continue;
+            for (size_t k = 0; k < taken.size(); ++k)
+                slots[taken[k]] = buckets[b][k] + 1;
+            seeds[b] = seed;
+            placed = true;
+        }
+        if (!placed)
+            return false;
+    }
+    return true;
+}
+
+static void write_table(std::ostream &out, const char *type, const char *name, const std::vector<uint32_t> &values)
+{
+    out << "constexpr " << type << " " << name << "[] = {";
+    for (size_t i = 0; i < values.size(); ++i)
+        out << (i % 16 == 0 ? "\n    " : " ") << values[i] << ",";
+    out << "\n};\n\n";
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <doc-root> <output.cpp>\n";
+        return 1;
+    }
+    std::error_code ec;
+    std::vector<SiteFile> files;
+    collect_site_files(argv[1], files, ec);
+    if (ec) {
+        std::cerr << argv[1] << ": " << ec.message() << "\n";
+        return 1;
+    }
+    std::vector<uint32_t> seeds, slots;
+    if (!build_index(files, seeds, slots)) {
+        std::cerr << argv[1] << ": unable to build the path index\n";
+        return 1;
+    }
+
+    std::ostringstream out;
+    out << "// Generated by shs-embed from " << argv[1] << ", do not edit\n"
+        << "#include \"embedded_assets.hpp\"\n\n"
+        << "namespace http\n{\n\nnamespace\n{\n\n";
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        out << "// " << files[i].path << "\n";
+        write_bytes(out, ("RAW_" + std::to_string(i)).c_str(), files[i].raw);
+        if (!files[i].deflated.empty())
+            write_bytes(out, ("DEFLATED_" + std::to_string(i)).c_str(), files[i].deflated);
+        out << "\n";
+    }
+
+    out << "constexpr EmbeddedAsset ASSETS[] = {\n";
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const SiteFile &f = files[i];
+        out << "    {";
+        write_string(out, f.path);
+        out << ", RAW_" << i << ", " << f.raw.size() << ", ";
+        if (f.deflated.empty())
+            out << "nullptr, 0, ";
+        else
+            out << "DEFLATED_" << i << ", " << f.deflated.size() << ", ";
+        out << "static_cast<ContentType>(" << f.type << "), " << f.mtime << ", ";
+        write_string(out, f.etag);
+        out << ", ";
+        write_string(out, f.deflatedEtag);
+        out << ", ";
+        write_string(out, f.lastModified);
+        out << "},\n";
+    }
+    // an array can't be empty, the count keeps the placeholder out of lookups
+    if (files.empty())
+        out << "    {},\n";
+    out << "};\n\n";
+    write_table(out, "uint32_t", "SEEDS", seeds);
+    write_table(out, "uint32_t", "SLOTS", slots);
+    out << "constexpr EmbeddedAssets TABLE = {ASSETS, " << files.size() << ", SEEDS, " << seeds.size()
+        << ", SLOTS, " << slots.size() << "};\n\n"
+        << "static_assert(embedded_table_is_perfect(TABLE));\n\n"
+        << "}// namespace\n\n"
+        << "extern const EmbeddedAssets EMBEDDED_ASSETS = TABLE;\n\n"
+        << "}// namespace http\n";
+
+    // only a changed table touches the output, so an unchanged site doesn't rebuild the server
+    std::string text = out.str();
+    std::ifstream old(argv[2], std::ios::binary);
+    std::stringstream current;
+    current << old.rdbuf();
+    if (old && current.str() == text)
+        return 0;
+    std::ofstream file(argv[2], std::ios::binary | std::ios::trunc);
+    file << text;
+    if (!file.flush()) {
+        std::cerr << argv[2] << ": write failed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "site_files.hpp"
+#include "bundle.hpp"
+#include "file_cache.hpp"
+#include "http_error.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+
+namespace http
+{
+
+static bool read_file(const std::filesystem::path &path, std::string &out)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+void collect_site_files(const std::filesystem::path &root, std::vector<SiteFile> &files, std::error_code &ec)
+{
+    for (auto iter = std::filesystem::recursive_directory_iterator(root, ec);
+        !ec && iter != std::filesystem::recursive_directory_iterator(); iter.increment(ec))
+    {
+        if (!iter->is_regular_file(ec))
+            continue;
+        SiteFile file;
+        file.path = std::filesystem::relative(iter->path(), root, ec).string();
+        if (ec)
+            return;
+        if (!read_file(iter->path(), file.raw)) {
+            ec = make_system_error(errno);
+            return;
+        }
+        compress_to_string(file.raw.data(), file.raw.size(), file.deflated, ec);
+        if (ec)
+            return;
+        if (file.deflated.size() >= file.raw.size())
+            file.deflated.clear();
+
+        // the content decides the ETag, so rebuilding an unchanged site keeps client caches valid
+        char etag[32];
+        snprintf(etag, sizeof(etag), "\"%016lx\"", (unsigned long)bundle_hash(file.raw));
+        file.etag = etag;
+        if (!file.deflated.empty()) {
+            snprintf(etag, sizeof(etag), "\"%016lx-z\"", (unsigned long)bundle_hash(file.raw));
+            file.deflatedEtag = etag;
+        }
+
+        struct stat st;
+        if (::stat(iter->path().c_str(), &st) == -1) {
+            ec = make_system_error(errno);
+            return;
+        }
+        file.mtime = st.st_mtime;
+        char lastModified[32];
+        struct tm tm;
+        time_t mtime = st.st_mtime;
+        strftime(lastModified, sizeof(lastModified), HTTP_DATE_FORMAT, gmtime_r(&mtime, &tm));
+        file.lastModified = lastModified;
+        file.type = file_extention2content_type(iter->path().extension().string().c_str());
+        files.push_back(std::move(file));
+    }
+    if (ec)
+        return;
+    // the same tree always gives the same output
+    std::sort(files.begin(), files.end(), [](const SiteFile &a, const SiteFile &b){ return a.path < b.path; });
+}
+
+}// namespace http
@@ -0,0 +1,31 @@
+#ifndef _SITE_FILES_HPP
+#define _SITE_FILES_HPP
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+#include "mime.hpp"
+
+namespace http
+{
+
+// A file of a doc root prepared for packing by the build tools
+struct SiteFile
+{
+    std::string path;
+    std::string raw;
+    std::string deflated; // empty if deflating does not make the file smaller
+    std::string etag;
+    std::string deflatedEtag; // empty if deflated is
+    std::string lastModified;
+    ContentType type;
+    int64_t mtime;
+};
+
+// reads and deflates every regular file below root, sorted by path
+void collect_site_files(const std::filesystem::path &root, std::vector<SiteFile> &files, std::error_code &ec);
+
+}// namespace http
+
+#endif